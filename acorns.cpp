@@ -79,6 +79,24 @@ void sq_threadyield()
   GIL_LOCK;
 }
 
+//Lets the garbage collector start sooner when the heap runs low
+SQInteger sq_getfreeheap()
+{
+  return ESP.getFreeHeap();
+}
+
+//Times the collector's pauses for gcstats()
+SQUnsignedInteger sq_getmicros()
+{
+  return micros();
+}
+
+//A random seed for the string hashes, so scripts can't pick keys that all collide
+SQHash sq_newhashseed()
+{
+  return esp_random();
+}
+
 //When setting the GIL we also set the active program.
 //This value is not valid when the GIL is unlocked.
 //It is also invalid when there isn't a logical "running program".
@@ -576,8 +594,9 @@ void deref_cb(CallbackData *p)
   {
     if (p->prog)
     {
-      sq_release(p->prog->vm, p->callable);
+      sq_releasehandle(p->prog->vm, p->handle);
     }
+    free(p->callable);
     //Setting the callable to 0 is the flag not
     //To try to call this callback anymore
     p->callable = 0;
@@ -640,11 +659,10 @@ struct CallbackData *_Acorns::acceptCallback(HSQUIRRELVM vm, SQInteger idx, void
   }
   sq_getstackobj(vm, idx, callable);
 
-  //This callback data is a ref to the callable
-  sq_addref(vm, callable);
-
   CallbackData *d = (CallbackData *)malloc(sizeof(CallbackData));
 
+  //This callback data is a ref to the callable
+  d->handle = sq_newhandle(vm, idx);
   d->callable = callable;
   d->cleanup = cleanup;
 
@@ -964,7 +982,7 @@ static int _closeProgram(const char *id)
       //The way we close the VM is to get rid of references to its thread object.
       if ((*old)->vm)
       {
-        sq_release((*old)->vm, &((*old)->threadObj));
+        sq_releasehandle((*old)->vm, (*old)->threadHandle);
         (*old)->vm = 0;
       }
       deref_prog(*old);
@@ -1145,12 +1163,32 @@ static int _loadProgram(const char *code, const char *id, bool synchronous,
       
       vm = loadedPrograms[i]->vm;
       sq_setforeignptr(vm, loadedPrograms[i]);
-      sq_resetobject(&loadedPrograms[i]->threadObj);
 
-      //Get the thread handle, ref it so it doesn't go away, then store it in the loadedProgram
+      //Everything the program allocates gets charged to its own account.
+      //In shared mode there's only one VM so there's nothing to tell programs apart by.
+      if (sharedMode == false)
+      {
+        char quotabuf[16];
+        char onquotabuf[8];
+        Acorns.getConfig("mem.quota", "0", quotabuf, 16);
+        Acorns.getConfig("mem.onquota", "error", onquotabuf, 8);
+        SQMemAccount *account = sq_newmemaccount(strtoul(quotabuf, 0, 10), strcmp(onquotabuf, "close") == 0);
+        if (account)
+        {
+          sq_setmemaccount(vm, account);
+          //The VM holds its own reference
+          sq_releasememaccount(account);
+        }
+      }
+      //"lines" keeps just enough debug info for errors to say where they happened
+      char debuginfobuf[8];
+      Acorns.getConfig("mem.debuginfo", "full", debuginfobuf, 8);
+      sq_striplocals(vm, strcmp(debuginfobuf, "lines") == 0);
+
+      SQMemAccount *prevAccount = sq_setcurrentmemaccount(sq_getmemaccount(vm));
+      //Pin the thread so it doesn't go away, store the handle in the loadedProgram
       //and pop it. Now the thread is independant
-      sq_getstackobj(rootInterpreter->vm, -1, &loadedPrograms[i]->threadObj);
-      sq_addref(vm, &loadedPrograms[i]->threadObj);
+      loadedPrograms[i]->threadHandle = sq_newhandle(rootInterpreter->vm, -1);
       sq_pop(rootInterpreter->vm, 1);
 
       //Make a new table as the root table of the VM, then set root aa it's delegate(The root table that is shared with the parent)
@@ -1178,7 +1216,10 @@ static int _loadProgram(const char *code, const char *id, bool synchronous,
       loadedPrograms[i]->busy = 0;
       loadedPrograms[i]->vm = vm;
 
-      if (SQ_SUCCEEDED(sq_compilebuffer(vm, code, strlen(code) + 1, _SC(id), SQTrue)))
+      SQRESULT compiled = sq_compilebuffer(vm, code, strlen(code) + 1, _SC(id), SQTrue);
+      sq_setcurrentmemaccount(prevAccount);
+
+      if (SQ_SUCCEEDED(compiled))
       {
         if (inputBufToFree)
         {
@@ -1953,6 +1994,7 @@ static void addlibs(HSQUIRRELVM v)
   sqstd_register_systemlib(v);
   sqstd_register_mathlib(v);
   sqstd_register_stringlib(v);
+  sqstd_register_jsonlib(v);
   sq_pop(v, 1);
 
 }
@@ -2003,6 +2045,249 @@ static SQInteger sqfreeheap(HSQUIRRELVM v)
   return (1);
 }
 
+/*********************************************************************/
+//VM counters
+
+//Only does anything when the VM is built with SQ_INSTRUMENT, returns 1 otherwise.
+int _Acorns::getCounters(const char *id, SQVMCounters *c)
+{
+  GIL_LOCK;
+  loadedProgram *p = _programForId(id);
+  if ((p == 0) || (p->vm == 0))
+  {
+    GIL_UNLOCK;
+    return 1;
+  }
+  SQRESULT r = sq_getcounters(p->vm, c);
+  //getcounters leaves an error on failure, we don't want it hanging around in the VM
+  sq_reseterror(p->vm);
+  GIL_UNLOCK;
+  return SQ_FAILED(r) ? 1 : 0;
+}
+
+/*********************************************************************/
+//Sampling profiler
+
+//Every program runs in its own VM thread, so the profiler for a program
+//is just the profiler of that VM. Samples are taken at the same point where we yield the GIL.
+
+static SQInteger sqprofilerstart(HSQUIRRELVM v)
+{
+  SQInteger slots = ACORNS_PROFILER_SLOTS;
+  if (sq_gettop(v) > 1)
+  {
+    if (sq_getinteger(v, 2, &slots) == SQ_ERROR)
+    {
+      return sq_throwerror_f(v, F("Expected an integer number of slots"));
+    }
+  }
+  return sq_startprofiler(v, slots);
+}
+
+static SQInteger sqprofilerstop(HSQUIRRELVM v)
+{
+  sq_stopprofiler(v);
+  return 0;
+}
+
+static SQInteger sqprofilerdump(HSQUIRRELVM v)
+{
+  sq_pushprofile(v);
+  return 1;
+}
+
+int _Acorns::startProfiler(const char *id, int slots)
+{
+  GIL_LOCK;
+  loadedProgram *p = _programForId(id);
+  if ((p == 0) || (p->vm == 0))
+  {
+    GIL_UNLOCK;
+    return 1;
+  }
+  if (SQ_FAILED(sq_startprofiler(p->vm, slots)))
+  {
+    GIL_UNLOCK;
+    return 1;
+  }
+  GIL_UNLOCK;
+  return 0;
+}
+
+int _Acorns::startProfiler(const char *id)
+{
+  return startProfiler(id, ACORNS_PROFILER_SLOTS);
+}
+
+void _Acorns::stopProfiler(const char *id)
+{
+  GIL_LOCK;
+  loadedProgram *p = _programForId(id);
+  if (p && p->vm)
+  {
+    sq_stopprofiler(p->vm);
+  }
+  GIL_UNLOCK;
+}
+
+//Print the histogram, hottest first, as "hits function source:line"
+void _Acorns::dumpProfiler(const char *id, Print &out)
+{
+  GIL_LOCK;
+  loadedProgram *p = _programForId(id);
+  if ((p == 0) || (p->vm == 0))
+  {
+    GIL_UNLOCK;
+    return;
+  }
+
+  SQUnsignedInteger dropped = 0;
+  SQInteger n = sq_getprofilesize(p->vm, &dropped);
+  SQProfileSample ps;
+
+  for (SQInteger i = 0; i < n; i++)
+  {
+    sq_getprofilesample(p->vm, i, &ps);
+    out.print((unsigned long)ps.hits);
+    out.print("\t");
+    out.print(ps.funcname);
+    out.print("\t");
+    out.print(ps.source);
+    out.print(":");
+    out.println((long)ps.line);
+  }
+  if (dropped)
+  {
+    out.print((unsigned long)dropped);
+    out.println(F(" samples did not fit in the histogram"));
+  }
+  GIL_UNLOCK;
+}
+
+//Returns an array with a table of stats for each size class of the VM pool allocator,
+//and one last entry with blocksize 0 for the allocations too big for the pool.
+//Throws if the pool allocator isn't enabled.
+static SQInteger sqpoolstats(HSQUIRRELVM v)
+{
+  SQPoolStats ps;
+  if (SQ_FAILED(sq_getpoolstats(0, &ps)))
+  {
+    return sq_throwerror_f(v, F("Squirrel was built without SQ_POOL_ALLOCATOR"));
+  }
+  sq_newarray(v, 0);
+  for (SQInteger i = 0; SQ_SUCCEEDED(sq_getpoolstats(i, &ps)); i++)
+  {
+    sq_newtableex(v, 5);
+    sq_pushstring(v, "blocksize", -1);
+    sq_pushinteger(v, ps.blocksize);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, "slabs", -1);
+    sq_pushinteger(v, ps.slabs);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, "used", -1);
+    sq_pushinteger(v, ps.used);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, "free", -1);
+    sq_pushinteger(v, ps.free);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, "requested", -1);
+    sq_pushinteger(v, ps.requested);
+    sq_newslot(v, -3, SQFalse);
+    sq_arrayappend(v, -2);
+  }
+  return 1;
+}
+
+//Returns an array of two tables, for internal RAM and PSRAM, with inuse, peak, blocks
+//and spilled, see sq_getmemtierstats(). Throws without SQ_MEM_ACCOUNTING.
+static SQInteger sqmemtiers(HSQUIRRELVM v)
+{
+  SQMemTierStats ts;
+  if (SQ_FAILED(sq_getmemtierstats(0, &ts)))
+  {
+    return sq_throwerror_f(v, F("Squirrel was built without SQ_MEM_ACCOUNTING"));
+  }
+  sq_newarray(v, 0);
+  for (SQInteger i = 0; SQ_SUCCEEDED(sq_getmemtierstats(i, &ts)); i++)
+  {
+    sq_newtableex(v, 4);
+    sq_pushstring(v, "inuse", -1);
+    sq_pushinteger(v, ts.inuse);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, "peak", -1);
+    sq_pushinteger(v, ts.peak);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, "blocks", -1);
+    sq_pushinteger(v, ts.blocks);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, "spilled", -1);
+    sq_pushinteger(v, ts.spilled);
+    sq_newslot(v, -3, SQFalse);
+    sq_arrayappend(v, -2);
+  }
+  return 1;
+}
+
+/*********************************************************************/
+//Memory accounting
+
+//Returns a table of current, peak, and quota in bytes for the calling program,
+//or null if it isn't being tracked.
+static SQInteger sqmemusage(HSQUIRRELVM v)
+{
+  SQMemAccount *a = sq_getmemaccount(v);
+  if (a == 0)
+  {
+    sq_pushnull(v);
+    return 1;
+  }
+  sq_newtableex(v, 3);
+  sq_pushstring(v, "current", -1);
+  sq_pushinteger(v, a->current);
+  sq_newslot(v, -3, SQFalse);
+  sq_pushstring(v, "peak", -1);
+  sq_pushinteger(v, a->peak);
+  sq_newslot(v, -3, SQFalse);
+  sq_pushstring(v, "quota", -1);
+  sq_pushinteger(v, a->quota);
+  sq_newslot(v, -3, SQFalse);
+  return 1;
+}
+
+//Copies the program's account into usage, returns 1 if the program isn't running or isn't tracked.
+int _Acorns::getMemoryUsage(const char *id, SQMemAccount *usage)
+{
+  GIL_LOCK;
+  loadedProgram *p = _programForId(id);
+  if ((p == 0) || (p->vm == 0) || (sq_getmemaccount(p->vm) == 0))
+  {
+    GIL_UNLOCK;
+    return 1;
+  }
+  *usage = *sq_getmemaccount(p->vm);
+  GIL_UNLOCK;
+  return 0;
+}
+
+//0 bytes means no limit. If forceClose is set the program is stopped when it goes over,
+//otherwise it gets an exception it can catch.
+int _Acorns::setMemoryQuota(const char *id, unsigned long bytes, bool forceClose)
+{
+  GIL_LOCK;
+  loadedProgram *p = _programForId(id);
+  if ((p == 0) || (p->vm == 0) || (sq_getmemaccount(p->vm) == 0))
+  {
+    GIL_UNLOCK;
+    return 1;
+  }
+  SQMemAccount *a = sq_getmemaccount(p->vm);
+  a->quota = bytes;
+  a->closeonquota = forceClose;
+  a->exceeded = (bytes && (a->current > bytes)) ? SQTrue : SQFalse;
+  GIL_UNLOCK;
+  return 0;
+}
+
 //Initialize squirrel task management
 void _Acorns::begin(const char *prgsdir)
 {
@@ -2060,6 +2345,13 @@ void _Acorns::begin(const char *prgsdir)
   loadConfig();
   Serial.print("Loaded Config");
 
+  //Smaller slices mean shorter GC pauses but cycles that take longer to finish
+  sq_setgcslice(rootInterpreter->vm, Acorns.getConfig("gc.slice", String(SQ_GC_SLICE)).toInt());
+  sq_setgctrigger(rootInterpreter->vm, Acorns.getConfig("gc.ratio", String(SQ_GC_RATIO)).toInt(),
+                  Acorns.getConfig("gc.lowheap", String(SQ_GC_LOWHEAP)).toInt());
+  //Only affects what gets allocated from here on, the root VM's own stack is already placed
+  sq_setmemlargesize(Acorns.getConfig("mem.largesize", String(SQ_MEM_LARGESIZE)).toInt());
+
   //Set the root table dynamic functions delegate;
   /*
   sq_pushroottable(rootInterpreter->vm);
@@ -2100,6 +2392,12 @@ void _Acorns::begin(const char *prgsdir)
   registerFunction(0, sqcloseProgram, "forceClose");
   registerFunction(0, sqexit, "exit");
   registerFunction(0, sqformat, "formatSPIFFS");
+  registerFunction(0, sqprofilerstart, "profilerStart");
+  registerFunction(0, sqprofilerstop, "profilerStop");
+  registerFunction(0, sqprofilerdump, "profilerDump");
+  registerFunction(0, sqpoolstats, "poolStats");
+  registerFunction(0, sqmemusage, "memUsage");
+  registerFunction(0, sqmemtiers, "memTiers");
  
 
 
@@ -2107,7 +2405,7 @@ void _Acorns::begin(const char *prgsdir)
   sq_setprintfunc(rootInterpreter->vm, _printfunc, _errorfunc);
 
 
-  //addlibs(rootInterpreter->vm);
+  addlibs(rootInterpreter->vm);
   Serial.println(F("Added core libraries"));
 
   //This is part of the class, it's in acorns_aduinobindings
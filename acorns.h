@@ -31,6 +31,7 @@ extern "C"
 #include "utility/sqstdio.h"
 #include "utility/sqstdmath.h"
 #include "utility/sqstdstring.h"
+#include "utility/sqstdjson.h"
 #include "utility/sqstdaux.h"
 }
 #include "utility/minIni.h"
@@ -88,6 +89,16 @@ public:
   int loadFromDir(const char *dir);
 
   String getQuote();
+
+  int startProfiler(const char *id);
+  int startProfiler(const char *id, int slots);
+  void stopProfiler(const char *id);
+  void dumpProfiler(const char *id, Print &out);
+
+  int getCounters(const char *id, SQVMCounters *c);
+
+  int getMemoryUsage(const char *id, SQMemAccount *usage);
+  int setMemoryQuota(const char *id, unsigned long bytes, bool forceClose);
 };
 
 #define PROG_HASH_LEN 24
@@ -124,7 +135,7 @@ struct loadedProgram
 
   //We often use sq_newthread, this is where we store the thread handle so
   //We don't have to clutter up a VM namespace.
-  HSQOBJECT threadObj;
+  HSQHANDLE threadHandle;
 
   //A parent proram, used because we don't want to stop a running program's parent
   struct loadedProgram *parent;
@@ -164,6 +175,8 @@ struct CallbackData
   //The actual callable that gets called when the callback happens
   //
   HSQOBJECT *callable;
+  //Keeps the callable alive until the callback is released
+  HSQHANDLE handle;
 
   void *userpointer;
   void (*cleanup)(struct loadedProgram *, void *);
@@ -194,4 +207,7 @@ extern SemaphoreHandle_t _acorns_gil_lock;
 #define ACORNS_MAXPROGRAMS 8
 #endif
 
+//Default number of distinct function/line pairs the sampling profiler keeps per program
+#define ACORNS_PROFILER_SLOTS 32
+
 #define dbg(x) Serial.println(x)
\ No newline at end of file
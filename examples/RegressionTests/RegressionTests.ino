@@ -0,0 +1,156 @@
+/*
+  Scripts for bugs that have been fixed, run through the interpreter like any other program.
+  Each one prints PASS or FAIL and what it checked.
+*/
+#include "acorns.h"
+
+//A collection finishing inside a callback must not free what the native calling it is still building
+static const char *gcCallbacks =
+  "local src = [];\n"
+  "for(local i = 0; i < 200; i++) src.append(i);\n"
+  "local m = src.map(function(x) { gcstep(); return [x]; });\n"
+  "local f = src.filter(function(i, x) { gcstep(); return [x][0] % 2 == 0; });\n"
+  "local s = clone src;\n"
+  "s.sort(function(a, b) { gcstep(); return [b][0] <=> [a][0]; });\n"
+  "local ok = m.len() == 200 && f.len() == 100 && s[0] == 199 && s[199] == 0;\n"
+  "foreach(i, x in m) if(x.len() != 1 || x[0] != i) ok = false;\n"
+  "print((ok ? \"PASS\" : \"FAIL\") + \" gc step in map, filter and sort callbacks\");\n";
+
+//The same for a pipeline, whose output and accumulator are built up while the stages are called
+static const char *gcPipeline =
+  "local src = [];\n"
+  "for(local i = 0; i < 300; i++) src.append(i);\n"
+  "local out = src.iter().map(function(x) { gcstep(); return [x]; }).filter(function(x) { gcstep(); return x[0] % 2 == 0; }).collect();\n"
+  "local sum = src.iter().map(function(x) { gcstep(); return {v = x}; }).reduce(function(a, b) { gcstep(); return {v = a.v + b.v}; });\n"
+  "local ok = out.len() == 150 && sum.v == 44850;\n"
+  "foreach(i, x in out) if(x[0] != i * 2) ok = false;\n"
+  "print((ok ? \"PASS\" : \"FAIL\") + \" gc step in pipeline stages\");\n";
+
+//The standard libraries have to be reachable from programs, through the root interpreter
+static const char *stdLibs =
+  "local ok = jsondecode(jsonencode({a = [1, 2.5, \"x\"]})).a[2] == \"x\";\n"
+  "local b = blob(4);\n"
+  "b.writen(0x1234, 'w');\n"
+  "ok = ok && b.len() == 4 && unpack(\"<h\", pack(\"<h\", -2))[0] == -2;\n"
+  "ok = ok && msgunpack(msgpack([7, \"y\"]))[1] == \"y\" && Int16Array([1, 2, 3]).sum() == 6;\n"
+  "ok = ok && regexp(\"a+\").match(\"aa\") && format(\"%d\", 5) == \"5\" && fabs(-1.0) == 1.0;\n"
+  "local sb = stringbuilder();\n"
+  "sb.append(\"p\", 1);\n"
+  "ok = ok && sb.tostring() == \"p1\" && typeof time() == \"integer\";\n"
+  "print((ok ? \"PASS\" : \"FAIL\") + \" json, blob, pack, msgpack, typed arrays, string, math and system libraries\");\n";
+
+//sortby keys only exist in the native doing the sort until it's finished, they must stay reachable
+static const char *gcSortBy =
+  "class Key { v = 0; constructor(x) { v = x; } function _cmp(o) { gcstep(); return v <=> o.v; } }\n"
+  "local src = [];\n"
+  "for(local i = 0; i < 200; i++) src.append(i);\n"
+  "src.sortby(function(x) { gcstep(); return Key(-x); });\n"
+  "local ok = src.len() == 200;\n"
+  "foreach(i, x in src) if(x != 199 - i) ok = false;\n"
+  "print((ok ? \"PASS\" : \"FAIL\") + \" gc step in sortby key function and key _cmp\");\n";
+
+//Compiled patterns stay in the shared regexp cache after the program is gone, so they can't be charged to it
+static const char *rexCache =
+  "local before = memUsage().current;\n"
+  "local r = regexp(\"(\\\\d+)-(\\\\d+)\");\n"
+  "local ok = r.match(\"12-34\");\n"
+  "r = null;\n"
+  "collectgarbage();\n"
+  "local kept = memUsage().current - before;\n"
+  "print((ok && kept == 0 ? \"PASS\" : \"FAIL\") + \" cached regexp left \" + kept + \" bytes charged to the program\");\n";
+
+//Line events come from the line table, another VM running in between must not make the hook miss any
+static const char *lineHook =
+  "local seen = {};\n"
+  "::hookthread <- newthread(function() { return 1; });\n"
+  "local f = compilestring(\"local a = hookthread.call()\\nlocal b = a + 1\\nlocal c = b * 2\\nreturn c\\n\", \"traced\");\n"
+  "setdebughook(function(type, src, line, fname) { if(type == 'l' && src == \"traced\") seen[line] <- true; });\n"
+  "local r = f();\n"
+  "setdebughook(null);\n"
+  "print((r == 4 && seen.len() == 4 ? \"PASS\" : \"FAIL\") + \" line hook saw \" + seen.len() + \" of 4 lines around a thread call\");\n";
+
+//The hook carries on through the line table from where it got to, loops, calls, returns and a throw must still
+//give the same lines as a scan from the start would
+static const char *lineHookOrder =
+  "local ev = [];\n"
+  "local src = \"local s = 0\\nfunction add(a, b) {\\n  local c = a + b\\n  return c\\n}\\n\"\n"
+  "  + \"for(local i = 0; i < 3; i++) {\\n  if(i % 2 == 0)\\n    s = add(s, i)\\n  else {\\n    s += 10\\n  }\\n\"\n"
+  "  + \"  foreach(x in [1, 2]) s += x\\n}\\ntry {\\n  throw \\\"e\\\"\\n} catch(e) {\\n  s += 100\\n}\\nreturn s\\n\";\n"
+  "local f = compilestring(src, \"traced\");\n"
+  "setdebughook(function(type, file, line, fname) { if(type == 'l' && file == \"traced\") ev.append(line); });\n"
+  "local r = f();\n"
+  "setdebughook(null);\n"
+  "local got = \"\";\n"
+  "foreach(l in ev) got += \" \" + l;\n"
+  "local ok = r == 121 && got == \" 1 2 6 7 8 3 4 12 7 10 12 7 8 3 4 12 14 15 17 19\";\n"
+  "print((ok ? \"PASS\" : \"FAIL\") + \" line hook order through loops and calls:\" + got);\n";
+
+//A bin32 header can claim 2GB, msgunpack must find the source too short before allocating for it
+static const char *msgpackLength =
+  "local bad = blob();\n"
+  "foreach(c in [0xc6, 0x7f, 0xff, 0xff, 0xff]) bad.writen(c, 'b');\n"
+  "bad.writes(\"abc\");\n"
+  "bad.seek(0);\n"
+  "local before = memUsage().peak;\n"
+  "local err = null;\n"
+  "try { msgunpack(bad); } catch(e) { err = e; }\n"
+  "local grew = memUsage().peak - before;\n"
+  "print((err == \"truncated data\" && grew < 4096 ? \"PASS\" : \"FAIL\") + \" msgunpack of a 2GB bin header from a short blob: \" + err + \", peak grew \" + grew);\n";
+
+//Compiler scratch has to be given back as each function is finished, not when the whole script is.
+//The peak while compiling, less what the compiled functions keep, has to stay below what they keep.
+static const char *compilePeak =
+  "local sb = stringbuilder();\n"
+  "for(local i = 0; i < 300; i++) sb.append(\"function f\", i, \"(a) { local b = a * \", i, \"; return b + 1; }\\n\");\n"
+  "sb.append(\"return f299(2);\");\n"
+  "local src = sb.tostring();\n"
+  "sb = null;\n"
+  "local before = memUsage();\n"
+  "local f = compilestring(src);\n"
+  "local after = memUsage();\n"
+  "local kept = after.current - before.current;\n"
+  "local scratch = after.peak - before.current - kept;\n"
+  "local ok = f() == 599 && scratch < kept;\n"
+  "print((ok ? \"PASS\" : \"FAIL\") + \" compiling 300 functions took \" + scratch + \" bytes of scratch, \" + kept + \" kept\");\n";
+
+//With the free heap below gc.lowheap, a cycle must still leave some room before the next one starts.
+//Raising lowheap past any real heap puts it there, and the threshold used to come out as 0 bytes of growth.
+static const char *gcLowHeap =
+  "local old = gcstats();\n"
+  "setgctrigger(old.ratio, 0x7fffffff);\n"
+  "collectgarbage();\n"
+  "local st = gcstats();\n"
+  "setgctrigger(old.ratio, old.lowheap);\n"
+  "local room = st.threshold - st.inuse;\n"
+  "print((room > 0 ? \"PASS\" : \"FAIL\") + \" room before the next cycle with a low free heap: \" + room);\n";
+
+//sum and dot of large Int32Array values are worked out in 64 bits, and have to come back that big,
+//as a float where integers are 32 bit, instead of wrapped around
+static const char *typedSum =
+  "local a = Int32Array([2000000000, 2000000000]);\n"
+  "local s = a.sum();\n"
+  "local d = Int32Array([100000, 100000]).dot(Int32Array([100000, 100000]));\n"
+  "local m = a.dot(Int16Array([2, 2]));\n"
+  "local ok = s == 4000000000.0 && d == 20000000000.0 && m == 8000000000.0;\n"
+  "print((ok ? \"PASS\" : \"FAIL\") + \" Int32Array sum and dot past 32 bits: \" + s + \" \" + d + \" \" + m);\n";
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println("**starting up**");
+  Acorns.begin();
+
+  Acorns.runProgram(stdLibs, "stdlibs");
+  Acorns.runProgram(gcCallbacks, "gccallbacks");
+  Acorns.runProgram(gcPipeline, "gcpipeline");
+  Acorns.runProgram(gcSortBy, "gcsortby");
+  Acorns.runProgram(rexCache, "rexcache");
+  Acorns.runProgram(lineHook, "linehook");
+  Acorns.runProgram(lineHookOrder, "linehookorder");
+  Acorns.runProgram(msgpackLength, "msgpacklength");
+  Acorns.runProgram(compilePeak, "compilepeak");
+  Acorns.runProgram(gcLowHeap, "gclowheap");
+  Acorns.runProgram(typedSum, "typedsum");
+}
+
+void loop() {
+}
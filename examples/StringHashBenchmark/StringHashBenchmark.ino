@@ -0,0 +1,71 @@
+/*
+  Compares the old sampling string hash with the full length one the VM uses now.
+  Paths and JSON keys share long prefixes, which the old hash mostly skipped over.
+  Prints the bucket chains both hashes give for the same keys, then times interning
+  and table lookups in a script and shows the VM's own string table.
+*/
+#include "acorns.h"
+//For _hashstr, which is internal to the VM
+#include "utility/sqpcheader.h"
+#include "utility/sqstring.h"
+
+#define NKEYS 2000
+#define NBUCKETS 2048
+
+//What _hashstr used to be, it only looked at every (l>>5)|1'th character
+static SQHash oldHash(const char *s, size_t l)
+{
+  SQHash h = (SQHash)l;
+  size_t step = (l >> 5) | 1;
+  for (; l >= step; l -= step)
+    h = h ^ ((h << 5) + (h >> 2) + (unsigned short) * (s++));
+  return h;
+}
+
+static unsigned short buckets[NBUCKETS];
+
+static void chainStats(const char *name, bool old)
+{
+  char key[96];
+  memset(buckets, 0, sizeof(buckets));
+  for (int i = 0; i < NKEYS; i++)
+  {
+    int l = snprintf(key, sizeof(key), "/spiffs/data/sensors/temperature/logs/reading_%d.json", i);
+    SQHash h = old ? oldHash(key, l) : _hashstr(key, l, 0);
+    buckets[h & (NBUCKETS - 1)]++;
+  }
+  int used = 0, longest = 0;
+  for (int i = 0; i < NBUCKETS; i++)
+  {
+    if (buckets[i]) used++;
+    if (buckets[i] > longest) longest = buckets[i];
+  }
+  Serial.printf("%s: %d keys in %d of %d buckets, longest chain %d\n", name, NKEYS, used, NBUCKETS, longest);
+}
+
+static const char *bench =
+  "local start = clock();\n"
+  "local keep = [];\n"
+  "for(local i=0;i<2000;i++) keep.append(\"/spiffs/data/sensors/temperature/logs/reading_\" + i + \".json\");\n"
+  "print(\"interning: \" + (clock()-start) + \"s\");\n"
+  "local t = {};\n"
+  "foreach(k in keep) t[k] <- 1;\n"
+  "start = clock();\n"
+  "local s = 0;\n"
+  "for(local r=0;r<10;r++) foreach(k in keep) s += t[k];\n"
+  "print(\"20000 lookups: \" + (clock()-start) + \"s\");\n"
+  "local st = stringstats();\n"
+  "print(\"string table: \" + st.strings + \" strings, \" + st.usedslots + \" of \" + st.slots + \" slots used, longest chain \" + st.longestchain);\n";
+
+void setup() {
+  Serial.begin(115200);
+  Serial.println("**starting up**");
+  Acorns.begin();
+
+  chainStats("old hash", true);
+  chainStats("new hash", false);
+  Acorns.runProgram(bench, "bench");
+}
+
+void loop() {
+}
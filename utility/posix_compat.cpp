@@ -6,6 +6,7 @@
 #include "posix_compat.h"
 
 #include <stdint.h>
+#include <string.h>
 
 struct FakePosixDirEntryObj MostRecentlyOpenedDirectory;
 static bool hasSpiffs = false;
@@ -82,36 +83,44 @@ FILE *fake_fopen(const char *name, const char *mode)
 
 size_t fread(void *ptr, size_t size, size_t count, FILE *stream)
 {
-  stream->readBytes((char *)ptr, size * count);
+  if (size == 0)
+  {
+    return 0;
+  }
+  return stream->read((uint8_t *)ptr, size * count) / size;
 }
 
 size_t fwrite(const void *ptr, size_t size, size_t count, FILE *stream)
 {
-  stream->write((const uint8_t *)ptr, size * count);
+  if (size == 0)
+  {
+    return 0;
+  }
+  return stream->write((const uint8_t *)ptr, size * count) / size;
 }
+
+//Reads a chunk in one go and seeks back over whatever followed the newline,
+//instead of asking SPIFFS for one byte at a time
 char *fgets(char *str, int num, FILE *stream)
 {
-  int b;
-  int p = 0;
-  while (num)
+  if (num <= 1)
   {
-    if ((b = stream->read()) < 0)
-    {
-      if (p)
-      {
-        return (str);
-      }
-      else
-      {
-        return 0;
-      }
-    }
-
-    *str = b;
-    str++;
-    p++;
-    num--;
+    return 0;
+  }
+  int n = stream->read((uint8_t *)str, num - 1);
+  if (n <= 0)
+  {
+    return 0;
+  }
+  char *nl = (char *)memchr(str, '\n', n);
+  if (nl)
+  {
+    int used = nl - str + 1;
+    stream->seek(stream->position() - (n - used), SeekSet);
+    n = used;
   }
+  str[n] = 0;
+  return str;
 }
 
 int fgetc(FILE *stream)
@@ -120,7 +129,7 @@ int fgetc(FILE *stream)
 }
 int fseek(FILE *stream, long int offset, SeekMode origin)
 {
-  stream->seek(offset, origin);
+  return stream->seek(offset, origin) ? 0 : -1;
 }
 
 void rewind(FILE *stream)
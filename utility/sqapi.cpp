@@ -33,6 +33,19 @@ static bool sq_aux_gettypedarg(HSQUIRRELVM v,SQInteger idx,SQObjectType type,SQO
 
 
 
+//Charge v's allocations to a, which may be NULL. v keeps a reference to it.
+void sq_setmemaccount(HSQUIRRELVM v,SQMemAccount *a)
+{
+    if(a) a->refs++;
+    if(v->_memaccount) sq_releasememaccount(v->_memaccount);
+    v->_memaccount = a;
+}
+
+SQMemAccount *sq_getmemaccount(HSQUIRRELVM v)
+{
+    return v->_memaccount;
+}
+
 SQInteger sq_request_forceclose(HSQUIRRELVM v)
 {
     v->stopRequestedFlag = true;
@@ -168,6 +181,12 @@ void sq_enabledebuginfo(HSQUIRRELVM v, SQBool enable)
     _ss(v)->_debuginfo = enable?true:false;
 }
 
+//Line info is always kept, errors need it. Only debuggers ever look at locals.
+void sq_striplocals(HSQUIRRELVM v, SQBool strip)
+{
+    v->_striplocals = strip?true:false;
+}
+
 void sq_notifyallexceptions(HSQUIRRELVM v, SQBool enable)
 {
     _ss(v)->_notifyallexceptions = enable?true:false;
@@ -183,6 +202,35 @@ void sq_addref(HSQUIRRELVM v,HSQOBJECT *po)
 #endif
 }
 
+//Pins the object at idx until sq_releasehandle(), in constant time. The handle is a slot
+//index that stays valid until it's released, after which it may be handed out again.
+HSQHANDLE sq_newhandle(HSQUIRRELVM v,SQInteger idx)
+{
+    return _ss(v)->_handles.Add(stack_get(v,idx));
+}
+
+SQRESULT sq_pushhandle(HSQUIRRELVM v,HSQHANDLE h)
+{
+    SQObjectPtr *o = _ss(v)->_handles.Get(h);
+    if(!o) return sq_throwerror(v,_SC("invalid handle"));
+    v->Push(*o);
+    return SQ_OK;
+}
+
+SQRESULT sq_gethandleobj(HSQUIRRELVM v,HSQHANDLE h,HSQOBJECT *po)
+{
+    SQObjectPtr *o = _ss(v)->_handles.Get(h);
+    if(!o) return sq_throwerror(v,_SC("invalid handle"));
+    *po = *o;
+    return SQ_OK;
+}
+
+SQRESULT sq_releasehandle(HSQUIRRELVM v,HSQHANDLE h)
+{
+    if(!_ss(v)->_handles.Release(h)) return sq_throwerror(v,_SC("invalid handle"));
+    return SQ_OK;
+}
+
 SQUnsignedInteger sq_getrefcount(HSQUIRRELVM v,HSQOBJECT *po)
 {
     if(!ISREFCOUNTED(sq_type(*po))) return 0;
@@ -208,7 +256,7 @@ SQBool sq_release(HSQUIRRELVM v,HSQOBJECT *po)
 SQUnsignedInteger sq_getvmrefcount(HSQUIRRELVM SQ_UNUSED_ARG(v), const HSQOBJECT *po)
 {
     if (!ISREFCOUNTED(sq_type(*po))) return 0;
-    return po->_unVal.pRefCounted->_uiRef;
+    return po->_unVal.pRefCounted->_uiRef & SQ_REFCOUNT_MASK;
 }
 
 const SQChar *sq_objtostring(const HSQOBJECT *o)
@@ -259,10 +307,21 @@ void sq_pushnull(HSQUIRRELVM v)
 void sq_pushstring(HSQUIRRELVM v,const SQChar *s,SQInteger len)
 {
     if(s)
-        v->Push(SQObjectPtr(SQString::Create(_ss(v), s, len)));
+        v->Push(SQObjectPtr(SQString::CreateTransient(_ss(v), s, (len < 0) ? (SQInteger)scstrlen(s) : len)));
     else v->PushNull();
 }
 
+//Pushes a string of len characters and returns them for the caller to fill in, before
+//anything else sees the string. Only for lengths of at least SQ_TRANSIENT_MINLEN, shorter
+//strings are interned by their contents, which aren't known yet, so it returns NULL for those.
+SQChar *sq_pushnewstring(HSQUIRRELVM v,SQInteger len)
+{
+    if(len < SQ_TRANSIENT_MINLEN) return NULL;
+    SQString *s = _ss(v)->_stringtable->NewTransient(len);
+    v->Push(SQObjectPtr(s));
+    return s->_val;
+}
+
 void sq_pushinteger(HSQUIRRELVM v,SQInteger n)
 {
     v->Push(n);
@@ -1202,6 +1261,7 @@ SQRESULT sq_reservestack(HSQUIRRELVM v,SQInteger nsize)
         if(v->_nmetamethodscall) {
             return sq_throwerror(v,_SC("cannot resize stack while in a metamethod"));
         }
+        SQMemPlacement fast(SQ_MEMTIER_FAST);
         v->_stack.resize(v->_stack.size() + ((v->_top + nsize) - v->_stack.size()));
     }
     return SQ_OK;
@@ -1368,6 +1428,54 @@ SQInteger sq_collectgarbage(HSQUIRRELVM v)
 #endif
 }
 
+//Does one slice of incremental collection, starting a new cycle if none is in progress.
+//Once started the cycle keeps going a slice at a time whenever a VM yields.
+//Returns SQTrue if this slice finished the cycle.
+SQBool sq_gcstep(HSQUIRRELVM v)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    return _ss(v)->GCStep(v,_ss(v)->_gcslice) ? SQTrue : SQFalse;
+#else
+    return SQTrue;
+#endif
+}
+
+void sq_setgcslice(HSQUIRRELVM v,SQInteger nobjects)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    _ss(v)->_gcslice = nobjects > 0 ? nobjects : 1;
+#endif
+}
+
+//ratio is how big the VM heap can get, as a percentage of what's in use after a cycle,
+//before the next one starts on its own. lowheap is the free system heap below which that allowance
+//shrinks. Takes effect after the next cycle.
+void sq_setgctrigger(HSQUIRRELVM v,SQInteger ratio,SQInteger lowheap)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    _ss(v)->_gcratio = ratio <= 0 ? 0 : (ratio > 100 ? ratio : 100);
+    _ss(v)->_gclowheap = lowheap > 0 ? lowheap : 1;
+#endif
+}
+
+SQRESULT sq_getgcstats(HSQUIRRELVM v,SQGCStats *st)
+{
+#ifndef NO_GARBAGE_COLLECTOR
+    *st = _ss(v)->_gcstats;
+    st->inuse = sq_getmeminuse();
+    st->ratio = _ss(v)->_gcratio;
+    st->lowheap = _ss(v)->_gclowheap;
+    return SQ_OK;
+#else
+    return sq_throwerror(v,_SC("sq_getgcstats requires a garbage collector build"));
+#endif
+}
+
+void sq_getstringtablestats(HSQUIRRELVM v,SQStringTableStats *st)
+{
+    _ss(v)->_stringtable->GetStats(st);
+}
+
 SQRESULT sq_getcallee(HSQUIRRELVM v)
 {
     if(v->_callsstacksize > 1)
@@ -1423,6 +1531,7 @@ SQRESULT sq_setfreevariable(HSQUIRRELVM v,SQInteger idx,SQUnsignedInteger nval)
     case OT_NATIVECLOSURE:
         if(_nativeclosure(self)->_noutervalues > nval){
             _nativeclosure(self)->_outervalues[nval] = stack_get(v,-1);
+            SQ_BARRIER(_nativeclosure(self),stack_get(v,-1));
         }
         else return sq_throwerror(v,_SC("invalid free var index"));
         break;
@@ -1443,6 +1552,7 @@ SQRESULT sq_setattributes(HSQUIRRELVM v,SQInteger idx)
     if(sq_type(key) == OT_NULL) {
         attrs = _class(*o)->_attributes;
         _class(*o)->_attributes = val;
+        SQ_BARRIER(_class(*o),val);
         v->Pop(2);
         v->Push(attrs);
         return SQ_OK;
@@ -36,6 +36,7 @@ public:
     {
         if(nidx>=0 && nidx<(SQInteger)_values.size()){
             _values[nidx]=val;
+            SQ_BARRIER(this,val);
             return true;
         }
         else return false;
@@ -61,9 +62,9 @@ public:
         SQObjectPtr _null;
         Resize(size,_null);
     }
-    void Resize(SQInteger size,SQObjectPtr &fill) { _values.resize(size,fill); ShrinkIfNeeded(); }
+    void Resize(SQInteger size,SQObjectPtr &fill) { _values.resize(size,fill); SQ_BARRIER(this,fill); ShrinkIfNeeded(); }
     void Reserve(SQInteger size) { _values.reserve(size); }
-    void Append(const SQObject &o){_values.push_back(o);}
+    void Append(const SQObject &o){_values.push_back(o); SQ_BARRIER(this,o);}
     void Extend(const SQArray *a);
     SQObjectPtr &Top(){return _values.top();}
     void Pop(){_values.pop_back(); ShrinkIfNeeded(); }
@@ -71,6 +72,7 @@ public:
         if(idx < 0 || idx > (SQInteger)_values.size())
             return false;
         _values.insert(idx,val);
+        SQ_BARRIER(this,val);
         return true;
     }
     void ShrinkIfNeeded() {
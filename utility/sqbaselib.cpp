@@ -57,8 +57,75 @@ static SQInteger base_resurectureachable(HSQUIRRELVM v)
     sq_resurrectunreachable(v);
     return 1;
 }
+static SQInteger base_gcstep(HSQUIRRELVM v)
+{
+    sq_pushbool(v, sq_gcstep(v));
+    return 1;
+}
+static SQInteger base_setgcslice(HSQUIRRELVM v)
+{
+    SQInteger n;
+    sq_getinteger(v, 2, &n);
+    sq_setgcslice(v, n);
+    return 0;
+}
+static SQInteger base_setgctrigger(HSQUIRRELVM v)
+{
+    SQInteger ratio, lowheap;
+    sq_getinteger(v, 2, &ratio);
+    sq_getinteger(v, 3, &lowheap);
+    sq_setgctrigger(v, ratio, lowheap);
+    return 0;
+}
+static void base_gcstat(HSQUIRRELVM v, const SQChar *name, SQUnsignedInteger val)
+{
+    sq_pushstring(v, name, -1);
+    sq_pushinteger(v, (SQInteger)val);
+    sq_newslot(v, -3, SQFalse);
+}
+static SQInteger base_gcstats(HSQUIRRELVM v)
+{
+    SQGCStats st;
+    sq_getgcstats(v, &st);
+    sq_newtableex(v, 11);
+    base_gcstat(v, _SC("cycles"), st.cycles);
+    base_gcstat(v, _SC("fullcollections"), st.fullcollections);
+    base_gcstat(v, _SC("slices"), st.slices);
+    base_gcstat(v, _SC("freed"), st.freed);
+    base_gcstat(v, _SC("lastcycleus"), st.lastcycleus);
+    base_gcstat(v, _SC("maxpauseus"), st.maxpauseus);
+    base_gcstat(v, _SC("totalus"), st.totalus);
+    base_gcstat(v, _SC("inuse"), st.inuse);
+    base_gcstat(v, _SC("threshold"), st.threshold);
+    base_gcstat(v, _SC("ratio"), st.ratio);
+    base_gcstat(v, _SC("lowheap"), st.lowheap);
+    return 1;
+}
 #endif
 
+static SQInteger base_stringstats(HSQUIRRELVM v)
+{
+    SQStringTableStats st;
+    sq_getstringtablestats(v, &st);
+    sq_newtableex(v, 5);
+    sq_pushstring(v, _SC("strings"), -1);
+    sq_pushinteger(v, (SQInteger)st.strings);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, _SC("slots"), -1);
+    sq_pushinteger(v, (SQInteger)st.slots);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, _SC("usedslots"), -1);
+    sq_pushinteger(v, (SQInteger)st.usedslots);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, _SC("longestchain"), -1);
+    sq_pushinteger(v, (SQInteger)st.longestchain);
+    sq_newslot(v, -3, SQFalse);
+    sq_pushstring(v, _SC("transient"), -1);
+    sq_pushinteger(v, (SQInteger)st.transient);
+    sq_newslot(v, -3, SQFalse);
+    return 1;
+}
+
 static SQInteger base_getroottable(HSQUIRRELVM v)
 {
     v->Push(v->_roottable);
@@ -146,6 +213,20 @@ static SQInteger __getcallstackinfos(HSQUIRRELVM v,SQInteger level)
 
     return 0;
 }
+#ifdef SQ_INSTRUMENT
+static SQInteger base_getvmcounters(HSQUIRRELVM v)
+{
+    if(SQ_FAILED(sq_pushcounters(v))) return SQ_ERROR;
+    return 1;
+}
+
+static SQInteger base_resetvmcounters(HSQUIRRELVM v)
+{
+    sq_resetcounters(v);
+    return 0;
+}
+#endif
+
 static SQInteger base_getstackinfos(HSQUIRRELVM v)
 {
     SQInteger level;
@@ -300,9 +381,18 @@ static const SQRegFunction base_funcs[]={
     {_SC("type"),base_type,2, NULL},
     {_SC("callee"),base_callee,0,NULL},
     {_SC("dummy"),base_dummy,0,NULL},
+    {_SC("stringstats"),base_stringstats,1, NULL},
 #ifndef NO_GARBAGE_COLLECTOR
     {_SC("collectgarbage"),base_collectgarbage,0, NULL},
     {_SC("resurrectunreachable"),base_resurectureachable,0, NULL},
+    {_SC("gcstep"),base_gcstep,1, NULL},
+    {_SC("setgcslice"),base_setgcslice,2, _SC(".n")},
+    {_SC("setgctrigger"),base_setgctrigger,3, _SC(".nn")},
+    {_SC("gcstats"),base_gcstats,1, NULL},
+#endif
+#ifdef SQ_INSTRUMENT
+    {_SC("getvmcounters"),base_getvmcounters,1, NULL},
+    {_SC("resetvmcounters"),base_resetvmcounters,1, NULL},
 #endif
     {NULL,(SQFUNCTION)0,0,NULL}
 };
@@ -700,98 +790,303 @@ static SQInteger array_find(HSQUIRRELVM v)
 }
 
 
-static bool _sort_compare(HSQUIRRELVM v,SQObjectPtr &a,SQObjectPtr &b,SQInteger func,SQInteger &ret)
-{
-    if(func < 0) {
-        if(!v->ObjCmp(a,b,ret)) return false;
-    }
-    else {
-        SQInteger top = sq_gettop(v);
-        sq_push(v, func);
-        sq_pushroottable(v);
-        v->Push(a);
-        v->Push(b);
-        if(SQ_FAILED(sq_call(v, 3, SQTrue, SQFalse))) {
-            if(!sq_isstring( v->_lasterror))
-                v->Raise_Error(_SC("compare func failed"));
-            return false;
-        }
-        if(SQ_FAILED(sq_getinteger(v, -1, &ret))) {
-            v->Raise_Error(_SC("numeric value expected as return value of the compare function"));
-            return false;
-        }
-        sq_settop(v, top);
+//Sorting. Arrays that are all integers, all floats or all strings are compared natively in
+//place. Anything else is sorted in a private copy, so a compare function that changes the
+//array can't pull it out from under the sort, then copied back.
+#define SQ_SORT_INSERTION 16
+
+struct SQSortPair {
+    SQObjectPtr key;
+    SQObjectPtr val;
+};
+
+inline const SQObjectPtr &_sort_key(const SQObjectPtr &o) { return o; }
+inline const SQObjectPtr &_sort_key(const SQSortPair &p) { return p.key; }
+inline void _sort_swap(SQObjectPtr &a,SQObjectPtr &b) { _Swap(a,b); }
+inline void _sort_swap(SQSortPair &a,SQSortPair &b) { _Swap(a.key,b.key); _Swap(a.val,b.val); }
+
+struct SQSortIntLess {
+    template<typename T> bool operator()(const T &a,const T &b,bool &lt) { lt = _integer(_sort_key(a)) < _integer(_sort_key(b)); return true; }
+};
+
+struct SQSortFloatLess {
+    template<typename T> bool operator()(const T &a,const T &b,bool &lt) { lt = _float(_sort_key(a)) < _float(_sort_key(b)); return true; }
+};
+
+struct SQSortStringLess {
+    template<typename T> bool operator()(const T &a,const T &b,bool &lt)
+    {
+        const SQObjectPtr &x = _sort_key(a), &y = _sort_key(b);
+        lt = _rawval(x) != _rawval(y) && scstrcmp(_stringval(x),_stringval(y)) < 0;
         return true;
     }
-    return true;
-}
+};
 
-static bool _hsort_sift_down(HSQUIRRELVM v,SQArray *arr, SQInteger root, SQInteger bottom, SQInteger func)
-{
-    SQInteger maxChild;
-    SQInteger done = 0;
-    SQInteger ret;
-    SQInteger root2;
-    while (((root2 = root * 2) <= bottom) && (!done))
+//Compares with the VM, calling func if there is one. The closure and `this` are set up
+//once, and each compare goes straight to SQVM::Call rather than through sq_call.
+struct SQSortVMLess {
+    HSQUIRRELVM v;
+    SQObjectPtr func;
+    SQObjectPtr env;
+    SQObjectPtr res;
+    template<typename T> bool operator()(const T &a,const T &b,bool &lt)
     {
-        if (root2 == bottom) {
-            maxChild = root2;
+        SQInteger ret;
+        if(sq_type(func) == OT_NULL) {
+            if(!v->ObjCmp(_sort_key(a),_sort_key(b),ret)) return false;
         }
         else {
-            if(!_sort_compare(v,arr->_values[root2],arr->_values[root2 + 1],func,ret))
+            v->Push(env);
+            v->Push(_sort_key(a));
+            v->Push(_sort_key(b));
+            if(!v->Call(func,3,v->_top-3,res,SQFalse)) {
+                v->Pop(3);
+                if(!sq_isstring(v->_lasterror))
+                    v->Raise_Error(_SC("compare func failed"));
                 return false;
-            if (ret > 0) {
-                maxChild = root2;
             }
+            v->Pop(3);
+            if(sq_isnumeric(res)) ret = tointeger(res);
+            else if(sq_isbool(res)) ret = SQVM::IsFalse(res) ? 0 : 1;
             else {
-                maxChild = root2 + 1;
+                v->Raise_Error(_SC("numeric value expected as return value of the compare function"));
+                return false;
             }
         }
+        lt = ret < 0;
+        return true;
+    }
+};
 
-        if(!_sort_compare(v,arr->_values[root],arr->_values[maxChild],func,ret))
-            return false;
-        if (ret < 0) {
-            if (root == maxChild) {
-                v->Raise_Error(_SC("inconsistent compare function"));
-                return false; // We'd be swapping ourselve. The compare function is incorrect
-            }
+template<typename T,class Less>
+static bool _sort_insertion(T *a,SQInteger lo,SQInteger hi,Less &less)
+{
+    bool lt;
+    for(SQInteger i = lo + 1; i < hi; i++) {
+        for(SQInteger j = i; j > lo; j--) {
+            if(!less(a[j],a[j-1],lt)) return false;
+            if(!lt) break;
+            _sort_swap(a[j],a[j-1]);
+        }
+    }
+    return true;
+}
+
+template<typename T,class Less>
+static bool _sort_siftdown(T *a,SQInteger root,SQInteger n,Less &less)
+{
+    bool lt;
+    SQInteger child;
+    while((child = root * 2 + 1) < n) {
+        if(child + 1 < n) {
+            if(!less(a[child],a[child+1],lt)) return false;
+            if(lt) child++;
+        }
+        if(!less(a[root],a[child],lt)) return false;
+        if(!lt) break;
+        _sort_swap(a[root],a[child]);
+        root = child;
+    }
+    return true;
+}
+
+template<typename T,class Less>
+static bool _sort_heap(T *a,SQInteger n,Less &less)
+{
+    for(SQInteger i = n / 2 - 1; i >= 0; i--) {
+        if(!_sort_siftdown(a,i,n,less)) return false;
+    }
+    for(SQInteger i = n - 1; i > 0; i--) {
+        _sort_swap(a[0],a[i]);
+        if(!_sort_siftdown(a,0,i,less)) return false;
+    }
+    return true;
+}
 
-            _Swap(arr->_values[root],arr->_values[maxChild]);
-            root = maxChild;
+//Introsort: quicksort with a median of three pivot, insertion sort for short ranges and heapsort
+//once the recursion gets too deep, so it's never worse than n log n. The bounds checks keep
+//an inconsistent compare function from running off the range.
+template<typename T,class Less>
+static bool _sort_intro(T *a,SQInteger lo,SQInteger hi,SQInteger depth,Less &less)
+{
+    bool lt;
+    while(hi - lo > SQ_SORT_INSERTION) {
+        if(depth-- == 0) return _sort_heap(a + lo,hi - lo,less);
+        SQInteger mid = lo + (hi - lo) / 2;
+        if(!less(a[mid],a[lo],lt)) return false;
+        if(lt) _sort_swap(a[mid],a[lo]);
+        if(!less(a[hi-1],a[mid],lt)) return false;
+        if(lt) {
+            _sort_swap(a[hi-1],a[mid]);
+            if(!less(a[mid],a[lo],lt)) return false;
+            if(lt) _sort_swap(a[mid],a[lo]);
+        }
+        _sort_swap(a[lo],a[mid]);
+        T pivot = a[lo];
+        SQInteger i = lo, j = hi;
+        for(;;) {
+            do {
+                if(++i >= hi) break;
+                if(!less(a[i],pivot,lt)) return false;
+            } while(lt);
+            do {
+                if(--j <= lo) break;
+                if(!less(pivot,a[j],lt)) return false;
+            } while(lt);
+            if(i >= j) break;
+            _sort_swap(a[i],a[j]);
+        }
+        _sort_swap(a[lo],a[j]);
+        //Recurse into the smaller side and loop on the bigger one
+        if(j - lo < hi - j - 1) {
+            if(!_sort_intro(a,lo,j,depth,less)) return false;
+            lo = j + 1;
         }
         else {
-            done = 1;
+            if(!_sort_intro(a,j + 1,hi,depth,less)) return false;
+            hi = j;
+        }
+    }
+    return _sort_insertion(a,lo,hi,less);
+}
+
+template<typename T,class Less>
+static bool _sort_unstable(T *a,SQInteger n,Less &less)
+{
+    SQInteger depth = 0;
+    for(SQInteger i = n; i > 1; i >>= 1) depth += 2;
+    return _sort_intro(a,0,n,depth,less);
+}
+
+//Bottom up merge sort, stable. Runs are insertion sorted first, and merges of runs
+//that are already in order are skipped.
+template<typename T,class Less>
+static bool _sort_stable(T *a,SQInteger n,Less &less)
+{
+    bool lt;
+    for(SQInteger lo = 0; lo < n; lo += SQ_SORT_INSERTION) {
+        if(!_sort_insertion(a,lo,lo + SQ_SORT_INSERTION < n ? lo + SQ_SORT_INSERTION : n,less)) return false;
+    }
+    if(n <= SQ_SORT_INSERTION) return true;
+    sqvector<T> tmp;
+    tmp.resize(n);
+    for(SQInteger width = SQ_SORT_INSERTION; width < n; width *= 2) {
+        for(SQInteger lo = 0; lo < n - width; lo += width * 2) {
+            SQInteger mid = lo + width, hi = (mid + width < n) ? mid + width : n;
+            if(!less(a[mid],a[mid-1],lt)) return false;
+            if(!lt) continue;
+            SQInteger nleft = mid - lo, i = 0, j = mid, k = lo;
+            for(SQInteger c = 0; c < nleft; c++) tmp[c] = a[lo + c];
+            while(i < nleft && j < hi) {
+                if(!less(a[j],tmp[i],lt)) return false;
+                if(lt) a[k++] = a[j++];
+                else a[k++] = tmp[i++];
+            }
+            while(i < nleft) a[k++] = tmp[i++];
         }
     }
     return true;
 }
 
-static bool _hsort(HSQUIRRELVM v,SQObjectPtr &arr, SQInteger SQ_UNUSED_ARG(l), SQInteger SQ_UNUSED_ARG(r),SQInteger func)
+//The type every element has, or OT_NULL if they differ
+template<typename T>
+static SQObjectType _sort_commontype(const T *a,SQInteger n)
 {
-    SQArray *a = _array(arr);
-    SQInteger i;
-    SQInteger array_size = a->Size();
-    for (i = (array_size / 2); i >= 0; i--) {
-        if(!_hsort_sift_down(v,a, i, array_size - 1,func)) return false;
+    SQObjectType t = sq_type(_sort_key(a[0]));
+    for(SQInteger i = 1; i < n; i++) {
+        if(sq_type(_sort_key(a[i])) != t) return OT_NULL;
     }
+    return t;
+}
 
-    for (i = array_size-1; i >= 1; i--)
-    {
-        _Swap(a->_values[0],a->_values[i]);
-        if(!_hsort_sift_down(v,a, 0, i-1,func)) return false;
+template<typename T>
+static bool _sort_values(HSQUIRRELVM v,T *a,SQInteger n,SQInteger func,bool stable)
+{
+    if(func < 0) {
+        //Equal integers, floats or strings can't be told apart, so these don't need to be stable
+        //unless they are keys with values attached
+        switch(_sort_commontype(a,n)) {
+        case OT_INTEGER: { SQSortIntLess less; return stable ? _sort_stable(a,n,less) : _sort_unstable(a,n,less); }
+        case OT_FLOAT: { SQSortFloatLess less; return stable ? _sort_stable(a,n,less) : _sort_unstable(a,n,less); }
+        case OT_STRING: { SQSortStringLess less; return stable ? _sort_stable(a,n,less) : _sort_unstable(a,n,less); }
+        default: break;
+        }
     }
-    return true;
+    SQSortVMLess less;
+    less.v = v;
+    if(func >= 0) less.func = stack_get(v,func);
+    less.env = v->_roottable;
+    return stable ? _sort_stable(a,n,less) : _sort_unstable(a,n,less);
 }
 
-static SQInteger array_sort(HSQUIRRELVM v)
+static SQInteger _array_sort(HSQUIRRELVM v,bool stable)
 {
-    SQInteger func = -1;
+    SQInteger func = sq_gettop(v) == 2 ? 2 : -1;
     SQObjectPtr &o = stack_get(v,1);
-    if(_array(o)->Size() > 1) {
-        if(sq_gettop(v) == 2) func = 2;
-        if(!_hsort(v, o, 0, _array(o)->Size()-1, func))
-            return SQ_ERROR;
+    SQArray *arr = _array(o);
+    SQInteger n = arr->Size();
+    if(n > 1) {
+        SQObjectType t = _sort_commontype(&arr->_values[0],n);
+        if(func < 0 && (t == OT_INTEGER || t == OT_FLOAT || t == OT_STRING)) {
+            _sort_values(v,&arr->_values[0],n,func,false);
+        }
+        else {
+            //The comparator can change the array, so sort a copy that lives on the stack
+            SQArray *work = arr->Clone();
+            v->Push(work);
+            if(!_sort_values(v,&work->_values[0],n,func,stable)) return SQ_ERROR;
+            if(arr->Size() != n) return sq_throwerror(v,_SC("array modified during sort"));
+            for(SQInteger i = 0; i < n; i++) arr->Set(i,work->_values[i]);
+        }
+    }
+    sq_settop(v,1);
+    return 1;
+}
+
+static SQInteger array_sort(HSQUIRRELVM v)
+{
+    return _array_sort(v,false);
+}
+
+static SQInteger array_stablesort(HSQUIRRELVM v)
+{
+    return _array_sort(v,true);
+}
 
+//Calls keyfunc once per element and sorts by the keys, stable
+static SQInteger array_sortby(HSQUIRRELVM v)
+{
+    SQObjectPtr &o = stack_get(v,1);
+    SQArray *arr = _array(o);
+    SQInteger n = arr->Size();
+    if(n > 1) {
+        //The keys and a copy of the values stay on the stack while keyfunc and any _cmp run,
+        //so the collector sees them, work only ever holds the same objects
+        SQArray *vals = arr->Clone();
+        SQArray *keys = SQArray::Create(_ss(v),n);
+        v->Push(vals);
+        v->Push(keys);
+        SQObjectPtr func = stack_get(v,2);
+        SQObjectPtr key;
+        for(SQInteger i = 0; i < n; i++) {
+            v->Push(o);
+            v->Push(vals->_values[i]);
+            if(!v->Call(func,2,v->_top-2,key,SQFalse)) {
+                v->Pop(2);
+                return SQ_ERROR;
+            }
+            v->Pop(2);
+            keys->Set(i,key);
+        }
+        sqvector<SQSortPair> work;
+        work.resize(n);
+        for(SQInteger i = 0; i < n; i++) {
+            work[i].key = keys->_values[i];
+            work[i].val = vals->_values[i];
+        }
+        if(!_sort_values(v,&work[0],n,-1,true)) return SQ_ERROR;
+        if(arr->Size() != n) return sq_throwerror(v,_SC("array modified during sort"));
+        for(SQInteger i = 0; i < n; i++) arr->Set(i,work[i].val);
     }
     sq_settop(v,1);
     return 1;
@@ -819,6 +1114,245 @@ static SQInteger array_slice(HSQUIRRELVM v)
 
 }
 
+//Lazy pipelines: arr.iter().map(f).filter(g).take(n).collect(). The stage methods only record the
+//stage and return the same pipeline. A terminal method then runs each element through every stage
+//in turn, so no intermediate arrays are built and take() stops pulling elements once it's done.
+//The state is one array, [source, kind, arg, kind, arg...], so the GC can see everything in it.
+#define SQ_PIPE_MAP     0
+#define SQ_PIPE_FILTER  1
+#define SQ_PIPE_TAKE    2
+#define SQ_PIPE_SKIP    3
+
+static SQArray *_pipeline_stages(HSQUIRRELVM v)
+{
+    SQObjectPtr &self = stack_get(v,1);
+    SQObjectPtr stages;
+    if(!_instance(self)->Get(SQString::Create(_ss(v),_SC("_stages")),stages) || sq_type(stages) != OT_ARRAY) {
+        v->Raise_Error(_SC("not a pipeline"));
+        return NULL;
+    }
+    return _array(stages);
+}
+
+static SQInteger _pipeline_addstage(HSQUIRRELVM v,SQInteger kind)
+{
+    SQArray *stages = _pipeline_stages(v);
+    if(!stages) return SQ_ERROR;
+    SQObjectPtr &arg = stack_get(v,2);
+    if((kind == SQ_PIPE_TAKE || kind == SQ_PIPE_SKIP) && tointeger(arg) < 0)
+        return sq_throwerror(v,_SC("count must be zero or more"));
+    stages->Append(SQObjectPtr(kind));
+    stages->Append(arg);
+    sq_settop(v,1);
+    return 1;
+}
+
+static SQInteger pipeline_map(HSQUIRRELVM v) { return _pipeline_addstage(v,SQ_PIPE_MAP); }
+static SQInteger pipeline_filter(HSQUIRRELVM v) { return _pipeline_addstage(v,SQ_PIPE_FILTER); }
+static SQInteger pipeline_take(HSQUIRRELVM v) { return _pipeline_addstage(v,SQ_PIPE_TAKE); }
+static SQInteger pipeline_skip(HSQUIRRELVM v) { return _pipeline_addstage(v,SQ_PIPE_SKIP); }
+
+//Calls func(a) or func(a, b) with the source array as this. Goes straight to SQVM::Call,
+//the arguments are pushed over the same stack slots for every element.
+static bool _pipeline_call(HSQUIRRELVM v,SQObjectPtr &func,const SQObjectPtr &env,const SQObjectPtr &a,const SQObjectPtr *b,SQObjectPtr &res)
+{
+    SQInteger nargs = b ? 3 : 2;
+    v->Push(env);
+    v->Push(a);
+    if(b) v->Push(*b);
+    bool ok = v->Call(func,nargs,v->_top-nargs,res,SQFalse);
+    v->Pop(nargs);
+    return ok;
+}
+
+//Feeds every value that makes it through all the stages to sink. False on an error.
+template<class Sink>
+static bool _pipeline_run(HSQUIRRELVM v,Sink &sink)
+{
+    SQArray *stages = _pipeline_stages(v);
+    if(!stages) return false;
+    SQObjectPtr src = stages->_values[0];
+    if(sq_type(src) != OT_ARRAY) {
+        v->Raise_Error(_SC("the pipeline has no source"));
+        return false;
+    }
+    if(SQ_FAILED(sq_reservestack(v,8))) return false;
+    //A copy, so a callback that changes the stages doesn't change this run. It's kept on the
+    //stack along with the value in flight, so the GC can see them while the callbacks run.
+    v->Push(SQObjectPtr(stages->Clone()));
+    v->PushNull();
+    SQInteger validx = sq_gettop(v);
+    SQInteger nstages = (stages->Size() - 1) / 2;
+    sqvector<SQInteger> kinds, left;
+    sqvector<SQObjectPtr> funcs;
+    kinds.resize(nstages);
+    left.resize(nstages);
+    funcs.resize(nstages);
+    for(SQInteger s = 0; s < nstages; s++) {
+        kinds[s] = _integer(stages->_values[s * 2 + 1]);
+        SQObjectPtr &arg = stages->_values[s * 2 + 2];
+        if(kinds[s] == SQ_PIPE_TAKE || kinds[s] == SQ_PIPE_SKIP) left[s] = tointeger(arg);
+        else funcs[s] = arg;
+    }
+    SQObjectPtr val, res;
+    for(SQInteger i = 0; i < _array(src)->Size(); i++) {
+        val = _array(src)->_values[i];
+        stack_get(v,validx) = val;
+        bool keep = true, last = false;
+        for(SQInteger s = 0; s < nstages && keep; s++) {
+            switch(kinds[s]) {
+            case SQ_PIPE_MAP:
+                if(!_pipeline_call(v,funcs[s],src,val,NULL,res)) return false;
+                val = res;
+                stack_get(v,validx) = val;
+                break;
+            case SQ_PIPE_FILTER:
+                if(!_pipeline_call(v,funcs[s],src,val,NULL,res)) return false;
+                if(SQVM::IsFalse(res)) keep = false;
+                break;
+            case SQ_PIPE_TAKE:
+                if(left[s] == 0) return true;
+                if(--left[s] == 0) last = true;
+                break;
+            case SQ_PIPE_SKIP:
+                if(left[s] > 0) {
+                    left[s]--;
+                    keep = false;
+                }
+                break;
+            }
+        }
+        if(keep && !sink(v,src,val)) return false;
+        if(last) break;
+    }
+    return true;
+}
+
+//The sinks that hold on to a value keep it in a stack slot of the terminal method, out of the GC's sight otherwise
+struct SQPipeCollect {
+    SQArray *out;
+    bool operator()(HSQUIRRELVM SQ_UNUSED_ARG(v),const SQObjectPtr &SQ_UNUSED_ARG(src),const SQObjectPtr &val) { out->Append(val); return true; }
+};
+
+struct SQPipeCount {
+    SQInteger n;
+    bool operator()(HSQUIRRELVM SQ_UNUSED_ARG(v),const SQObjectPtr &SQ_UNUSED_ARG(src),const SQObjectPtr &SQ_UNUSED_ARG(val)) { n++; return true; }
+};
+
+struct SQPipeEach {
+    SQObjectPtr func;
+    SQObjectPtr res;
+    bool operator()(HSQUIRRELVM v,const SQObjectPtr &src,const SQObjectPtr &val) { return _pipeline_call(v,func,src,val,NULL,res); }
+};
+
+struct SQPipeReduce {
+    SQObjectPtr func;
+    SQObjectPtr acc;
+    SQObjectPtr res;
+    SQInteger accidx;
+    bool started;
+    bool operator()(HSQUIRRELVM v,const SQObjectPtr &src,const SQObjectPtr &val)
+    {
+        if(!started) {
+            acc = val;
+            started = true;
+        }
+        else {
+            if(!_pipeline_call(v,func,src,acc,&val,res)) return false;
+            acc = res;
+        }
+        stack_get(v,accidx) = acc;
+        return true;
+    }
+};
+
+static SQInteger pipeline_collect(HSQUIRRELVM v)
+{
+    SQPipeCollect sink;
+    sink.out = SQArray::Create(_ss(v),0);
+    v->Push(sink.out);
+    SQInteger outidx = sq_gettop(v);
+    if(!_pipeline_run(v,sink)) return SQ_ERROR;
+    sq_push(v,outidx);
+    return 1;
+}
+
+static SQInteger pipeline_count(HSQUIRRELVM v)
+{
+    SQPipeCount sink;
+    sink.n = 0;
+    if(!_pipeline_run(v,sink)) return SQ_ERROR;
+    v->Push(sink.n);
+    return 1;
+}
+
+static SQInteger pipeline_each(HSQUIRRELVM v)
+{
+    SQPipeEach sink;
+    sink.func = stack_get(v,2);
+    if(!_pipeline_run(v,sink)) return SQ_ERROR;
+    sq_settop(v,1);
+    return 0;
+}
+
+//reduce(f, [initial]), f(acc, val). Without an initial value the first one starts it off.
+static SQInteger pipeline_reduce(HSQUIRRELVM v)
+{
+    SQPipeReduce sink;
+    sink.func = stack_get(v,2);
+    sink.started = sq_gettop(v) > 2;
+    if(sink.started) sink.acc = stack_get(v,3);
+    v->Push(sink.acc);
+    sink.accidx = sq_gettop(v);
+    if(!_pipeline_run(v,sink)) return SQ_ERROR;
+    v->Push(sink.acc);
+    return 1;
+}
+
+static const SQRegFunction _pipeline_funcz[]={
+    {_SC("map"),pipeline_map,2, _SC("xc")},
+    {_SC("filter"),pipeline_filter,2, _SC("xc")},
+    {_SC("take"),pipeline_take,2, _SC("xn")},
+    {_SC("skip"),pipeline_skip,2, _SC("xn")},
+    {_SC("collect"),pipeline_collect,1, _SC("x")},
+    {_SC("count"),pipeline_count,1, _SC("x")},
+    {_SC("each"),pipeline_each,2, _SC("xc")},
+    {_SC("reduce"),pipeline_reduce,-2, _SC("xc.")},
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+
+//The pipeline class lives in the registry, made the first time it's needed
+static SQInteger array_iter(HSQUIRRELVM v)
+{
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_pipeline"),-1);
+    if(SQ_FAILED(sq_rawget(v,-2))) {
+        sq_pushstring(v,_SC("std_pipeline"),-1);
+        sq_newclass(v,SQFalse);
+        sq_pushstring(v,_SC("_stages"),-1);
+        sq_pushnull(v);
+        sq_newslot(v,-3,SQFalse);
+        for(SQInteger i = 0; _pipeline_funcz[i].name; i++) {
+            const SQRegFunction &f = _pipeline_funcz[i];
+            sq_pushstring(v,f.name,-1);
+            sq_newclosure(v,f.f,0);
+            sq_setparamscheck(v,f.nparamscheck,f.typemask);
+            sq_setnativeclosurename(v,-1,f.name);
+            sq_newslot(v,-3,SQFalse);
+        }
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("std_pipeline"),-1);
+        sq_rawget(v,-2);
+    }
+    sq_createinstance(v,-1);
+    SQArray *stages = SQArray::Create(_ss(v),0);
+    stages->Append(stack_get(v,1));
+    sq_pushstring(v,_SC("_stages"),-1);
+    v->Push(SQObjectPtr(stages));
+    sq_set(v,-3);
+    return 1;
+}
+
 const SQRegFunction SQSharedState::_array_default_delegate_funcz[]={
     {_SC("len"),default_delegate_len,1, _SC("a")},
     {_SC("append"),array_append,2, _SC("a")},
@@ -831,6 +1365,8 @@ const SQRegFunction SQSharedState::_array_default_delegate_funcz[]={
     {_SC("resize"),array_resize,-2, _SC("an")},
     {_SC("reverse"),array_reverse,1, _SC("a")},
     {_SC("sort"),array_sort,-1, _SC("ac")},
+    {_SC("stablesort"),array_stablesort,-1, _SC("ac")},
+    {_SC("sortby"),array_sortby,2, _SC("ac")},
     {_SC("slice"),array_slice,-1, _SC("ann")},
     {_SC("weakref"),obj_delegate_weakref,1, NULL },
     {_SC("tostring"),default_delegate_tostring,1, _SC(".")},
@@ -839,6 +1375,7 @@ const SQRegFunction SQSharedState::_array_default_delegate_funcz[]={
     {_SC("apply"),array_apply,2, _SC("ac")},
     {_SC("reduce"),array_reduce,2, _SC("ac")},
     {_SC("filter"),array_filter,2, _SC("ac")},
+    {_SC("iter"),array_iter,1, _SC("a")},
     {_SC("find"),array_find,2, _SC("a.")},
     {NULL,(SQFUNCTION)0,0,NULL}
 };
@@ -1006,7 +1543,7 @@ static SQInteger closure_getinfos(HSQUIRRELVM v) {
         SQNativeClosure *nc = _nativeclosure(o);
         res->NewSlot(SQString::Create(_ss(v),_SC("native"),-1),true);
         res->NewSlot(SQString::Create(_ss(v),_SC("name"),-1),nc->_name);
-        res->NewSlot(SQString::Create(_ss(v),_SC("paramscheck"),-1),nc->_nparamscheck);
+        res->NewSlot(SQString::Create(_ss(v),_SC("paramscheck"),-1),(SQInteger)nc->_nparamscheck);
         SQObjectPtr typecheck;
         if(nc->_typecheck.size() > 0) {
             typecheck =
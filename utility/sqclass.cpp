@@ -56,6 +56,7 @@ bool SQClass::NewSlot(SQSharedState *ss,const SQObjectPtr &key,const SQObjectPtr
     bool belongs_to_static_table = sq_type(val) == OT_CLOSURE || sq_type(val) == OT_NATIVECLOSURE || bstatic;
     if(_locked && !belongs_to_static_table)
         return false; //the class already has an instance so cannot be modified
+    SQ_BARRIER(this,val);
     if(_members->Get(key,temp) && _isfield(temp)) //overrides the default value
     {
         _defaultvalues[_member_idx(temp)].val = val;
@@ -128,6 +129,7 @@ bool SQClass::SetAttributes(const SQObjectPtr &key,const SQObjectPtr &val)
             _defaultvalues[_member_idx(idx)].attrs = val;
         else
             _methods[_member_idx(idx)].attrs = val;
+        SQ_BARRIER(this,val);
         return true;
     }
     return false;
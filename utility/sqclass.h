@@ -131,6 +131,7 @@ public:
         SQObjectPtr idx;
         if(_class->_members->Get(key,idx) && _isfield(idx)) {
             _values[_member_idx(idx)] = val;
+            SQ_BARRIER(this,val);
             return true;
         }
         return false;
@@ -139,7 +140,7 @@ public:
         _uiRef++;
         if (_hook) { _hook(_userpointer,0);}
         _uiRef--;
-        if(_uiRef > 0) return;
+        if(_uiRef & SQ_REFCOUNT_MASK) return;
         SQInteger size = _memsize;
         this->~SQInstance();
         SQ_FREE(this, size);
@@ -73,6 +73,7 @@ class SQCompiler
 {
 public:
     SQCompiler(SQVM *v, SQLEXREADFUNC rg, SQUserPointer up, const SQChar* sourcename, bool raiseerror, bool lineinfo)
+        : _arena(SQ_COMPILE_ARENA_CHUNK)
     {
         _vm=v;
         _lex.Init(_ss(v), rg, up,ThrowError,this);
@@ -167,6 +168,7 @@ public:
         _debugop = 0;
 
         SQFuncState funcstate(_ss(_vm), NULL,ThrowError,this);
+        funcstate._striplocals = _vm->_striplocals;
         funcstate._name = SQString::Create(_ss(_vm), _SC("main"));
         _fs = &funcstate;
         _fs->AddParameter(_fs->CreateString(_SC("this")));
@@ -1156,7 +1158,7 @@ public:
         _fs->SnoozeOpt();
         SQInteger expend = _fs->GetCurrentPos();
         SQInteger expsize = (expend - expstart) + 1;
-        SQInstructionVec exp;
+        SQCompileInstructionVec exp;
         if(expsize > 0) {
             for(SQInteger i = 0; i < expsize; i++)
                 exp.push_back(_fs->GetInstruction(expstart + i));
@@ -1563,6 +1565,9 @@ public:
         }
     }
 private:
+    //Declared first so it outlives the lexer, whose buffer comes from it.
+    //Each function state has an arena of its own.
+    SQArena _arena;
     SQInteger _token;
     SQFuncState *_fs;
     SQObjectPtr _sourcename;
@@ -1,4 +1,68 @@
 
+//Uncomment to build the VM with execution counters(opcodes, calls, exceptions, etc.), see sq_getcounters().
+//It adds an increment to every opcode dispatch, so it's off by default.
+//#define SQ_INSTRUMENT
+
+//Most slots sq_startprofiler() will take. The histogram is allocated up front, and the count
+//can come straight from a script, so this keeps one call from taking the whole heap.
+#define SQ_PROFILER_MAXSLOTS 256
+
+//Never emit _OP_LINE, even with debug info enabled. Line numbers for errors come from the
+//line info table, and the debug hook still gets line events. Execute tests one flag per instruction
+//for that, and only looks at the line table while a hook is set.
+#define SQ_NO_LINEOPS
+
+//Serve small VM allocations from per size class free lists refilled a slab at a time,
+//instead of malloc. See sq_getpoolstats().
+//#define SQ_POOL_ALLOCATOR
+
+//Charge every VM allocation to the memory account of the VM that was running, so each
+//program's usage can be tracked and limited. Costs a pointer sized header per allocation.
+#define SQ_MEM_ACCOUNTING
+
+//VM allocations of at least this many bytes(long strings, blobs, array storage) go to PSRAM on
+//boards that have it, smaller ones stay in internal RAM. Bytecode always goes to PSRAM and stacks
+//always stay internal. Can be changed at runtime with sq_setmemlargesize().
+#define SQ_MEM_LARGESIZE 1024
+
+//The compiler's scratch(instructions, locals, jump lists, the lexer's buffer) comes from arenas,
+//one for each function being compiled, freed in one go as soon as that function is done.
+//This is the size of an arena's first chunk, later ones double.
+#define SQ_COMPILE_ARENA_CHUNK 1024
+
+//How many objects the incremental collector traverses in each slice. A slice runs every time
+//the VM yields while a collection is in progress, see sq_gcstep().
+#define SQ_GC_SLICE 64
+
+//A cycle starts on its own once the VM heap is this percentage of what was left after the
+//last one, so 200 lets it double, and 0 means cycles only start from sq_gcstep(). Below
+//SQ_GC_LOWHEAP bytes of free system heap the allowance shrinks in proportion, but not below
+//SQ_GC_MINSTEP/8 bytes or half of what's left. Otherwise it's never less than SQ_GC_MINSTEP
+//bytes, so small heaps don't collect constantly. See sq_setgctrigger().
+#define SQ_GC_RATIO 200
+#define SQ_GC_LOWHEAP 32768
+#define SQ_GC_MINSTEP 16384
+
+//On a 32 bit target built with doubles or 64 bit integers, an object's value needs 8 byte
+//alignment, so the type tag gets padded out and every object takes 16 bytes. This packs them to
+//12(and table nodes from 40 to 32), at the cost of 8 byte values that are only 4 byte aligned.
+//It changes the layout of HSQOBJECT, so everything linked against the VM has to be built with
+//the same setting. It does nothing anywhere else: the default float build already uses 8 byte
+//objects, and on 64 bit hosts objects stay 16 bytes, since packing would misalign pointers.
+//#define SQ_PACKED_OBJECTS
+
+//Strings at least this long that are built at runtime(concatenation, natives) skip the string
+//table until they're used as a table key, so building big strings doesn't hash every step.
+#define SQ_TRANSIENT_MINLEN 32
+
+//Use the open addressing table engine instead of the chained one. Lookups compare a group of
+//hash bytes at once, removal needs no tombstones and tables iterate in insertion order.
+//#define SQ_OPEN_TABLES
+
+//Match every regexp with the original recursive backtracker instead of the linear time Pike VM.
+//Patterns using \m or very long counted repeats always use the backtracker.
+//#define SQ_REX_BACKTRACK
+
 #ifdef _SQ64
 
 #ifdef _MSC_VER
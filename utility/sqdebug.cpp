@@ -21,7 +21,7 @@ SQRESULT sq_getfunctioninfo(HSQUIRRELVM v,SQInteger level,SQFunctionInfo *fi)
             fi->funcid = proto;
             fi->name = sq_type(proto->_name) == OT_STRING?_stringval(proto->_name):_SC("unknown");
             fi->source = sq_type(proto->_sourcename) == OT_STRING?_stringval(proto->_sourcename):_SC("unknown");
-            fi->line = proto->_lineinfos[0]._line;
+            fi->line = proto->GetLine(proto->_instructions);
             return SQ_OK;
         }
     }
@@ -58,6 +58,133 @@ SQRESULT sq_stackinfos(HSQUIRRELVM v, SQInteger level, SQStackInfos *si)
     return SQ_ERROR;
 }
 
+//Starts sampling, discarding any previous histogram.
+//A sample is taken every time the VM yields, i.e. every SQ_SUSPEND_INTERVAL instructions.
+SQRESULT sq_startprofiler(HSQUIRRELVM v,SQInteger nslots)
+{
+    if(nslots <= 0) return sq_throwerror(v,_SC("the profiler needs at least one slot"));
+    if(nslots > SQ_PROFILER_MAXSLOTS) return sq_throwerror(v,_SC("too many profiler slots"));
+    v->_profile.resize(0);
+    v->_profile.reserve(nslots);
+    v->_profileslots = nslots;
+    v->_profiledropped = 0;
+    v->_profiling = true;
+    return SQ_OK;
+}
+
+//Stops sampling but keeps the histogram so it can still be read.
+void sq_stopprofiler(HSQUIRRELVM v)
+{
+    v->_profiling = false;
+}
+
+SQInteger sq_getprofilesize(HSQUIRRELVM v,SQUnsignedInteger *dropped)
+{
+    if(dropped) *dropped = v->_profiledropped;
+    return v->_profile.size();
+}
+
+//Samples are ordered hottest first.
+SQRESULT sq_getprofilesample(HSQUIRRELVM v,SQInteger idx,SQProfileSample *ps)
+{
+    if(idx < 0 || idx >= (SQInteger)v->_profile.size()) return SQ_ERROR;
+    v->SortProfile();
+    SQProfileEntry &e = v->_profile[idx];
+    SQFunctionProto *func = _funcproto(e._function);
+    ps->funcname = sq_type(func->_name) == OT_STRING?_stringval(func->_name):_SC("unknown");
+    ps->source = sq_type(func->_sourcename) == OT_STRING?_stringval(func->_sourcename):_SC("unknown");
+    ps->line = e._line;
+    ps->hits = e._hits;
+    return SQ_OK;
+}
+
+//Pushes an array of {funcname, source, line, hits} tables, hottest first.
+SQRESULT sq_pushprofile(HSQUIRRELVM v)
+{
+    SQInteger size = v->_profile.size();
+    SQProfileSample ps;
+    sq_newarray(v,0);
+    for(SQInteger i = 0; i < size; i++) {
+        sq_getprofilesample(v,i,&ps);
+        sq_newtableex(v,4);
+        sq_pushstring(v,_SC("funcname"),-1);
+        sq_pushstring(v,ps.funcname,-1);
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("source"),-1);
+        sq_pushstring(v,ps.source,-1);
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("line"),-1);
+        sq_pushinteger(v,ps.line);
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("hits"),-1);
+        sq_pushinteger(v,(SQInteger)ps.hits);
+        sq_newslot(v,-3,SQFalse);
+        sq_arrayappend(v,-2);
+    }
+    return SQ_OK;
+}
+
+#ifdef SQ_INSTRUMENT
+extern SQInstructionDesc g_InstrDesc[];
+#endif
+
+SQRESULT sq_getcounters(HSQUIRRELVM v,SQVMCounters *c)
+{
+#ifdef SQ_INSTRUMENT
+    *c = v->_counters;
+    c->rehashes = _ss(v)->_rehashes;
+    return SQ_OK;
+#else
+    memset(c,0,sizeof(SQVMCounters));
+    return sq_throwerror(v,_SC("the VM was built without SQ_INSTRUMENT"));
+#endif
+}
+
+//v is only used with SQ_INSTRUMENT
+void sq_resetcounters(HSQUIRRELVM SQ_UNUSED_ARG(v))
+{
+#ifdef SQ_INSTRUMENT
+    memset(&v->_counters,0,sizeof(SQVMCounters));
+#endif
+}
+
+//Pushes a table of the counters. ops is a table of opcode name to count, only
+//listing the opcodes that were executed at least once.
+SQRESULT sq_pushcounters(HSQUIRRELVM v)
+{
+    SQVMCounters c;
+    if(SQ_FAILED(sq_getcounters(v,&c))) return SQ_ERROR;
+    sq_newtableex(v,6);
+    sq_pushstring(v,_SC("calls"),-1);
+    sq_pushinteger(v,(SQInteger)c.calls);
+    sq_newslot(v,-3,SQFalse);
+    sq_pushstring(v,_SC("nativecalls"),-1);
+    sq_pushinteger(v,(SQInteger)c.nativecalls);
+    sq_newslot(v,-3,SQFalse);
+    sq_pushstring(v,_SC("exceptions"),-1);
+    sq_pushinteger(v,(SQInteger)c.exceptions);
+    sq_newslot(v,-3,SQFalse);
+    sq_pushstring(v,_SC("gccycles"),-1);
+    sq_pushinteger(v,(SQInteger)c.gccycles);
+    sq_newslot(v,-3,SQFalse);
+    sq_pushstring(v,_SC("rehashes"),-1);
+    sq_pushinteger(v,(SQInteger)c.rehashes);
+    sq_newslot(v,-3,SQFalse);
+    sq_pushstring(v,_SC("ops"),-1);
+    sq_newtable(v);
+#ifdef SQ_INSTRUMENT
+    for(SQInteger i = 0; i < SQ_OPCODE_COUNT; i++) {
+        if(c.ops[i] == 0) continue;
+        //Skip the _OP_ prefix
+        sq_pushstring(v,g_InstrDesc[i].name + 4,-1);
+        sq_pushinteger(v,(SQInteger)c.ops[i]);
+        sq_newslot(v,-3,SQFalse);
+    }
+#endif
+    sq_newslot(v,-3,SQFalse);
+    return SQ_OK;
+}
+
 static void Fcopy(char* buf, const __FlashStringHelper *ifsh)
 {
   const char *p = (const char *)ifsh;
@@ -48,15 +48,63 @@ struct SQLocalVarInfo
 
 struct SQLineInfo { SQInteger _line;SQInteger _op; };
 
+//Function protos keep their line info as a byte stream of (op, line) pairs, each stored as
+//the zigzag varint of its difference from the previous entry. Most pairs take two bytes
+//instead of two SQIntegers.
+#define SQ_LINEINFO_MAXVARINT ((sizeof(SQUnsignedInteger)*8+6)/7)
+
+struct SQLineInfoReader
+{
+    SQLineInfoReader():_p(NULL),_end(NULL),_op(0),_line(0){}
+    SQLineInfoReader(const unsigned char *p,SQInteger size):_p(p),_end(p+size),_op(0),_line(0){}
+    //Loaded bytecode is checked with this first: every varint fits an SQInteger and they come in whole pairs
+    static bool Valid(const unsigned char *p,SQInteger size)
+    {
+        SQUnsignedInteger n = 0, len = 0;
+        for(SQInteger i = 0; i < size; i++) {
+            if(++len > SQ_LINEINFO_MAXVARINT) return false;
+            if(!(p[i] & 0x80)) {
+                n++;
+                len = 0;
+            }
+        }
+        return len == 0 && (n & 1) == 0;
+    }
+    bool Next()
+    {
+        if(_p >= _end) return false;
+        _op += ReadDelta();
+        _line += ReadDelta();
+        return true;
+    }
+    SQInteger ReadDelta()
+    {
+        SQUnsignedInteger u = 0;
+        SQInteger shift = 0;
+        unsigned char c;
+        do {
+            c = *_p++;
+            u |= ((SQUnsignedInteger)(c & 0x7F)) << shift;
+            shift += 7;
+        } while((c & 0x80) && _p < _end && shift < (SQInteger)(sizeof(SQUnsignedInteger)*8));
+        return (SQInteger)(u >> 1) ^ -(SQInteger)(u & 1);
+    }
+    const unsigned char *_p;
+    const unsigned char *_end;
+    SQInteger _op;
+    SQInteger _line;
+};
+
 typedef sqvector<SQOuterVar> SQOuterVarVec;
 typedef sqvector<SQLocalVarInfo> SQLocalVarInfoVec;
 typedef sqvector<SQLineInfo> SQLineInfoVec;
 
-#define _FUNC_SIZE(ni,nl,nparams,nfuncs,nouters,nlineinf,localinf,defparams) (sizeof(SQFunctionProto) \
+//lineinfosize is in bytes, the line info goes last since it has no alignment
+#define _FUNC_SIZE(ni,nl,nparams,nfuncs,nouters,lineinfosize,localinf,defparams) (sizeof(SQFunctionProto) \
         +((ni-1)*sizeof(SQInstruction))+(nl*sizeof(SQObjectPtr)) \
         +(nparams*sizeof(SQObjectPtr))+(nfuncs*sizeof(SQObjectPtr)) \
-        +(nouters*sizeof(SQOuterVar))+(nlineinf*sizeof(SQLineInfo)) \
-        +(localinf*sizeof(SQLocalVarInfo))+(defparams*sizeof(SQInteger)))
+        +(nouters*sizeof(SQOuterVar))+(localinf*sizeof(SQLocalVarInfo)) \
+        +(defparams*sizeof(SQInteger))+lineinfosize)
 
 
 struct SQFunctionProto : public CHAINABLE_OBJ
@@ -69,11 +117,13 @@ public:
     static SQFunctionProto *Create(SQSharedState *ss,SQInteger ninstructions,
         SQInteger nliterals,SQInteger nparameters,
         SQInteger nfunctions,SQInteger noutervalues,
-        SQInteger nlineinfos,SQInteger nlocalvarinfos,SQInteger ndefaultparams)
+        SQInteger lineinfosize,SQInteger nlocalvarinfos,SQInteger ndefaultparams)
     {
         SQFunctionProto *f;
-        //I compact the whole class and members in a single memory allocation
-        f = (SQFunctionProto *)sq_vm_malloc(_FUNC_SIZE(ninstructions,nliterals,nparameters,nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams));
+        //I compact the whole class and members in a single memory allocation.
+        //It goes in the large tier, instructions are read in order so they cache well even from PSRAM
+        SQMemPlacement large(SQ_MEMTIER_LARGE);
+        f = (SQFunctionProto *)sq_vm_malloc(_FUNC_SIZE(ninstructions,nliterals,nparameters,nfunctions,noutervalues,lineinfosize,nlocalvarinfos,ndefaultparams));
         new (f) SQFunctionProto(ss);
         f->_ninstructions = ninstructions;
         f->_literals = (SQObjectPtr*)&f->_instructions[ninstructions];
@@ -84,18 +134,17 @@ public:
         f->_nfunctions = nfunctions;
         f->_outervalues = (SQOuterVar*)&f->_functions[nfunctions];
         f->_noutervalues = noutervalues;
-        f->_lineinfos = (SQLineInfo *)&f->_outervalues[noutervalues];
-        f->_nlineinfos = nlineinfos;
-        f->_localvarinfos = (SQLocalVarInfo *)&f->_lineinfos[nlineinfos];
+        f->_localvarinfos = (SQLocalVarInfo *)&f->_outervalues[noutervalues];
         f->_nlocalvarinfos = nlocalvarinfos;
         f->_defaultparams = (SQInteger *)&f->_localvarinfos[nlocalvarinfos];
         f->_ndefaultparams = ndefaultparams;
+        f->_lineinfos = (unsigned char *)&f->_defaultparams[ndefaultparams];
+        f->_lineinfosize = lineinfosize;
 
         _CONSTRUCT_VECTOR(SQObjectPtr,f->_nliterals,f->_literals);
         _CONSTRUCT_VECTOR(SQObjectPtr,f->_nparameters,f->_parameters);
         _CONSTRUCT_VECTOR(SQObjectPtr,f->_nfunctions,f->_functions);
         _CONSTRUCT_VECTOR(SQOuterVar,f->_noutervalues,f->_outervalues);
-        //_CONSTRUCT_VECTOR(SQLineInfo,f->_nlineinfos,f->_lineinfos); //not required are 2 integers
         _CONSTRUCT_VECTOR(SQLocalVarInfo,f->_nlocalvarinfos,f->_localvarinfos);
         return f;
     }
@@ -104,15 +153,15 @@ public:
         _DESTRUCT_VECTOR(SQObjectPtr,_nparameters,_parameters);
         _DESTRUCT_VECTOR(SQObjectPtr,_nfunctions,_functions);
         _DESTRUCT_VECTOR(SQOuterVar,_noutervalues,_outervalues);
-        //_DESTRUCT_VECTOR(SQLineInfo,_nlineinfos,_lineinfos); //not required are 2 integers
         _DESTRUCT_VECTOR(SQLocalVarInfo,_nlocalvarinfos,_localvarinfos);
-        SQInteger size = _FUNC_SIZE(_ninstructions,_nliterals,_nparameters,_nfunctions,_noutervalues,_nlineinfos,_nlocalvarinfos,_ndefaultparams);
+        SQInteger size = _FUNC_SIZE(_ninstructions,_nliterals,_nparameters,_nfunctions,_noutervalues,_lineinfosize,_nlocalvarinfos,_ndefaultparams);
         this->~SQFunctionProto();
         sq_vm_free(this,size);
     }
 
     const SQChar* GetLocal(SQVM *v,SQUnsignedInteger stackbase,SQUnsignedInteger nseq,SQUnsignedInteger nop);
     SQInteger GetLine(SQInstruction *curr);
+    static SQInteger EncodeLineInfos(const SQLineInfo *li,SQInteger n,unsigned char *out);
     bool Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write);
     static bool Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr &ret);
 #ifndef NO_GARBAGE_COLLECTOR
@@ -129,8 +178,8 @@ public:
     SQInteger _nlocalvarinfos;
     SQLocalVarInfo *_localvarinfos;
 
-    SQInteger _nlineinfos;
-    SQLineInfo *_lineinfos;
+    SQInteger _lineinfosize;
+    unsigned char *_lineinfos;
 
     SQInteger _nliterals;
     SQObjectPtr *_literals;
@@ -10,7 +10,7 @@
 #include "sqopcodes.h"
 #include "sqfuncstate.h"
 
-#ifdef _DEBUG_DUMP
+#if defined(_DEBUG_DUMP) || defined(SQ_INSTRUMENT)
 SQInstructionDesc g_InstrDesc[]={
     {_SC("_OP_LINE")},
     {_SC("_OP_LOAD")},
@@ -87,6 +87,7 @@ void DumpLiteral(SQObjectPtr &o)
 }
 
 SQFuncState::SQFuncState(SQSharedState *ss,SQFuncState *parent,CompilerErrorFunc efunc,void *ed)
+    : _arena(SQ_COMPILE_ARENA_CHUNK)
 {
         _nliterals = 0;
         _literals = SQTable::Create(ss,0);
@@ -103,6 +104,7 @@ SQFuncState::SQFuncState(SQSharedState *ss,SQFuncState *parent,CompilerErrorFunc
         _errtarget = ed;
         _bgenerator = false;
         _outers = 0;
+        _striplocals = parent ? parent->_striplocals : false;
         _ss = ss;
 
 }
@@ -327,7 +329,7 @@ void SQFuncState::SetStackSize(SQInteger n)
                 _outers--;
             }
             lvi._end_op = GetCurrentPos();
-            _localvarinfos.push_back(lvi);
+            if(!_striplocals) _localvarinfos.push_back(lvi);
         }
         _vlocals.pop_back();
     }
@@ -418,13 +420,24 @@ void SQFuncState::AddParameter(const SQObject &name)
     _parameters.push_back(name);
 }
 
-void SQFuncState::AddLineInfos(SQInteger line,bool lineop,bool force)
+//lineop is ignored with SQ_NO_LINEOPS
+void SQFuncState::AddLineInfos(SQInteger line,bool SQ_UNUSED_ARG(lineop),bool force)
 {
     if(_lastline!=line || force){
         SQLineInfo li;
         li._line=line;li._op=(GetCurrentPos()+1);
+#ifndef SQ_NO_LINEOPS
         if(lineop)AddInstruction(_OP_LINE,0,line);
+#endif
         if(_lastline!=line) {
+#ifdef SQ_NO_LINEOPS
+            //Nothing was emitted since the last line, so that one is empty
+            //and would only confuse line lookups.
+            if(_lineinfos.size() && _lineinfos.top()._op == li._op) {
+                _lineinfos.top()._line = line;
+            }
+            else
+#endif
             _lineinfos.push_back(li);
         }
         _lastline=line;
@@ -596,9 +609,10 @@ SQObject SQFuncState::CreateTable()
 SQFunctionProto *SQFuncState::BuildProto()
 {
 
+    SQInteger lineinfosize = SQFunctionProto::EncodeLineInfos(&_lineinfos[0],_lineinfos.size(),NULL);
     SQFunctionProto *f=SQFunctionProto::Create(_ss,_instructions.size(),
         _nliterals,_parameters.size(),_functions.size(),_outervalues.size(),
-        _lineinfos.size(),_localvarinfos.size(),_defaultparams.size());
+        lineinfosize,_localvarinfos.size(),_defaultparams.size());
 
     SQObjectPtr refidx,key,val;
     SQInteger idx;
@@ -617,7 +631,7 @@ SQFunctionProto *SQFuncState::BuildProto()
     for(SQUnsignedInteger np = 0; np < _parameters.size(); np++) f->_parameters[np] = _parameters[np];
     for(SQUnsignedInteger no = 0; no < _outervalues.size(); no++) f->_outervalues[no] = _outervalues[no];
     for(SQUnsignedInteger nl = 0; nl < _localvarinfos.size(); nl++) f->_localvarinfos[nl] = _localvarinfos[nl];
-    for(SQUnsignedInteger ni = 0; ni < _lineinfos.size(); ni++) f->_lineinfos[ni] = _lineinfos[ni];
+    SQFunctionProto::EncodeLineInfos(&_lineinfos[0],_lineinfos.size(),f->_lineinfos);
     for(SQUnsignedInteger nd = 0; nd < _defaultparams.size(); nd++) f->_defaultparams[nd] = _defaultparams[nd];
 
     memcpy(f->_instructions,&_instructions[0],_instructions.size()*sizeof(SQInstruction));
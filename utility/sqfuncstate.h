@@ -4,6 +4,14 @@
 ///////////////////////////////////
 #include "squtils.h"
 
+//Everything a function state holds dies with it, so it comes from the state's own arena
+typedef sqvector<SQInteger,SQArenaAllocator> SQCompileIntVec;
+typedef sqvector<SQObjectPtr,SQArenaAllocator> SQCompileObjectPtrVec;
+typedef sqvector<SQOuterVar,SQArenaAllocator> SQCompileOuterVarVec;
+typedef sqvector<SQInstruction,SQArenaAllocator> SQCompileInstructionVec;
+typedef sqvector<SQLocalVarInfo,SQArenaAllocator> SQCompileLocalVarInfoVec;
+typedef sqvector<SQLineInfo,SQArenaAllocator> SQCompileLineInfoVec;
+
 struct SQFuncState
 {
     SQFuncState(SQSharedState *ss,SQFuncState *parent,CompilerErrorFunc efunc,void *ed);
@@ -49,36 +57,40 @@ struct SQFuncState
     SQObject CreateString(const SQChar *s,SQInteger len = -1);
     SQObject CreateTable();
     bool IsConstant(const SQObject &name,SQObject &e);
+    //Declared first so it's current while the vectors below are made, and outlives them.
+    //A child state's scratch is all given back when the child is popped.
+    SQArena _arena;
     SQInteger _returnexp;
-    SQLocalVarInfoVec _vlocals;
-    SQIntVec _targetstack;
+    SQCompileLocalVarInfoVec _vlocals;
+    SQCompileIntVec _targetstack;
     SQInteger _stacksize;
     bool _varparams;
     bool _bgenerator;
-    SQIntVec _unresolvedbreaks;
-    SQIntVec _unresolvedcontinues;
-    SQObjectPtrVec _functions;
-    SQObjectPtrVec _parameters;
-    SQOuterVarVec _outervalues;
-    SQInstructionVec _instructions;
-    SQLocalVarInfoVec _localvarinfos;
+    SQCompileIntVec _unresolvedbreaks;
+    SQCompileIntVec _unresolvedcontinues;
+    SQCompileObjectPtrVec _functions;
+    SQCompileObjectPtrVec _parameters;
+    SQCompileOuterVarVec _outervalues;
+    SQCompileInstructionVec _instructions;
+    SQCompileLocalVarInfoVec _localvarinfos;
     SQObjectPtr _literals;
     SQObjectPtr _strings;
     SQObjectPtr _name;
     SQObjectPtr _sourcename;
     SQInteger _nliterals;
-    SQLineInfoVec _lineinfos;
+    SQCompileLineInfoVec _lineinfos;
     SQFuncState *_parent;
-    SQIntVec _scope_blocks;
-    SQIntVec _breaktargets;
-    SQIntVec _continuetargets;
-    SQIntVec _defaultparams;
+    SQCompileIntVec _scope_blocks;
+    SQCompileIntVec _breaktargets;
+    SQCompileIntVec _continuetargets;
+    SQCompileIntVec _defaultparams;
     SQInteger _lastline;
     SQInteger _traps; //contains number of nested exception traps
     SQInteger _outers;
     bool _optimization;
+    bool _striplocals; //no local variable names for debuggers, see sq_striplocals()
     SQSharedState *_sharedstate;
-    sqvector<SQFuncState*> _childstates;
+    sqvector<SQFuncState*,SQArenaAllocator> _childstates;
     SQInteger GetConstant(const SQObject &cons);
 private:
     CompilerErrorFunc _errfunc;
@@ -283,7 +283,7 @@ SQInteger SQLexer::Lex()
 SQInteger SQLexer::GetIDType(const SQChar *s,SQInteger len)
 {
     SQObjectPtr t;
-    if(_keywords->GetStr(s,len, t)) {
+    if(_keywords->GetStr(s,len,_sharedstate->_hashseed,t)) {
         return SQInteger(_integer(t));
     }
     return TK_IDENTIFIER;
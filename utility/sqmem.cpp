@@ -4,25 +4,500 @@
 #include "sqpcheader.h"
 #ifndef SQ_EXCLUDE_DEFAULT_MEMFUNCTIONS
 
-#ifdef M5Stack_Core_ESP32
-void *sq_vm_malloc(SQUnsignedInteger size){ 
-    
-    void *x = ps_malloc(size); 
-    if(x==0)
-        {
-            return malloc(size);
-        }
-    else
-        {
-            return x;
+//Placement. Every VM allocation goes to one of two tiers, fast internal RAM or the large tier,
+//which is PSRAM on boards that have it. Blocks of SQ_MEM_LARGESIZE bytes or more(long strings,
+//blobs, array storage) go large, everything else stays fast, unless a SQMemPlacement is
+//in effect, which is how stacks are kept fast and bytecode is sent large whatever their size.
+//Without PSRAM both tiers are the same heap, but are still counted separately.
+#if defined(M5Stack_Core_ESP32) || (defined(ESP32) && defined(BOARD_HAS_PSRAM))
+#define SQ_MEM_PSRAM
+#include "esp_heap_caps.h"
+//esp_ptr_external_ram() is in esp_memory_utils.h since IDF 5, soc_memory_layout.h before that
+#ifdef __has_include
+#if __has_include("esp_memory_utils.h")
+#define SQ_MEM_UTILS_H
+#endif
+#endif
+#ifdef SQ_MEM_UTILS_H
+#include "esp_memory_utils.h"
+#else
+#include "soc/soc_memory_layout.h"
+#endif
+#endif
+
+static SQUnsignedInteger sq_mem_largesize = SQ_MEM_LARGESIZE;
+static SQInteger sq_mem_placement = SQ_PLACE_BYSIZE;
+static SQUnsignedInteger sq_mem_spilled[SQ_MEMTIERS] = {0, 0};
+
+void sq_setmemlargesize(SQUnsignedInteger size)
+{
+    sq_mem_largesize = size;
+}
+
+SQUnsignedInteger sq_getmemlargesize()
+{
+    return sq_mem_largesize;
+}
+
+SQInteger sq_vm_setplacement(SQInteger tier)
+{
+    SQInteger prev = sq_mem_placement;
+    sq_mem_placement = tier;
+    return prev;
+}
+
+static inline SQInteger sq_mem_tierof(SQUnsignedInteger size)
+{
+    if(sq_mem_placement != SQ_PLACE_BYSIZE) return sq_mem_placement;
+    return size >= sq_mem_largesize ? SQ_MEMTIER_LARGE : SQ_MEMTIER_FAST;
+}
+
+#ifdef SQ_MEM_PSRAM
+static const uint32_t sq_mem_caps[SQ_MEMTIERS] = {MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT, MALLOC_CAP_SPIRAM};
+
+//Sets *tier to wherever the block really is, and counts a spill if that's not where it was meant to go
+static void sq_raw_landed(void *x, SQInteger *tier)
+{
+    SQInteger want = *tier;
+    *tier = esp_ptr_external_ram(x) ? SQ_MEMTIER_LARGE : SQ_MEMTIER_FAST;
+    if(*tier != want) sq_mem_spilled[want]++;
+}
+
+//A full tier isn't fatal while the other one has room.
+static void *sq_raw_malloc(SQUnsignedInteger size, SQInteger *tier)
+{
+    void *x = heap_caps_malloc(size, sq_mem_caps[*tier]);
+    if(x) return x;
+    x = malloc(size);
+    if(x) sq_raw_landed(x, tier);
+    return x;
+}
+
+//Moves the block if it's in the wrong tier for its new size
+static void *sq_raw_realloc(void *p, SQUnsignedInteger size, SQInteger *tier)
+{
+    void *x = heap_caps_realloc(p, size, sq_mem_caps[*tier]);
+    if(x) return x;
+    x = realloc(p, size);
+    if(x) sq_raw_landed(x, tier);
+    return x;
+}
+#else
+static void *sq_raw_malloc(SQUnsignedInteger size, SQInteger *SQ_UNUSED_ARG(tier)){ return malloc(size); }
+static void *sq_raw_realloc(void *p, SQUnsignedInteger size, SQInteger *SQ_UNUSED_ARG(tier)){ return realloc(p, size); }
+#endif
+
+#ifdef SQ_POOL_ALLOCATOR
+
+//Size class allocator. Almost everything the VM allocates is a small fixed size object,
+//and the free path always gets the size, so blocks need no header. Each class has a free list
+//that gets refilled a whole slab at a time. Slabs are never given back, the blocks in them
+//just get reused, which keeps small objects from scattering across the heap.
+//Anything bigger than the largest class goes straight to malloc.
+
+struct SQPoolBlock{
+    SQPoolBlock *_next;
+};
+
+struct SQPoolClass{
+    SQPoolBlock *_free;
+    SQPoolStats _stats;
+};
+
+static const SQUnsignedInteger sq_pool_sizes[SQ_POOL_CLASSES] = {8, 16, 24, 32, 40, 48, 64, 80, 96, 128};
+#define SQ_POOL_MAXSIZE 128
+
+static SQPoolClass sq_pool[SQ_POOL_CLASSES];
+//Maps (size+7)/8 to the index of the smallest class that fits
+static unsigned char sq_pool_lookup[(SQ_POOL_MAXSIZE/8)+1];
+static bool sq_pool_ready = false;
+
+static SQUnsignedInteger sq_pool_largeallocs = 0;
+static SQUnsignedInteger sq_pool_largebytes = 0;
+
+static void sq_pool_init()
+{
+    SQInteger c = 0;
+    for(SQInteger i = 0; i <= (SQ_POOL_MAXSIZE/8); i++) {
+        while(sq_pool_sizes[c] < (SQUnsignedInteger)(i*8)) c++;
+        sq_pool_lookup[i] = (unsigned char)c;
+    }
+    for(SQInteger i = 0; i < SQ_POOL_CLASSES; i++) {
+        sq_pool[i]._free = NULL;
+        memset(&sq_pool[i]._stats, 0, sizeof(SQPoolStats));
+        sq_pool[i]._stats.blocksize = sq_pool_sizes[i];
+    }
+    sq_pool_ready = true;
+}
+
+static inline SQInteger sq_pool_class(SQUnsignedInteger size)
+{
+    if(size > SQ_POOL_MAXSIZE) return -1;
+    if(!sq_pool_ready) sq_pool_init();
+    return sq_pool_lookup[(size+7)>>3];
+}
+
+//Carve a new slab into blocks and put them all on the free list
+static bool sq_pool_refill(SQPoolClass *pc)
+{
+    SQUnsignedInteger bsize = pc->_stats.blocksize;
+    SQUnsignedInteger n = SQ_POOL_SLAB_SIZE / bsize;
+    //Slabs hold small objects, so they belong in fast RAM however big they are
+    SQInteger tier = SQ_MEMTIER_FAST;
+    unsigned char *slab = (unsigned char *)sq_raw_malloc(n * bsize, &tier);
+    if(!slab) return false;
+    for(SQUnsignedInteger i = 0; i < n; i++) {
+        SQPoolBlock *b = (SQPoolBlock *)(slab + (i * bsize));
+        b->_next = pc->_free;
+        pc->_free = b;
+    }
+    pc->_stats.slabs++;
+    pc->_stats.free += n;
+    return true;
+}
+
+static void *sq_pool_alloc(SQInteger c, SQUnsignedInteger size)
+{
+    SQPoolClass *pc = &sq_pool[c];
+    if(!pc->_free && !sq_pool_refill(pc)) return NULL;
+    SQPoolBlock *b = pc->_free;
+    pc->_free = b->_next;
+    pc->_stats.free--;
+    pc->_stats.used++;
+    pc->_stats.requested += size;
+    return b;
+}
+
+static void sq_pool_release(SQInteger c, void *p, SQUnsignedInteger size)
+{
+    SQPoolClass *pc = &sq_pool[c];
+    SQPoolBlock *b = (SQPoolBlock *)p;
+    b->_next = pc->_free;
+    pc->_free = b;
+    pc->_stats.free++;
+    pc->_stats.used--;
+    pc->_stats.requested -= size;
+}
+
+static void *sq_mem_malloc(SQUnsignedInteger size, SQInteger *tier)
+{
+    SQInteger c = sq_pool_class(size);
+    if(c >= 0) {
+        *tier = SQ_MEMTIER_FAST;
+        return sq_pool_alloc(c, size);
+    }
+    void *p = sq_raw_malloc(size, tier);
+    if(p) {
+        sq_pool_largeallocs++;
+        sq_pool_largebytes += size;
+    }
+    return p;
+}
+
+static void sq_mem_free(void *p, SQUnsignedInteger size);
+
+static void *sq_mem_realloc(void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size, SQInteger *tier)
+{
+    SQInteger oc = p ? sq_pool_class(oldsize) : -1;
+    SQInteger nc = sq_pool_class(size);
+    if(p && oc < 0 && nc < 0) {
+        void *n = sq_raw_realloc(p, size, tier);
+        if(n) {
+            sq_pool_largebytes += size;
+            sq_pool_largebytes -= oldsize;
         }
+        return n;
+    }
+    //Still fits the same block, just fix up the accounting
+    if(p && oc == nc) {
+        *tier = SQ_MEMTIER_FAST;
+        sq_pool[oc]._stats.requested += size;
+        sq_pool[oc]._stats.requested -= oldsize;
+        return p;
+    }
+    void *n = sq_mem_malloc(size, tier);
+    if(!n) return NULL;
+    if(p) {
+        memcpy(n, p, oldsize < size ? oldsize : size);
+        sq_mem_free(p, oldsize);
+    }
+    return n;
+}
+
+static void sq_mem_free(void *p, SQUnsignedInteger size)
+{
+    if(!p) return;
+    SQInteger c = sq_pool_class(size);
+    if(c >= 0) {
+        sq_pool_release(c, p, size);
+        return;
+    }
+    sq_pool_largeallocs--;
+    sq_pool_largebytes -= size;
+    free(p);
+}
+
+SQRESULT sq_getpoolstats(SQInteger sizeclass, SQPoolStats *ps)
+{
+    if(!sq_pool_ready) sq_pool_init();
+    if(sizeclass >= 0 && sizeclass < SQ_POOL_CLASSES) {
+        *ps = sq_pool[sizeclass]._stats;
+        return SQ_OK;
     }
+    //One past the last class describes the allocations that bypass the pool
+    if(sizeclass == SQ_POOL_CLASSES) {
+        memset(ps, 0, sizeof(SQPoolStats));
+        ps->used = sq_pool_largeallocs;
+        ps->requested = sq_pool_largebytes;
+        return SQ_OK;
+    }
+    return SQ_ERROR;
+}
+
 #else
-void *sq_vm_malloc(SQUnsignedInteger size){ return malloc(size); }
+
+static void *sq_mem_malloc(SQUnsignedInteger size, SQInteger *tier){ return sq_raw_malloc(size, tier); }
+
+static void *sq_mem_realloc(void *p, SQUnsignedInteger SQ_UNUSED_ARG(oldsize), SQUnsignedInteger size, SQInteger *tier){ return sq_raw_realloc(p, size, tier); }
+
+static void sq_mem_free(void *p, SQUnsignedInteger SQ_UNUSED_ARG(size)){ free(p); }
+
+SQRESULT sq_getpoolstats(SQInteger SQ_UNUSED_ARG(sizeclass), SQPoolStats *SQ_UNUSED_ARG(ps)){ return SQ_ERROR; }
+
 #endif
 
+//Whatever VM is running charges its allocations to this
+static SQMemAccount *sq_current_account = NULL;
+
+//Bytes the VMs have allocated and not yet freed, which is what the collector's
+//automatic triggering goes by.
+static SQUnsignedInteger sq_mem_inuse = 0;
+
+SQUnsignedInteger sq_getmeminuse()
+{
+    return sq_mem_inuse;
+}
+
+SQMemAccount *sq_setcurrentmemaccount(SQMemAccount *a)
+{
+    SQMemAccount *prev = sq_current_account;
+    sq_current_account = a;
+    return prev;
+}
+
+SQMemAccount *sq_newmemaccount(SQUnsignedInteger quota, SQBool closeonquota)
+{
+    SQMemAccount *a = (SQMemAccount *)malloc(sizeof(SQMemAccount));
+    if(!a) return NULL;
+    memset(a, 0, sizeof(SQMemAccount));
+    a->quota = quota;
+    a->closeonquota = closeonquota;
+    a->refs = 1;
+    return a;
+}
+
+//An account lives until nothing refers to it and nothing allocated under it is left,
+//so blocks that outlive their program can still be credited back.
+static void sq_memaccount_maybefree(SQMemAccount *a)
+{
+    if(a->refs == 0 && a->current == 0) {
+        if(sq_current_account == a) sq_current_account = NULL;
+        free(a);
+    }
+}
+
+void sq_releasememaccount(SQMemAccount *a)
+{
+    if(!a) return;
+    a->refs--;
+    sq_memaccount_maybefree(a);
+}
+
+#ifdef SQ_MEM_ACCOUNTING
+
+//Every block starts with a pointer to the account it was charged to, with the tier the block
+//is in kept in the low bit, padded so the block itself stays aligned.
+#define SQ_MEM_HEADER ((sizeof(SQMemAccount *) > SQ_ALIGNMENT) ? sizeof(SQMemAccount *) : SQ_ALIGNMENT)
+#define SQ_MEM_HDRACCOUNT(base) ((SQMemAccount *)(*((size_t *)(base)) & ~((size_t)1)))
+#define SQ_MEM_HDRTIER(base) ((SQInteger)(*((size_t *)(base)) & 1))
+
+static SQMemTierStats sq_mem_tiers[SQ_MEMTIERS];
+
+static inline void sq_memaccount_charge(SQMemAccount *a, SQUnsignedInteger size)
+{
+    a->current += size;
+    if(a->current > a->peak) a->peak = a->current;
+    if(a->quota && (a->current > a->quota)) a->exceeded = SQTrue;
+}
+
+static inline void sq_memtier_charge(SQInteger tier, SQUnsignedInteger size)
+{
+    SQMemTierStats *t = &sq_mem_tiers[tier];
+    t->inuse += size;
+    t->blocks++;
+    if(t->inuse > t->peak) t->peak = t->inuse;
+}
+
+static inline void sq_memtier_credit(SQInteger tier, SQUnsignedInteger size)
+{
+    sq_mem_tiers[tier].inuse -= size;
+    sq_mem_tiers[tier].blocks--;
+}
+
+void *sq_vm_malloc(SQUnsignedInteger size)
+{
+    SQInteger tier = sq_mem_tierof(size);
+    unsigned char *p = (unsigned char *)sq_mem_malloc(size + SQ_MEM_HEADER, &tier);
+    if(!p) return NULL;
+    SQMemAccount *a = sq_current_account;
+    *((size_t *)p) = ((size_t)a) | (size_t)tier;
+    if(a) sq_memaccount_charge(a, size);
+    sq_memtier_charge(tier, size);
+    sq_mem_inuse += size;
+    return p + SQ_MEM_HEADER;
+}
 
-void *sq_vm_realloc(void *p, SQUnsignedInteger SQ_UNUSED_ARG(oldsize), SQUnsignedInteger size){ return realloc(p, size); }
+void *sq_vm_realloc(void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size)
+{
+    if(!p) return sq_vm_malloc(size);
+    unsigned char *base = ((unsigned char *)p) - SQ_MEM_HEADER;
+    //Stays charged to whoever allocated it in the first place
+    SQMemAccount *a = SQ_MEM_HDRACCOUNT(base);
+    SQInteger oldtier = SQ_MEM_HDRTIER(base);
+    SQInteger tier = sq_mem_tierof(size);
+    base = (unsigned char *)sq_mem_realloc(base, oldsize + SQ_MEM_HEADER, size + SQ_MEM_HEADER, &tier);
+    if(!base) return NULL;
+    *((size_t *)base) = ((size_t)a) | (size_t)tier;
+    if(a) {
+        a->current -= oldsize;
+        sq_memaccount_charge(a, size);
+    }
+    sq_memtier_credit(oldtier, oldsize);
+    sq_memtier_charge(tier, size);
+    sq_mem_inuse += size;
+    sq_mem_inuse -= oldsize;
+    return base + SQ_MEM_HEADER;
+}
+
+void sq_vm_free(void *p, SQUnsignedInteger size)
+{
+    if(!p) return;
+    unsigned char *base = ((unsigned char *)p) - SQ_MEM_HEADER;
+    SQMemAccount *a = SQ_MEM_HDRACCOUNT(base);
+    sq_memtier_credit(SQ_MEM_HDRTIER(base), size);
+    sq_mem_free(base, size + SQ_MEM_HEADER);
+    sq_mem_inuse -= size;
+    if(a) {
+        a->current -= size;
+        sq_memaccount_maybefree(a);
+    }
+}
+
+SQRESULT sq_getmemtierstats(SQInteger tier, SQMemTierStats *st)
+{
+    if(tier < 0 || tier >= SQ_MEMTIERS) return SQ_ERROR;
+    *st = sq_mem_tiers[tier];
+    st->spilled = sq_mem_spilled[tier];
+    return SQ_OK;
+}
+
+#else
 
-void sq_vm_free(void *p, SQUnsignedInteger SQ_UNUSED_ARG(size)){ free(p); }
+void *sq_vm_malloc(SQUnsignedInteger size)
+{
+    SQInteger tier = sq_mem_tierof(size);
+    void *p = sq_mem_malloc(size, &tier);
+    if(p) sq_mem_inuse += size;
+    return p;
+}
+
+void *sq_vm_realloc(void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size)
+{
+    SQInteger tier = sq_mem_tierof(size);
+    void *n = sq_mem_realloc(p, oldsize, size, &tier);
+    if(!n) return NULL;
+    sq_mem_inuse += size;
+    if(p) sq_mem_inuse -= oldsize;
+    return n;
+}
+
+void sq_vm_free(void *p, SQUnsignedInteger size)
+{
+    if(!p) return;
+    sq_mem_free(p, size);
+    sq_mem_inuse -= size;
+}
+
+//Blocks are still placed, but without a header there's nowhere to remember which tier each one is in
+SQRESULT sq_getmemtierstats(SQInteger SQ_UNUSED_ARG(tier), SQMemTierStats *SQ_UNUSED_ARG(st)){ return SQ_ERROR; }
+
+#endif
 #endif
+
+//Chunks stop doubling at this size, bigger requests still get a chunk of their own
+#define SQ_ARENA_MAXCHUNK 16384
+#define SQ_ARENA_HEADER sq_aligning(sizeof(SQArena::Chunk))
+
+SQArena *SQArena::_current = NULL;
+
+SQArena::SQArena(SQUnsignedInteger chunksize)
+{
+    _chunks = NULL;
+    _top = _end = _last = NULL;
+    _chunksize = chunksize;
+    _prev = _current;
+    _current = this;
+}
+
+SQArena::~SQArena()
+{
+    while(_chunks) {
+        Chunk *next = _chunks->_next;
+        sq_vm_free(_chunks, _chunks->_size);
+        _chunks = next;
+    }
+    _current = _prev;
+}
+
+bool SQArena::NewChunk(SQUnsignedInteger size)
+{
+    SQUnsignedInteger csize = SQ_ARENA_HEADER + size;
+    if(csize < _chunksize) csize = _chunksize;
+    if(_chunksize < SQ_ARENA_MAXCHUNK) _chunksize *= 2;
+    //Scratch is short lived and hot, keep it out of PSRAM
+    SQMemPlacement fast(SQ_MEMTIER_FAST);
+    Chunk *c = (Chunk *)sq_vm_malloc(csize);
+    if(!c) return false;
+    c->_size = csize;
+    c->_next = _chunks;
+    _chunks = c;
+    _top = ((unsigned char *)c) + SQ_ARENA_HEADER;
+    _end = ((unsigned char *)c) + csize;
+    return true;
+}
+
+void *SQArena::Alloc(SQUnsignedInteger size)
+{
+    size = sq_aligning(size);
+    if((SQUnsignedInteger)(_end - _top) < size && !NewChunk(size)) return NULL;
+    _last = _top;
+    _top += size;
+    return _last;
+}
+
+void *SQArena::Realloc(void *p, SQUnsignedInteger oldsize, SQUnsignedInteger size)
+{
+    if(!p) return Alloc(size);
+    if(p == _last && (SQUnsignedInteger)(_end - _last) >= sq_aligning(size)) {
+        _top = _last + sq_aligning(size);
+        return p;
+    }
+    void *n = Alloc(size);
+    if(n) memcpy(n, p, oldsize < size ? oldsize : size);
+    return n;
+}
+
+void SQArena::Free(void *p, SQUnsignedInteger SQ_UNUSED_ARG(size))
+{
+    if(p && p == _last) _top = _last;
+}
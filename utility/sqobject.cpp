@@ -52,6 +52,27 @@ SQString *SQString::Create(SQSharedState *ss,const SQChar *s,SQInteger len)
     return str;
 }
 
+SQString *SQString::CreateTransient(SQSharedState *ss,const SQChar *s,SQInteger len)
+{
+    if(len < SQ_TRANSIENT_MINLEN) return ADD_STRING(ss,s,len);
+    SQString *str=ss->_stringtable->NewTransient(len);
+    memcpy(str->_val,s,sq_rsl(len));
+    return str;
+}
+
+SQHash SQString::ComputeHash()
+{
+    _hash = _hashstr(_val,_len,_sharedstate->_hashseed);
+    return _hash;
+}
+
+//Returns the interned string equal to this one, which is this one unless an equal
+//string was already interned
+SQString *SQString::Intern()
+{
+    return IsTransient() ? _sharedstate->_stringtable->Intern(this) : this;
+}
+
 void SQString::Release()
 {
     REMOVE_STRING(_sharedstate,this);
@@ -128,6 +149,9 @@ bool SQDelegable::SetDelegate(SQTable *mt)
     if (mt) __ObjAddRef(mt);
     __ObjRelease(_delegate);
     _delegate = mt;
+#ifndef NO_GARBAGE_COLLECTOR
+    if (mt && _sharedstate->_gcphase == SQ_GC_PROPAGATE) _sharedstate->Barrier(this);
+#endif
     return true;
 }
 
@@ -233,38 +257,42 @@ const SQChar* SQFunctionProto::GetLocal(SQVM *vm,SQUnsignedInteger stackbase,SQU
 }
 
 
+//The line of the last entry before curr. The VM has already moved past the instruction
+//that's running by the time anyone asks, so an entry starting at curr doesn't count yet.
 SQInteger SQFunctionProto::GetLine(SQInstruction *curr)
 {
     SQInteger op = (SQInteger)(curr-_instructions);
-    SQInteger line=_lineinfos[0]._line;
-    SQInteger low = 0;
-    SQInteger high = _nlineinfos - 1;
-    SQInteger mid = 0;
-    while(low <= high)
-    {
-        mid = low + ((high - low) >> 1);
-        SQInteger curop = _lineinfos[mid]._op;
-        if(curop > op)
-        {
-            high = mid - 1;
-        }
-        else if(curop < op) {
-            if(mid < (_nlineinfos - 1)
-                && _lineinfos[mid + 1]._op >= op) {
-                break;
-            }
-            low = mid + 1;
-        }
-        else { //equal
-            break;
-        }
-    }
-
-    while(mid > 0 && _lineinfos[mid]._op >= op) mid--;
+    SQLineInfoReader r(_lineinfos,_lineinfosize);
+    if(!r.Next()) return 0;
+    SQInteger line = r._line;
+    while(r.Next() && r._op < op) line = r._line;
+    return line;
+}
 
-    line = _lineinfos[mid]._line;
+static unsigned char *sq_writedelta(unsigned char *out,SQInteger delta,SQInteger &size)
+{
+    SQUnsignedInteger u = (((SQUnsignedInteger)delta) << 1) ^ (SQUnsignedInteger)(delta >> ((sizeof(SQInteger)*8)-1));
+    do {
+        unsigned char c = (unsigned char)(u & 0x7F);
+        u >>= 7;
+        if(u) c |= 0x80;
+        if(out) *out++ = c;
+        size++;
+    } while(u);
+    return out;
+}
 
-    return line;
+//Returns the number of bytes the entries take, only counting them if out is NULL
+SQInteger SQFunctionProto::EncodeLineInfos(const SQLineInfo *li,SQInteger n,unsigned char *out)
+{
+    SQInteger size = 0, op = 0, line = 0;
+    for(SQInteger i = 0; i < n; i++) {
+        out = sq_writedelta(out,li[i]._op - op,size);
+        out = sq_writedelta(out,li[i]._line - line,size);
+        op = li[i]._op;
+        line = li[i]._line;
+    }
+    return size;
 }
 
 SQClosure::~SQClosure()
@@ -409,7 +437,7 @@ bool SQFunctionProto::Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
 {
     SQInteger i,nliterals = _nliterals,nparameters = _nparameters;
     SQInteger noutervalues = _noutervalues,nlocalvarinfos = _nlocalvarinfos;
-    SQInteger nlineinfos=_nlineinfos,ninstructions = _ninstructions,nfunctions=_nfunctions;
+    SQInteger lineinfosize=_lineinfosize,ninstructions = _ninstructions,nfunctions=_nfunctions;
     SQInteger ndefaultparams = _ndefaultparams;
     _CHECK_IO(WriteTag(v,write,up,SQ_CLOSURESTREAM_PART));
     _CHECK_IO(WriteObject(v,up,write,_sourcename));
@@ -419,7 +447,7 @@ bool SQFunctionProto::Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
     _CHECK_IO(SafeWrite(v,write,up,&nparameters,sizeof(nparameters)));
     _CHECK_IO(SafeWrite(v,write,up,&noutervalues,sizeof(noutervalues)));
     _CHECK_IO(SafeWrite(v,write,up,&nlocalvarinfos,sizeof(nlocalvarinfos)));
-    _CHECK_IO(SafeWrite(v,write,up,&nlineinfos,sizeof(nlineinfos)));
+    _CHECK_IO(SafeWrite(v,write,up,&lineinfosize,sizeof(lineinfosize)));
     _CHECK_IO(SafeWrite(v,write,up,&ndefaultparams,sizeof(ndefaultparams)));
     _CHECK_IO(SafeWrite(v,write,up,&ninstructions,sizeof(ninstructions)));
     _CHECK_IO(SafeWrite(v,write,up,&nfunctions,sizeof(nfunctions)));
@@ -450,7 +478,7 @@ bool SQFunctionProto::Save(SQVM *v,SQUserPointer up,SQWRITEFUNC write)
     }
 
     _CHECK_IO(WriteTag(v,write,up,SQ_CLOSURESTREAM_PART));
-    _CHECK_IO(SafeWrite(v,write,up,_lineinfos,sizeof(SQLineInfo)*nlineinfos));
+    _CHECK_IO(SafeWrite(v,write,up,_lineinfos,lineinfosize));
 
     _CHECK_IO(WriteTag(v,write,up,SQ_CLOSURESTREAM_PART));
     _CHECK_IO(SafeWrite(v,write,up,_defaultparams,sizeof(SQInteger)*ndefaultparams));
@@ -472,7 +500,7 @@ bool SQFunctionProto::Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr
 {
     SQInteger i, nliterals,nparameters;
     SQInteger noutervalues ,nlocalvarinfos ;
-    SQInteger nlineinfos,ninstructions ,nfunctions,ndefaultparams ;
+    SQInteger lineinfosize,ninstructions ,nfunctions,ndefaultparams ;
     SQObjectPtr sourcename, name;
     SQObjectPtr o;
     _CHECK_IO(CheckTag(v,read,up,SQ_CLOSURESTREAM_PART));
@@ -484,14 +512,14 @@ bool SQFunctionProto::Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr
     _CHECK_IO(SafeRead(v,read,up, &nparameters, sizeof(nparameters)));
     _CHECK_IO(SafeRead(v,read,up, &noutervalues, sizeof(noutervalues)));
     _CHECK_IO(SafeRead(v,read,up, &nlocalvarinfos, sizeof(nlocalvarinfos)));
-    _CHECK_IO(SafeRead(v,read,up, &nlineinfos, sizeof(nlineinfos)));
+    _CHECK_IO(SafeRead(v,read,up, &lineinfosize, sizeof(lineinfosize)));
     _CHECK_IO(SafeRead(v,read,up, &ndefaultparams, sizeof(ndefaultparams)));
     _CHECK_IO(SafeRead(v,read,up, &ninstructions, sizeof(ninstructions)));
     _CHECK_IO(SafeRead(v,read,up, &nfunctions, sizeof(nfunctions)));
 
 
     SQFunctionProto *f = SQFunctionProto::Create(_opt_ss(v),ninstructions,nliterals,nparameters,
-            nfunctions,noutervalues,nlineinfos,nlocalvarinfos,ndefaultparams);
+            nfunctions,noutervalues,lineinfosize,nlocalvarinfos,ndefaultparams);
     SQObjectPtr proto = f; //gets a ref in case of failure
     f->_sourcename = sourcename;
     f->_name = name;
@@ -529,7 +557,11 @@ bool SQFunctionProto::Load(SQVM *v,SQUserPointer up,SQREADFUNC read,SQObjectPtr
         f->_localvarinfos[i] = lvi;
     }
     _CHECK_IO(CheckTag(v,read,up,SQ_CLOSURESTREAM_PART));
-    _CHECK_IO(SafeRead(v,read,up, f->_lineinfos, sizeof(SQLineInfo)*nlineinfos));
+    _CHECK_IO(SafeRead(v,read,up, f->_lineinfos, lineinfosize));
+    if(!SQLineInfoReader::Valid(f->_lineinfos,lineinfosize)) {
+        v->Raise_Error(_SC("invalid or corrupted closure stream"));
+        return false;
+    }
 
     _CHECK_IO(CheckTag(v,read,up,SQ_CLOSURESTREAM_PART));
     _CHECK_IO(SafeRead(v,read,up, f->_defaultparams, sizeof(SQInteger)*ndefaultparams));
@@ -568,6 +600,7 @@ void SQVM::Mark(SQCollectable **chain)
         SQSharedState::MarkObject(temp_reg, chain);
         for(SQUnsignedInteger i = 0; i < _stack.size(); i++) SQSharedState::MarkObject(_stack[i], chain);
         for(SQInteger k = 0; k < _callsstacksize; k++) SQSharedState::MarkObject(_callsstack[k]._closure, chain);
+        for(SQUnsignedInteger j = 0; j < _profile.size(); j++) SQSharedState::MarkObject(_profile[j]._function, chain);
     END_MARK()
 }
 
@@ -581,7 +614,7 @@ void SQArray::Mark(SQCollectable **chain)
 void SQTable::Mark(SQCollectable **chain)
 {
     START_MARK()
-        if(_delegate) _delegate->Mark(chain);
+        if(_delegate) SQSharedState::MarkCollectable(_delegate);
         SQInteger len = _numofnodes;
         for(SQInteger i = 0; i < len; i++){
             SQSharedState::MarkObject(_nodes[i].key, chain);
@@ -593,8 +626,8 @@ void SQTable::Mark(SQCollectable **chain)
 void SQClass::Mark(SQCollectable **chain)
 {
     START_MARK()
-        _members->Mark(chain);
-        if(_base) _base->Mark(chain);
+        SQSharedState::MarkCollectable(_members);
+        if(_base) SQSharedState::MarkCollectable(_base);
         SQSharedState::MarkObject(_attributes, chain);
         for(SQUnsignedInteger i =0; i< _defaultvalues.size(); i++) {
             SQSharedState::MarkObject(_defaultvalues[i].val, chain);
@@ -613,7 +646,7 @@ void SQClass::Mark(SQCollectable **chain)
 void SQInstance::Mark(SQCollectable **chain)
 {
     START_MARK()
-        _class->Mark(chain);
+        SQSharedState::MarkCollectable(_class);
         SQUnsignedInteger nvalues = _class->_defaultvalues.size();
         for(SQUnsignedInteger i =0; i< nvalues; i++) {
             SQSharedState::MarkObject(_values[i], chain);
@@ -640,9 +673,9 @@ void SQFunctionProto::Mark(SQCollectable **chain)
 void SQClosure::Mark(SQCollectable **chain)
 {
     START_MARK()
-        if(_base) _base->Mark(chain);
+        if(_base) SQSharedState::MarkCollectable(_base);
         SQFunctionProto *fp = _function;
-        fp->Mark(chain);
+        SQSharedState::MarkCollectable(fp);
         for(SQInteger i = 0; i < fp->_noutervalues; i++) SQSharedState::MarkObject(_outervalues[i], chain);
         for(SQInteger k = 0; k < fp->_ndefaultparams; k++) SQSharedState::MarkObject(_defaultparams[k], chain);
     END_MARK()
@@ -667,11 +700,11 @@ void SQOuter::Mark(SQCollectable **chain)
 
 void SQUserData::Mark(SQCollectable **chain){
     START_MARK()
-        if(_delegate) _delegate->Mark(chain);
+        if(_delegate) SQSharedState::MarkCollectable(_delegate);
     END_MARK()
 }
 
-void SQCollectable::UnMark() { _uiRef&=~MARK_FLAG; }
+void SQCollectable::UnMark() { _uiRef&=~(MARK_FLAG|GRAY_FLAG|AGAIN_FLAG); }
 
 #endif
 
@@ -10,7 +10,8 @@
 #define UINT_MINUS_ONE (0xFFFFFFFF)
 #endif
 
-#define SQ_CLOSURESTREAM_HEAD (('S'<<24)|('Q'<<16)|('I'<<8)|('R'))
+//Upstream uses SQIR, the line info here is delta encoded so the streams aren't compatible
+#define SQ_CLOSURESTREAM_HEAD (('S'<<24)|('Q'<<16)|('I'<<8)|('D'))
 #define SQ_CLOSURESTREAM_PART (('P'<<24)|('A'<<16)|('R'<<8)|('T'))
 #define SQ_CLOSURESTREAM_TAIL (('T'<<24)|('A'<<16)|('I'<<8)|('L'))
 
@@ -84,6 +85,9 @@ enum SQMetaMethod{
 
 #define MINPOWER2 4
 
+//The top bits of _uiRef hold the collector's marks, the rest is the reference count
+#define SQ_REFCOUNT_MASK 0x1FFFFFFF
+
 struct SQRefCounted
 {
     SQUnsignedInteger _uiRef;
@@ -110,7 +114,7 @@ struct SQObjectPtr;
             unval.pRefCounted->_uiRef++; \
         }
 
-#define __Release(type,unval) if(ISREFCOUNTED(type) && ((--unval.pRefCounted->_uiRef)==0))  \
+#define __Release(type,unval) if(ISREFCOUNTED(type) && (((--unval.pRefCounted->_uiRef)&SQ_REFCOUNT_MASK)==0))  \
         {   \
             unval.pRefCounted->Release();   \
         }
@@ -118,7 +122,7 @@ struct SQObjectPtr;
 #define __ObjRelease(obj) { \
     if((obj)) { \
         (obj)->_uiRef--; \
-        if((obj)->_uiRef == 0) \
+        if(((obj)->_uiRef&SQ_REFCOUNT_MASK) == 0) \
             (obj)->Release(); \
         (obj) = NULL;   \
     } \
@@ -309,7 +313,13 @@ inline void _Swap(SQObject &a,SQObject &b)
 
 /////////////////////////////////////////////////////////////////////////////////////
 #ifndef NO_GARBAGE_COLLECTOR
+//Tri-color marking. White objects have no flag and live in _gc_chain, gray ones are waiting
+//in _gc_gray to have their children marked, black ones have been traversed and live in _gc_black.
+//Black objects that may change behind the collector's back are kept in _gc_grayagain instead
+//and get traversed once more in the atomic step at the end of marking.
 #define MARK_FLAG 0x80000000
+#define GRAY_FLAG 0x40000000
+#define AGAIN_FLAG 0x20000000
 struct SQCollectable : public SQRefCounted {
     SQCollectable *_next;
     SQCollectable *_prev;
@@ -324,16 +334,20 @@ struct SQCollectable : public SQRefCounted {
 };
 
 
-#define ADD_TO_CHAIN(chain,obj) AddToChain(chain,obj)
-#define REMOVE_FROM_CHAIN(chain,obj) {if(!(_uiRef&MARK_FLAG))RemoveFromChain(chain,obj);}
+#define ADD_TO_CHAIN(chain,obj) (obj)->_sharedstate->AddNew(chain,obj)
+//Objects can die while marked, in which case they are in another chain
+#define REMOVE_FROM_CHAIN(chain,obj) RemoveFromChain(_sharedstate->ChainOf(chain,obj),obj)
 #define CHAINABLE_OBJ SQCollectable
 #define INIT_CHAIN() {_next=NULL;_prev=NULL;_sharedstate=ss;}
+//Has to be used when storing a reference into an object the collector may have already traversed
+#define SQ_BARRIER(obj,val) {if(ISREFCOUNTED(sq_type(val)) && (obj)->_sharedstate->_gcphase == SQ_GC_PROPAGATE) (obj)->_sharedstate->Barrier(obj);}
 #else
 
 #define ADD_TO_CHAIN(chain,obj) ((void)0)
 #define REMOVE_FROM_CHAIN(chain,obj) ((void)0)
 #define CHAINABLE_OBJ SQRefCounted
 #define INIT_CHAIN() ((void)0)
+#define SQ_BARRIER(obj,val) ((void)0)
 #endif
 
 struct SQDelegable : public CHAINABLE_OBJ {
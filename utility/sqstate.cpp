@@ -12,6 +12,13 @@
 #include "squserdata.h"
 #include "sqclass.h"
 
+//Each shared state asks the platform for a hash seed, so the string hashes of one VM
+//can't be predicted from another. Zero, the default, gives the same hashes every run.
+SQHash __attribute__((weak)) sq_newhashseed()
+{
+    return 0;
+}
+
 SQSharedState::SQSharedState()
 {
     _compilererrorhandler = NULL;
@@ -21,6 +28,10 @@ SQSharedState::SQSharedState()
     _notifyallexceptions = false;
     _foreignptr = NULL;
     _releasehook = NULL;
+    _hashseed = sq_newhashseed();
+#ifdef SQ_INSTRUMENT
+    _rehashes = 0;
+#endif
 }
 
 #define newsysstring(s) {   \
@@ -95,6 +106,17 @@ void SQSharedState::Init()
     _scratchpadsize=0;
 #ifndef NO_GARBAGE_COLLECTOR
     _gc_chain=NULL;
+    _gc_gray=NULL;
+    _gc_grayagain=NULL;
+    _gc_black=NULL;
+    _gcphase=SQ_GC_IDLE;
+    _gcslice=SQ_GC_SLICE;
+    _gcratio=SQ_GC_RATIO;
+    _gclowheap=SQ_GC_LOWHEAP;
+    memset(&_gcstats,0,sizeof(SQGCStats));
+    _gcstats.threshold=sq_getmeminuse()+SQ_GC_MINSTEP;
+    _gccycleus=0;
+    _gcnatives=0;
 #endif
     _stringtable = (SQStringTable*)SQ_MALLOC(sizeof(SQStringTable));
     new (_stringtable) SQStringTable(this);
@@ -157,6 +179,11 @@ void SQSharedState::Init()
 SQSharedState::~SQSharedState()
 {
     if(_releasehook) { _releasehook(_foreignptr,0); _releasehook = NULL; }
+#ifndef NO_GARBAGE_COLLECTOR
+    //Drop any cycle in progress, everything has to be in the white chain to get finalized below
+    _gcphase = SQ_GC_IDLE;
+    UnmarkAll(-1);
+#endif
     _constructoridx.Null();
     _table(_registry)->Finalize();
     _table(_consts)->Finalize();
@@ -181,6 +208,7 @@ SQSharedState::~SQSharedState()
     _instance_default_delegate.Null();
     _weakref_default_delegate.Null();
     _refs_table.Finalize();
+    _handles.Finalize();
 #ifndef NO_GARBAGE_COLLECTOR
     SQCollectable *t = _gc_chain;
     SQCollectable *nx = NULL;
@@ -223,61 +251,260 @@ SQInteger SQSharedState::GetMetaMethodIdxByName(const SQObjectPtr &name)
 
 #ifndef NO_GARBAGE_COLLECTOR
 
-void SQSharedState::MarkObject(SQObjectPtr &o,SQCollectable **chain)
+//Unmarking only clears flags, so a slice unmarks this many objects for each one it would traverse.
+//Everything made during a cycle is marked and has to be unmarked before the next cycle can start.
+#define SQ_GC_UNMARKSTEP 16
+
+//Marking only ever grays an object, its children get marked when the collector gets to it.
+//That keeps marking iterative, and lets it be spread across many slices.
+void SQSharedState::MarkObject(SQObjectPtr &o,SQCollectable **SQ_UNUSED_ARG(chain))
 {
     switch(sq_type(o)){
-    case OT_TABLE:_table(o)->Mark(chain);break;
-    case OT_ARRAY:_array(o)->Mark(chain);break;
-    case OT_USERDATA:_userdata(o)->Mark(chain);break;
-    case OT_CLOSURE:_closure(o)->Mark(chain);break;
-    case OT_NATIVECLOSURE:_nativeclosure(o)->Mark(chain);break;
-    case OT_GENERATOR:_generator(o)->Mark(chain);break;
-    case OT_THREAD:_thread(o)->Mark(chain);break;
-    case OT_CLASS:_class(o)->Mark(chain);break;
-    case OT_INSTANCE:_instance(o)->Mark(chain);break;
-    case OT_OUTER:_outer(o)->Mark(chain);break;
-    case OT_FUNCPROTO:_funcproto(o)->Mark(chain);break;
+    case OT_TABLE:
+    case OT_ARRAY:
+    case OT_USERDATA:
+    case OT_CLOSURE:
+    case OT_NATIVECLOSURE:
+    case OT_GENERATOR:
+    case OT_THREAD:
+    case OT_CLASS:
+    case OT_INSTANCE:
+    case OT_OUTER:
+    case OT_FUNCPROTO:
+        MarkCollectable(static_cast<SQCollectable *>(o._unVal.pRefCounted));
+        break;
     default: break; //shutup compiler
     }
 }
 
-void SQSharedState::RunMark(SQVM* SQ_UNUSED_ARG(vm),SQCollectable **tchain)
+void SQSharedState::MarkCollectable(SQCollectable *c)
 {
-    SQVM *vms = _thread(_root_vm);
+    if(c->_uiRef & (MARK_FLAG|GRAY_FLAG)) return;
+    SQSharedState *ss = c->_sharedstate;
+    SQCollectable::RemoveFromChain(&ss->_gc_chain,c);
+    c->_uiRef |= GRAY_FLAG;
+    SQCollectable::AddToChain(&ss->_gc_gray,c);
+}
 
-    vms->Mark(tchain);
+//Something was stored into c. If c was already traversed it has to be traversed again,
+//rather than chase the new value now the container waits for the atomic step.
+void SQSharedState::Barrier(SQCollectable *c)
+{
+    if((c->_uiRef & (MARK_FLAG|GRAY_FLAG|AGAIN_FLAG)) != MARK_FLAG) return;
+    SQCollectable::RemoveFromChain(&_gc_black,c);
+    c->_uiRef |= AGAIN_FLAG;
+    SQCollectable::AddToChain(&_gc_grayagain,c);
+}
 
-    _refs_table.Mark(tchain);
-    MarkObject(_registry,tchain);
-    MarkObject(_consts,tchain);
-    MarkObject(_metamethodsmap,tchain);
-    MarkObject(_table_default_delegate,tchain);
-    MarkObject(_array_default_delegate,tchain);
-    MarkObject(_string_default_delegate,tchain);
-    MarkObject(_number_default_delegate,tchain);
-    MarkObject(_generator_default_delegate,tchain);
-    MarkObject(_thread_default_delegate,tchain);
-    MarkObject(_closure_default_delegate,tchain);
-    MarkObject(_class_default_delegate,tchain);
-    MarkObject(_instance_default_delegate,tchain);
-    MarkObject(_weakref_default_delegate,tchain);
+void SQSharedState::MarkRoots()
+{
+    MarkObject(_root_vm,NULL);
+    _refs_table.Mark(NULL);
+    _handles.Mark(NULL);
+    MarkObject(_registry,NULL);
+    MarkObject(_consts,NULL);
+    MarkObject(_metamethodsmap,NULL);
+    MarkObject(_table_default_delegate,NULL);
+    MarkObject(_array_default_delegate,NULL);
+    MarkObject(_string_default_delegate,NULL);
+    MarkObject(_number_default_delegate,NULL);
+    MarkObject(_generator_default_delegate,NULL);
+    MarkObject(_thread_default_delegate,NULL);
+    MarkObject(_closure_default_delegate,NULL);
+    MarkObject(_class_default_delegate,NULL);
+    MarkObject(_instance_default_delegate,NULL);
+    MarkObject(_weakref_default_delegate,NULL);
+}
 
+//Traverse a gray object, graying its children. The object's Mark moves it to the black chain,
+//or to grayagain if again is set and it's a kind of object that changes without a barrier:
+//thread stacks, generators and outers.
+void SQSharedState::Blacken(SQCollectable *c,bool again)
+{
+    SQCollectable::RemoveFromChain(&_gc_gray,c);
+    c->_uiRef &= ~GRAY_FLAG;
+    SQCollectable::AddToChain(&_gc_chain,c);
+    SQObjectType t = c->GetType();
+    if(again && (t == OT_THREAD || t == OT_GENERATOR || t == OT_OUTER)) {
+        c->Mark(&_gc_grayagain);
+        c->_uiRef |= AGAIN_FLAG;
+    }
+    else {
+        c->Mark(&_gc_black);
+    }
 }
 
-SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
+//Returns what's left of the budget, a negative budget means no limit
+SQInteger SQSharedState::Propagate(SQInteger budget)
 {
-    SQInteger n=0;
-    SQCollectable *tchain=NULL;
+    while(_gc_gray && budget != 0) {
+        Blacken(_gc_gray,true);
+        if(budget > 0) budget--;
+    }
+    return budget;
+}
 
-    RunMark(vm,&tchain);
+//Natives can hold objects in C locals while they call back into a VM, and those aren't roots.
+//So nothing is swept until the only native running, if any, is the one asking for the sweep.
+bool SQSharedState::CanSweep(SQVM *vm)
+{
+    SQInteger callers = (vm->ci && sq_type(vm->ci->_closure) == OT_NATIVECLOSURE) ? 1 : 0;
+    return _gcnatives <= callers;
+}
 
-    SQCollectable *resurrected = _gc_chain;
-    SQCollectable *t = resurrected;
+//The atomic step. The roots and everything that may have changed since it was traversed
+//get marked again, and marking runs to completion. Anything still white is garbage.
+void SQSharedState::FinishMark()
+{
+    MarkRoots();
+    while(_gc_grayagain) {
+        SQCollectable *c = _gc_grayagain;
+        SQCollectable::RemoveFromChain(&_gc_grayagain,c);
+        c->_uiRef &= ~(MARK_FLAG|AGAIN_FLAG);
+        c->_uiRef |= GRAY_FLAG;
+        SQCollectable::AddToChain(&_gc_gray,c);
+    }
+    while(_gc_gray) Blacken(_gc_gray,false);
+}
 
-    _gc_chain = tchain;
+//Finalizes everything left white, which breaks the cycles so the refcounts can free them.
+//Anything created or kept alive from C while doing so just stays in the white chain.
+SQInteger SQSharedState::Sweep()
+{
+    SQInteger n = 0;
+    SQCollectable *t = _gc_chain;
+    SQCollectable *nx = NULL;
+    if(t) {
+        t->_uiRef++;
+        while(t) {
+            t->Finalize();
+            nx = t->_next;
+            if(nx) nx->_uiRef++;
+            if((--t->_uiRef & SQ_REFCOUNT_MASK) == 0)
+                t->Release();
+            t = nx;
+            n++;
+        }
+    }
+    return n;
+}
+
+//Turns marked objects white again, a few at a time. Returns what's left of the budget.
+SQInteger SQSharedState::UnmarkAll(SQInteger budget)
+{
+    SQCollectable **chains[3] = { &_gc_gray, &_gc_grayagain, &_gc_black };
+    for(SQInteger i = 0; i < 3; i++) {
+        while(*chains[i] && budget != 0) {
+            SQCollectable *c = *chains[i];
+            SQCollectable::RemoveFromChain(chains[i],c);
+            c->UnMark();
+            SQCollectable::AddToChain(&_gc_chain,c);
+            if(budget > 0) budget--;
+        }
+    }
+    return budget;
+}
+
+//The platform can say how much system heap is left so the collector runs sooner when it's low.
+//Negative means unknown.
+SQInteger __attribute__((weak)) sq_getfreeheap()
+{
+    return -1;
+}
+
+//The platform's microsecond clock, for the pause times in the statistics. They're all 0 without one.
+SQUnsignedInteger __attribute__((weak)) sq_getmicros()
+{
+    return 0;
+}
+
+//Decide when the next cycle starts, based on what's in use right after a sweep
+void SQSharedState::SetThreshold()
+{
+    SQUnsignedInteger live = sq_getmeminuse();
+    SQUnsignedInteger grow = _gcratio > 100 ? (live / 100) * (_gcratio - 100) : 0;
+    if(grow < SQ_GC_MINSTEP) grow = SQ_GC_MINSTEP;
+    SQInteger freeheap = sq_getfreeheap();
+    if(freeheap >= 0) {
+        //Tighten as the heap runs out, and never let it grow into more than half of what's left.
+        //Multiply first, grow is often smaller than _gclowheap and dividing first made it 0.
+        if(freeheap < _gclowheap) {
+            grow = (SQUnsignedInteger)(((unsigned long long)grow * freeheap) / _gclowheap);
+            if(grow < SQ_GC_MINSTEP / 8) grow = SQ_GC_MINSTEP / 8;
+        }
+        if(grow > (SQUnsignedInteger)(freeheap / 2)) grow = freeheap / 2;
+    }
+    _gcstats.threshold = live + grow;
+}
+
+//Does up to budget objects worth of work on the current cycle, starting one if the collector
+//is idle. Returns true when this finished a cycle.
+bool SQSharedState::GCStep(SQVM *vm,SQInteger budget)
+{
+    SQUnsignedInteger start = sq_getmicros();
+    bool done = RunStep(vm,budget);
+    SQUnsignedInteger t = sq_getmicros() - start;
+    _gcstats.slices++;
+    _gcstats.totalus += t;
+    if(t > _gcstats.maxpauseus) _gcstats.maxpauseus = t;
+    _gccycleus += t;
+    if(done) {
+        _gcstats.cycles++;
+        _gcstats.lastcycleus = _gccycleus;
+        _gccycleus = 0;
+    }
+    return done;
+}
+
+bool SQSharedState::RunStep(SQVM *vm,SQInteger budget)
+{
+    switch(_gcphase) {
+    case SQ_GC_IDLE:
+        MarkRoots();
+        _gcphase = SQ_GC_PROPAGATE;
+        //fallthrough
+    case SQ_GC_PROPAGATE:
+        budget = Propagate(budget);
+        if(_gc_gray || !CanSweep(vm)) return false;
+        FinishMark();
+        _gcphase = SQ_GC_UNMARK;
+        _gcstats.freed += Sweep();
+        SetThreshold();
+        SQ_COUNT(vm,gccycles);
+        //fallthrough
+    case SQ_GC_UNMARK:
+        UnmarkAll(budget < 0 ? budget : budget * SQ_GC_UNMARKSTEP);
+        if(_gc_black) return false;
+        _gcphase = SQ_GC_IDLE;
+        return true;
+    }
+    return false;
+}
+
+SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
+{
+    SQInteger n=0;
+
+    //Finish any cycle in progress, or drop it if it can't sweep yet, then mark everything in one go
+    if(_gcphase != SQ_GC_IDLE) {
+        if(CanSweep(vm)) {
+            while(!GCStep(vm,-1));
+        }
+        else {
+            _gcphase = SQ_GC_IDLE;
+            UnmarkAll(-1);
+        }
+    }
+    MarkRoots();
+    _gcphase = SQ_GC_PROPAGATE;
+    FinishMark();
 
     SQArray *ret = NULL;
-    if(resurrected) {
+    SQCollectable *t = _gc_chain;
+    if(t) {
+        //The array goes in grayagain while marking, it's not one of the unreachable objects
+        SQCollectable *resurrected = _gc_chain;
+        _gc_chain = NULL;
         ret = SQArray::Create(this,0);
         SQCollectable *rlast = NULL;
         while(t) {
@@ -292,21 +519,14 @@ SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
             t = t->_next;
             n++;
         }
-
-        assert(rlast->_next == NULL);
+        //Put them back in front of the array
         rlast->_next = _gc_chain;
-        if(_gc_chain)
-        {
-            _gc_chain->_prev = rlast;
-        }
+        if(_gc_chain) _gc_chain->_prev = rlast;
         _gc_chain = resurrected;
     }
 
-    t = _gc_chain;
-    while(t) {
-        t->UnMark();
-        t = t->_next;
-    }
+    _gcphase = SQ_GC_IDLE;
+    UnmarkAll(-1);
 
     if(ret) {
         SQObjectPtr temp = ret;
@@ -318,35 +538,34 @@ SQInteger SQSharedState::ResurrectUnreachable(SQVM *vm)
     return n;
 }
 
+//Collects everything in one go. A cycle that was in progress is finished first,
+//and since it can miss garbage made while it ran, a full one runs after it.
+//Called from inside a native callback it can't sweep, so it only marks and the sweep
+//happens at a later yield.
 SQInteger SQSharedState::CollectGarbage(SQVM *vm)
 {
-    SQInteger n = 0;
-    SQCollectable *tchain = NULL;
-
-    RunMark(vm,&tchain);
-
-    SQCollectable *t = _gc_chain;
-    SQCollectable *nx = NULL;
-    if(t) {
-        t->_uiRef++;
-        while(t) {
-            t->Finalize();
-            nx = t->_next;
-            if(nx) nx->_uiRef++;
-            if(--t->_uiRef == 0)
-                t->Release();
-            t = nx;
-            n++;
-        }
+    if(!CanSweep(vm)) {
+        GCStep(vm,-1);
+        return 0;
     }
-
-    t = tchain;
-    while(t) {
-        t->UnMark();
-        t = t->_next;
+    if(_gcphase != SQ_GC_IDLE) {
+        while(!GCStep(vm,-1));
     }
-    _gc_chain = tchain;
-
+    SQ_COUNT(vm,gccycles);
+    SQUnsignedInteger start = sq_getmicros();
+    MarkRoots();
+    _gcphase = SQ_GC_PROPAGATE;
+    FinishMark();
+    _gcphase = SQ_GC_UNMARK;
+    SQInteger n = Sweep();
+    SetThreshold();
+    UnmarkAll(-1);
+    _gcphase = SQ_GC_IDLE;
+    SQUnsignedInteger t = sq_getmicros() - start;
+    _gcstats.fullcollections++;
+    _gcstats.freed += n;
+    _gcstats.totalus += t;
+    if(t > _gcstats.maxpauseus) _gcstats.maxpauseus = t;
     return n;
 }
 #endif
@@ -389,6 +608,60 @@ SQChar* SQSharedState::GetScratchPad(SQInteger size)
     return _scratchpad;
 }
 
+HandleTable::HandleTable()
+{
+    _freelist = -1;
+}
+
+SQInteger HandleTable::Add(const SQObject &obj)
+{
+    SQInteger h = _freelist;
+    if(h >= 0) {
+        _freelist = _nodes[h]._nextfree;
+    }
+    else {
+        h = _nodes.size();
+        _nodes.push_back();
+    }
+    HandleNode &n = _nodes[h];
+    n.obj = obj;
+    n._nextfree = SQ_HANDLE_INUSE;
+    return h;
+}
+
+//NULL if h isn't a handle that's in use
+SQObjectPtr *HandleTable::Get(SQInteger h)
+{
+    if(h < 0 || h >= (SQInteger)_nodes.size() || _nodes[h]._nextfree != SQ_HANDLE_INUSE) return NULL;
+    return &_nodes[h].obj;
+}
+
+SQBool HandleTable::Release(SQInteger h)
+{
+    if(!Get(h)) return SQFalse;
+    HandleNode &n = _nodes[h];
+    n.obj.Null();
+    n._nextfree = _freelist;
+    _freelist = h;
+    return SQTrue;
+}
+
+#ifndef NO_GARBAGE_COLLECTOR
+void HandleTable::Mark(SQCollectable **chain)
+{
+    SQInteger size = _nodes.size();
+    for(SQInteger i = 0; i < size; i++) {
+        if(_nodes[i]._nextfree == SQ_HANDLE_INUSE) SQSharedState::MarkObject(_nodes[i].obj,chain);
+    }
+}
+#endif
+
+void HandleTable::Finalize()
+{
+    SQInteger size = _nodes.size();
+    for(SQInteger i = 0; i < size; i++) _nodes[i].obj.Null();
+}
+
 RefTable::RefTable()
 {
     AllocNodes(4);
@@ -562,6 +835,7 @@ SQStringTable::SQStringTable(SQSharedState *ss)
     _sharedstate = ss;
     AllocNodes(4);
     _slotused = 0;
+    _transient = 0;
 }
 
 SQStringTable::~SQStringTable()
@@ -581,7 +855,7 @@ SQString *SQStringTable::Add(const SQChar *news,SQInteger len)
 {
     if(len<0)
         len = (SQInteger)scstrlen(news);
-    SQHash newhash = ::_hashstr(news,len);
+    SQHash newhash = ::_hashstr(news,len,_sharedstate->_hashseed);
     SQHash h = newhash&(_numofslots-1);
     SQString *s;
     for (s = _strings[h]; s; s = s->_next){
@@ -604,6 +878,37 @@ SQString *SQStringTable::Add(const SQChar *news,SQInteger len)
     return t;
 }
 
+//Makes a string that isn't in the table, the caller fills in its len chars.
+SQString *SQStringTable::NewTransient(SQInteger len)
+{
+    SQString *t = (SQString *)SQ_MALLOC(sq_rsl(len)+sizeof(SQString));
+    new (t) SQString;
+    t->_sharedstate = _sharedstate;
+    t->_val[len] = _SC('\0');
+    t->_len = len;
+    t->_hash = 0;
+    t->_next = t;
+    _transient++;
+    return t;
+}
+
+SQString *SQStringTable::Intern(SQString *t)
+{
+    SQHash h = t->Hash()&(_numofslots-1);
+    for (SQString *s = _strings[h]; s; s = s->_next){
+        if(s->_len == t->_len && (!memcmp(t->_val,s->_val,sq_rsl(t->_len))))
+            return s;
+    }
+    //Nothing equal is interned yet, so this one becomes the interned copy
+    t->_next = _strings[h];
+    _strings[h] = t;
+    _transient--;
+    _slotused++;
+    if (_slotused > _numofslots)
+        Resize(_numofslots*2);
+    return t;
+}
+
 void SQStringTable::Resize(SQInteger size)
 {
     SQInteger oldsize=_numofslots;
@@ -622,10 +927,31 @@ void SQStringTable::Resize(SQInteger size)
     SQ_FREE(oldtable,oldsize*sizeof(SQString*));
 }
 
+void SQStringTable::GetStats(SQStringTableStats *st)
+{
+    memset(st,0,sizeof(SQStringTableStats));
+    st->strings = _slotused;
+    st->transient = _transient;
+    st->slots = _numofslots;
+    for (SQUnsignedInteger i=0; i<_numofslots; i++){
+        SQUnsignedInteger chain = 0;
+        for (SQString *s = _strings[i]; s; s = s->_next) chain++;
+        if(chain) st->usedslots++;
+        if(chain > st->longestchain) st->longestchain = chain;
+    }
+}
+
 void SQStringTable::Remove(SQString *bs)
 {
     SQString *s;
     SQString *prev=NULL;
+    if(bs->IsTransient()) {
+        _transient--;
+        SQInteger slen = bs->_len;
+        bs->~SQString();
+        SQ_FREE(bs,sizeof(SQString) + sq_rsl(slen));
+        return;
+    }
     SQHash h = bs->_hash&(_numofslots - 1);
 
     for (s = _strings[h]; s; ){
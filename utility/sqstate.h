@@ -5,6 +5,7 @@
 #include "squtils.h"
 #include "sqobject.h"
 struct SQString;
+#define SQ_HANDLE_INUSE -2
 struct SQTable;
 //max number of character for a printed number
 #define NUMBER_MAX_CHAR 50
@@ -14,13 +15,17 @@ struct SQStringTable
     SQStringTable(SQSharedState*ss);
     ~SQStringTable();
     SQString *Add(const SQChar *,SQInteger len);
+    SQString *NewTransient(SQInteger len);
+    SQString *Intern(SQString *);
     void Remove(SQString *);
+    void GetStats(SQStringTableStats *st);
 private:
     void Resize(SQInteger size);
     void AllocNodes(SQInteger size);
     SQString **_strings;
     SQUnsignedInteger _numofslots;
     SQUnsignedInteger _slotused;
+    SQUnsignedInteger _transient;
     SQSharedState *_sharedstate;
 };
 
@@ -51,11 +56,39 @@ private:
     RefNode **_buckets;
 };
 
+//Pins objects for native code in slots addressed by index, so unlike RefTable there's no
+//hashing or chain walking. Free slots are linked through _nextfree.
+struct HandleTable {
+    struct HandleNode {
+        HandleNode() { _nextfree = SQ_HANDLE_INUSE; }
+        SQObjectPtr obj;
+        SQInteger _nextfree;
+    };
+    HandleTable();
+    SQInteger Add(const SQObject &obj);
+    SQObjectPtr *Get(SQInteger h);
+    SQBool Release(SQInteger h);
+#ifndef NO_GARBAGE_COLLECTOR
+    void Mark(SQCollectable **chain);
+#endif
+    void Finalize();
+private:
+    sqvector<HandleNode> _nodes;
+    SQInteger _freelist;
+};
+
 #define ADD_STRING(ss,str,len) ss->_stringtable->Add(str,len)
 #define REMOVE_STRING(ss,bstr) ss->_stringtable->Remove(bstr)
 
 struct SQObjectPtr;
 
+#ifndef NO_GARBAGE_COLLECTOR
+//Where the incremental collector is in its cycle
+#define SQ_GC_IDLE 0
+#define SQ_GC_PROPAGATE 1
+#define SQ_GC_UNMARK 2
+#endif
+
 struct SQSharedState
 {
     SQSharedState();
@@ -66,9 +99,47 @@ public:
     SQInteger GetMetaMethodIdxByName(const SQObjectPtr &name);
 #ifndef NO_GARBAGE_COLLECTOR
     SQInteger CollectGarbage(SQVM *vm);
-    void RunMark(SQVM *vm,SQCollectable **tchain);
+    bool GCStep(SQVM *vm,SQInteger budget);
+    //Called at every yield, doing a slice if a cycle is running or due
+    void GCYield(SQVM *vm) {
+        if(_gcphase == SQ_GC_IDLE) {
+            if(!_gcratio || sq_getmeminuse() <= _gcstats.threshold) return;
+        }
+        //Marking is done and the sweep is waiting for the natives to return
+        else if(_gcphase == SQ_GC_PROPAGATE && !_gc_gray && _gcnatives) return;
+        GCStep(vm,_gcslice);
+    }
     SQInteger ResurrectUnreachable(SQVM *vm);
     static void MarkObject(SQObjectPtr &o,SQCollectable **chain);
+    static void MarkCollectable(SQCollectable *c);
+    void Barrier(SQCollectable *c);
+    //Objects made while marking can't start out white, the only reference may be in a native's
+    //C locals. They wait in grayagain and get traversed with the rest in the atomic step.
+    void AddNew(SQCollectable **white,SQCollectable *c) {
+        if(_gcphase != SQ_GC_PROPAGATE) {
+            SQCollectable::AddToChain(white,c);
+            return;
+        }
+        c->_uiRef |= MARK_FLAG|AGAIN_FLAG;
+        SQCollectable::AddToChain(&_gc_grayagain,c);
+    }
+    SQCollectable **ChainOf(SQCollectable **white,SQCollectable *c) {
+        if(c->_uiRef & GRAY_FLAG) return &_gc_gray;
+        if(c->_uiRef & AGAIN_FLAG) return &_gc_grayagain;
+        if(c->_uiRef & MARK_FLAG) return &_gc_black;
+        return white;
+    }
+private:
+    bool RunStep(SQVM *vm,SQInteger budget);
+    void SetThreshold();
+    void MarkRoots();
+    SQInteger Propagate(SQInteger budget);
+    void Blacken(SQCollectable *c,bool again);
+    bool CanSweep(SQVM *vm);
+    void FinishMark();
+    SQInteger Sweep();
+    SQInteger UnmarkAll(SQInteger budget);
+public:
 #endif
     SQObjectPtrVec *_metamethods;
     SQObjectPtr _metamethodsmap;
@@ -76,11 +147,24 @@ public:
     SQObjectPtrVec *_types;
     SQStringTable *_stringtable;
     RefTable _refs_table;
+    HandleTable _handles;
     SQObjectPtr _registry;
     SQObjectPtr _consts;
     SQObjectPtr _constructoridx;
 #ifndef NO_GARBAGE_COLLECTOR
     SQCollectable *_gc_chain;
+    SQCollectable *_gc_gray;
+    SQCollectable *_gc_grayagain;
+    SQCollectable *_gc_black;
+    SQInteger _gcphase;
+    //How many objects each slice traverses
+    SQInteger _gcslice;
+    SQInteger _gcratio;
+    SQInteger _gclowheap;
+    SQGCStats _gcstats;
+    SQUnsignedInteger _gccycleus;
+    //Native calls in progress on any VM of this state, see CanSweep()
+    SQInteger _gcnatives;
 #endif
     SQObjectPtr _root_vm;
     SQObjectPtr _table_default_delegate;
@@ -111,6 +195,11 @@ public:
     bool _notifyallexceptions;
     SQUserPointer _foreignptr;
     SQRELEASEHOOK _releasehook;
+    //Seeds every string hash, so it has to be set before the first string is made
+    SQHash _hashseed;
+#ifdef SQ_INSTRUMENT
+    SQUnsignedInteger _rehashes;
+#endif
 private:
     SQChar *_scratchpad;
     SQInteger _scratchpadsize;
@@ -7,7 +7,17 @@
 #include "sqstdstream.h"
 #include "sqstdblobimpl.h"
 
-#define SQSTD_BLOB_TYPE_TAG ((SQUnsignedInteger)(SQSTD_STREAM_TYPE_TAG | 0x00000002))
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SQ_BLOB_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SQ_BLOB_NEON
+#endif
+
+#ifdef ESP32
+#include "rom/crc.h"
+#endif
 
 //Blob
 
@@ -43,28 +53,332 @@ static void __swap_word(unsigned short *n)
     *n=(unsigned short)((*n>>8)&0x00FF)| ((*n<<8)&0xFF00);
 }
 
-static SQInteger _blob_swap4(HSQUIRRELVM v)
+//Bulk operations. Most take an optional [start],[len] range, len defaulting to the rest of the
+//blob. Copying, filling, comparing and searching for a byte go through the C library, which
+//already uses SIMD on hosts and whole words on the ESP. xor and popcount do their own
+//vectors(SSE2/NEON) or words, after stepping byte by byte up to an aligned address, since the
+//ESP32 can't load unaligned words.
+
+#if defined(SQ_BLOB_SSE2) || defined(SQ_BLOB_NEON)
+#define SQ_BLOB_VEC 16
+#else
+#define SQ_BLOB_VEC ((SQInteger)sizeof(size_t))
+#endif
+
+//Reads the range at idx and idx+1, throws if it doesn't fit in size
+static SQRESULT _blob_getrange(HSQUIRRELVM v,SQInteger idx,SQInteger size,SQInteger &start,SQInteger &len)
+{
+    start = 0;
+    if(sq_gettop(v) >= idx) sq_getinteger(v,idx,&start);
+    if(start < 0 || start > size)
+        return sq_throwerror(v,_SC("start out of range"));
+    len = size - start;
+    if(sq_gettop(v) > idx) sq_getinteger(v,idx+1,&len);
+    if(len < 0 || len > size - start)
+        return sq_throwerror(v,_SC("length out of range"));
+    return SQ_OK;
+}
+
+//Strings and blobs are both just bytes to search for or xor with
+static SQRESULT _blob_getbytes(HSQUIRRELVM v,SQInteger idx,const unsigned char *&p,SQInteger &len)
+{
+    SQUserPointer bp;
+    const SQChar *s;
+    if(SQ_SUCCEEDED(sq_getstring(v,idx,&s))) {
+        p = (const unsigned char *)s;
+        len = sq_getsize(v,idx);
+        return SQ_OK;
+    }
+    if(SQ_SUCCEEDED(sqstd_getblob(v,idx,&bp))) {
+        p = (const unsigned char *)bp;
+        len = sqstd_getblobsize(v,idx);
+        return SQ_OK;
+    }
+    return sq_throwerror(v,_SC("expected a string or a blob"));
+}
+
+static void __swap_range(unsigned char *p,SQInteger n,SQInteger width)
+{
+    for(; n >= width; n -= width, p += width) {
+        for(SQInteger i = 0; i < (width >> 1); i++) {
+            unsigned char t = p[i];
+            p[i] = p[width - 1 - i];
+            p[width - 1 - i] = t;
+        }
+    }
+}
+
+static SQInteger _blob_swap(HSQUIRRELVM v,SQInteger width)
 {
     SETUP_BLOB(v);
-    SQInteger num=(self->Len()-(self->Len()%4))>>2;
-    unsigned int *t=(unsigned int *)self->GetBuf();
-    for(SQInteger i = 0; i < num; i++) {
-        __swap_dword(&t[i]);
+    SQInteger start,len;
+    if(SQ_FAILED(_blob_getrange(v,2,self->Len(),start,len))) return SQ_ERROR;
+    unsigned char *p = ((unsigned char *)self->GetBuf()) + start;
+    //Whole words when they're aligned, which they are unless a range says otherwise
+    if(width == 4 && !((size_t)p & 3)) {
+        unsigned int *t = (unsigned int *)p;
+        for(SQInteger i = 0; i < (len >> 2); i++) __swap_dword(&t[i]);
+    }
+    else if(width == 2 && !((size_t)p & 1)) {
+        unsigned short *t = (unsigned short *)p;
+        for(SQInteger i = 0; i < (len >> 1); i++) __swap_word(&t[i]);
     }
+    else __swap_range(p,len,width);
+    return 0;
+}
+
+static SQInteger _blob_swap2(HSQUIRRELVM v) { return _blob_swap(v,2); }
+static SQInteger _blob_swap4(HSQUIRRELVM v) { return _blob_swap(v,4); }
+static SQInteger _blob_swap8(HSQUIRRELVM v) { return _blob_swap(v,8); }
+
+//fill(byte,[start],[len])
+static SQInteger _blob_fill(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    SQInteger val,start,len;
+    sq_getinteger(v,2,&val);
+    if(SQ_FAILED(_blob_getrange(v,3,self->Len(),start,len))) return SQ_ERROR;
+    memset(((unsigned char *)self->GetBuf()) + start,(unsigned char)val,len);
+    return 0;
+}
+
+//copyfrom(src,[dststart],[srcstart],[len]), src can be this blob, the ranges may overlap
+static SQInteger _blob_copyfrom(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    const unsigned char *src;
+    SQInteger srcsize,dst = 0,start,len;
+    if(SQ_FAILED(_blob_getbytes(v,2,src,srcsize))) return SQ_ERROR;
+    if(sq_gettop(v) >= 3) sq_getinteger(v,3,&dst);
+    if(dst < 0 || dst > self->Len())
+        return sq_throwerror(v,_SC("destination out of range"));
+    if(SQ_FAILED(_blob_getrange(v,4,srcsize,start,len))) return SQ_ERROR;
+    if(len > self->Len() - dst)
+        return sq_throwerror(v,_SC("the destination is too small"));
+    memmove(((unsigned char *)self->GetBuf()) + dst,src + start,len);
     return 0;
 }
 
-static SQInteger _blob_swap2(HSQUIRRELVM v)
+//compare(other,[start],[otherstart],[len]) returns <0, 0 or >0 like memcmp. Without len the
+//shorter of the two ranges is compared, and if those match the shorter range is the lesser.
+static SQInteger _blob_compare(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    const unsigned char *other;
+    SQInteger othersize,start = 0,ostart = 0,len;
+    if(SQ_FAILED(_blob_getbytes(v,2,other,othersize))) return SQ_ERROR;
+    if(sq_gettop(v) >= 3) sq_getinteger(v,3,&start);
+    if(sq_gettop(v) >= 4) sq_getinteger(v,4,&ostart);
+    if(start < 0 || start > self->Len() || ostart < 0 || ostart > othersize)
+        return sq_throwerror(v,_SC("start out of range"));
+    SQInteger mylen = self->Len() - start, otherlen = othersize - ostart;
+    if(sq_gettop(v) >= 5) {
+        sq_getinteger(v,5,&len);
+        if(len < 0 || len > mylen || len > otherlen)
+            return sq_throwerror(v,_SC("length out of range"));
+        mylen = otherlen = len;
+    }
+    SQInteger n = mylen < otherlen ? mylen : otherlen;
+    int r = memcmp(((unsigned char *)self->GetBuf()) + start,other + ostart,n);
+    if(r == 0) r = mylen < otherlen ? -1 : (mylen > otherlen ? 1 : 0);
+    sq_pushinteger(v,r < 0 ? -1 : (r > 0 ? 1 : 0));
+    return 1;
+}
+
+//find(needle,[start]) where needle is a byte, string or blob. Returns the index or null.
+static SQInteger _blob_find(HSQUIRRELVM v)
 {
     SETUP_BLOB(v);
-    SQInteger num=(self->Len()-(self->Len()%2))>>1;
-    unsigned short *t = (unsigned short *)self->GetBuf();
-    for(SQInteger i = 0; i < num; i++) {
-        __swap_word(&t[i]);
+    const unsigned char *needle;
+    unsigned char byte;
+    SQInteger nlen,start = 0;
+    if(sq_gettype(v,2) & SQOBJECT_NUMERIC) {
+        SQInteger b;
+        sq_getinteger(v,2,&b);
+        byte = (unsigned char)b;
+        needle = &byte;
+        nlen = 1;
+    }
+    else if(SQ_FAILED(_blob_getbytes(v,2,needle,nlen))) return SQ_ERROR;
+    if(sq_gettop(v) >= 3) sq_getinteger(v,3,&start);
+    if(start < 0 || start > self->Len())
+        return sq_throwerror(v,_SC("start out of range"));
+    const unsigned char *buf = (const unsigned char *)self->GetBuf();
+    const unsigned char *p = buf + start, *end = buf + self->Len();
+    if(nlen == 0) {
+        sq_pushinteger(v,start);
+        return 1;
     }
+    //memchr finds candidates for the first byte a vector or word at a time
+    while(end - p >= nlen) {
+        p = (const unsigned char *)memchr(p,needle[0],(end - p) - nlen + 1);
+        if(!p) break;
+        if(memcmp(p + 1,needle + 1,nlen - 1) == 0) {
+            sq_pushinteger(v,p - buf);
+            return 1;
+        }
+        p++;
+    }
+    sq_pushnull(v);
+    return 1;
+}
+
+static void __xor_bytes(unsigned char *p,SQInteger len,const unsigned char *key,SQInteger keylen)
+{
+    SQInteger k = 0;
+    //Whole vectors only work when the key repeats evenly across them
+    if(SQ_BLOB_VEC % keylen == 0) {
+        while(len > 0 && ((size_t)p & (SQ_BLOB_VEC - 1))) {
+            *p++ ^= key[k];
+            if(++k == keylen) k = 0;
+            len--;
+        }
+        unsigned char pat[SQ_BLOB_VEC];
+        for(SQInteger i = 0; i < SQ_BLOB_VEC; i++) pat[i] = key[(k + i) % keylen];
+#if defined(SQ_BLOB_SSE2)
+        __m128i kv = _mm_loadu_si128((const __m128i *)pat);
+        for(; len >= 16; len -= 16, p += 16)
+            _mm_store_si128((__m128i *)p,_mm_xor_si128(_mm_load_si128((const __m128i *)p),kv));
+#elif defined(SQ_BLOB_NEON)
+        uint8x16_t kv = vld1q_u8(pat);
+        for(; len >= 16; len -= 16, p += 16)
+            vst1q_u8(p,veorq_u8(vld1q_u8(p),kv));
+#else
+        size_t kw;
+        memcpy(&kw,pat,sizeof(kw));
+        for(; len >= SQ_BLOB_VEC; len -= SQ_BLOB_VEC, p += SQ_BLOB_VEC)
+            *((size_t *)p) ^= kw;
+#endif
+    }
+    for(; len > 0; len--) {
+        *p++ ^= key[k];
+        if(++k == keylen) k = 0;
+    }
+}
+
+//xor(key,[start],[len]) where key is a byte, or a string or blob that gets repeated over the range
+static SQInteger _blob_xor(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    const unsigned char *key;
+    unsigned char byte;
+    SQInteger keylen,start,len;
+    if(sq_gettype(v,2) & SQOBJECT_NUMERIC) {
+        SQInteger b;
+        sq_getinteger(v,2,&b);
+        byte = (unsigned char)b;
+        key = &byte;
+        keylen = 1;
+    }
+    else if(SQ_FAILED(_blob_getbytes(v,2,key,keylen))) return SQ_ERROR;
+    if(keylen == 0)
+        return sq_throwerror(v,_SC("the key is empty"));
+    if(SQ_FAILED(_blob_getrange(v,3,self->Len(),start,len))) return SQ_ERROR;
+    unsigned char *p = ((unsigned char *)self->GetBuf()) + start;
+    //Xoring a blob with part of itself would change the key as it goes
+    if(key >= p - keylen && key < p + len) {
+        unsigned char *copy = (unsigned char *)sq_malloc(keylen);
+        memcpy(copy,key,keylen);
+        __xor_bytes(p,len,copy,keylen);
+        sq_free(copy,keylen);
+    }
+    else __xor_bytes(p,len,key,keylen);
     return 0;
 }
 
+#if defined(SQ_BLOB_NEON)
+//Adds up 16 byte counts, widening as it goes. 32 bit ARM has no add across a whole vector.
+static inline unsigned int __sum_bytes16(uint8x16_t c)
+{
+#if defined(__aarch64__)
+    return vaddlvq_u8(c);
+#else
+    uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(c)));
+    return (unsigned int)(vgetq_lane_u64(s,0) + vgetq_lane_u64(s,1));
+#endif
+}
+#endif
+
+//popcount([start],[len]), the number of bits set
+static SQInteger _blob_popcount(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    SQInteger start,len;
+    if(SQ_FAILED(_blob_getrange(v,2,self->Len(),start,len))) return SQ_ERROR;
+    const unsigned char *p = ((const unsigned char *)self->GetBuf()) + start;
+    SQUnsignedInteger n = 0;
+    while(len > 0 && ((size_t)p & (sizeof(size_t) - 1))) {
+        n += __builtin_popcount(*p++);
+        len--;
+    }
+#if defined(SQ_BLOB_NEON)
+    for(; len >= 16; len -= 16, p += 16)
+        n += __sum_bytes16(vcntq_u8(vld1q_u8(p)));
+#endif
+    for(; len >= (SQInteger)sizeof(size_t); len -= sizeof(size_t), p += sizeof(size_t))
+        n += __builtin_popcountl(*((const size_t *)p));
+    for(; len > 0; len--) n += __builtin_popcount(*p++);
+    sq_pushinteger(v,(SQInteger)n);
+    return 1;
+}
+
+#ifndef ESP32
+//The usual reflected CRC-32(zlib, ethernet, PNG). The ESP32 has this table in ROM.
+static unsigned int _crc32_table[256];
+
+static unsigned int crc32_le(unsigned int crc,const unsigned char *p,SQInteger len)
+{
+    if(!_crc32_table[1]) {
+        for(unsigned int i = 0; i < 256; i++) {
+            unsigned int c = i;
+            for(int j = 0; j < 8; j++) c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            _crc32_table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while(len--) crc = _crc32_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+#endif
+
+//crc32([start],[len],[crc]), pass the previous result as crc to continue a running checksum.
+//Both checksums are the 32 bit value as an SQInteger, so with 32 bit integers the ones with the
+//top bit set are negative. Only the low 32 bits of a crc or adler passed in are used.
+static SQInteger _blob_crc32(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    SQInteger start,len,crc = 0;
+    if(SQ_FAILED(_blob_getrange(v,2,self->Len(),start,len))) return SQ_ERROR;
+    if(sq_gettop(v) >= 4) sq_getinteger(v,4,&crc);
+    crc = (SQInteger)crc32_le((unsigned int)crc,((const unsigned char *)self->GetBuf()) + start,len);
+    sq_pushinteger(v,crc);
+    return 1;
+}
+
+//adler32([start],[len],[adler]), same as zlib's
+static SQInteger _blob_adler32(HSQUIRRELVM v)
+{
+    SETUP_BLOB(v);
+    SQInteger start,len,adler = 1;
+    if(SQ_FAILED(_blob_getrange(v,2,self->Len(),start,len))) return SQ_ERROR;
+    if(sq_gettop(v) >= 4) sq_getinteger(v,4,&adler);
+    const unsigned char *p = ((const unsigned char *)self->GetBuf()) + start;
+    unsigned int a = (unsigned int)adler & 0xFFFF, b = ((unsigned int)adler >> 16) & 0xFFFF;
+    while(len > 0) {
+        //The most bytes that can be summed before b could overflow 32 bits
+        SQInteger n = len < 5552 ? len : 5552;
+        len -= n;
+        while(n--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    sq_pushinteger(v,(SQInteger)((b << 16) | a));
+    return 1;
+}
+
 static SQInteger _blob__set(HSQUIRRELVM v)
 {
     SETUP_BLOB(v);
@@ -120,9 +434,10 @@ static SQInteger _blob__typeof(HSQUIRRELVM v)
     return 1;
 }
 
-static SQInteger _blob_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+SQInteger _blob_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
 {
     SQBlob *self = (SQBlob*)p;
+    if(!self->Release()) return 1;
     self->~SQBlob();
     sq_free(self,sizeof(SQBlob));
     return 1;
@@ -171,8 +486,17 @@ static SQInteger _blob__cloned(HSQUIRRELVM v)
 static const SQRegFunction _blob_methods[] = {
     _DECL_BLOB_FUNC(constructor,-1,_SC("xn")),
     _DECL_BLOB_FUNC(resize,2,_SC("xn")),
-    _DECL_BLOB_FUNC(swap2,1,_SC("x")),
-    _DECL_BLOB_FUNC(swap4,1,_SC("x")),
+    _DECL_BLOB_FUNC(swap2,-1,_SC("xnn")),
+    _DECL_BLOB_FUNC(swap4,-1,_SC("xnn")),
+    _DECL_BLOB_FUNC(swap8,-1,_SC("xnn")),
+    _DECL_BLOB_FUNC(fill,-2,_SC("xnnn")),
+    _DECL_BLOB_FUNC(copyfrom,-2,_SC("x.nnn")),
+    _DECL_BLOB_FUNC(compare,-2,_SC("x.nnn")),
+    _DECL_BLOB_FUNC(find,-2,_SC("x.n")),
+    _DECL_BLOB_FUNC(xor,-2,_SC("x.nn")),
+    _DECL_BLOB_FUNC(popcount,-1,_SC("xnn")),
+    _DECL_BLOB_FUNC(crc32,-1,_SC("xnnn")),
+    _DECL_BLOB_FUNC(adler32,-1,_SC("xnnn")),
     _DECL_BLOB_FUNC(_set,3,_SC("xnn")),
     _DECL_BLOB_FUNC(_get,2,_SC("x.")),
     _DECL_BLOB_FUNC(_typeof,1,_SC("x")),
@@ -278,6 +602,10 @@ SQUserPointer sqstd_createblob(HSQUIRRELVM v, SQInteger size)
 
 SQRESULT sqstd_register_bloblib(HSQUIRRELVM v)
 {
-    return declare_stream(v,_SC("blob"),(SQUserPointer)SQSTD_BLOB_TYPE_TAG,_SC("std_blob"),_blob_methods,bloblib_funcs);
+    if(SQ_FAILED(declare_stream(v,_SC("blob"),(SQUserPointer)SQSTD_BLOB_TYPE_TAG,_SC("std_blob"),_blob_methods,bloblib_funcs)))
+        return SQ_ERROR;
+    sqstd_register_pack(v);
+    sqstd_register_msgpack(v);
+    return sqstd_register_typedarrays(v);
 }
 
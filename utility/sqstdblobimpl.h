@@ -2,6 +2,9 @@
 #ifndef _SQSTD_BLOBIMPL_H_
 #define _SQSTD_BLOBIMPL_H_
 
+#define SQSTD_BLOB_TYPE_TAG ((SQUnsignedInteger)(SQSTD_STREAM_TYPE_TAG | 0x00000002))
+#define SQSTD_TYPEDARRAY_TYPE_TAG ((SQUnsignedInteger)0x40000001)
+
 struct SQBlob : public SQStream
 {
     SQBlob(SQInteger size) {
@@ -11,6 +14,7 @@ struct SQBlob : public SQStream
         memset(_buf, 0, _size);
         _ptr = 0;
         _owns = true;
+        _refs = 1;
     }
     virtual ~SQBlob() {
         sq_free(_buf, _allocated);
@@ -65,6 +69,21 @@ struct SQBlob : public SQStream
         _size = _size + n;
         return ret;
     }
+    //Drops everything past n without reallocating, for when less was read into the buffer than expected
+    void Truncate(SQInteger n) {
+        if(n < _size) _size = n;
+        if(_ptr > _size) _ptr = _size;
+    }
+    SQInteger ReadUntil(void *buffer, SQInteger size, int delim) {
+        SQInteger n = _size - _ptr;
+        if(size < n) n = size;
+        if(n <= 0) return 0;
+        unsigned char *e = (unsigned char *)memchr(&_buf[_ptr], delim, n);
+        if(e) n = e - &_buf[_ptr] + 1;
+        memcpy(buffer, &_buf[_ptr], n);
+        _ptr += n;
+        return n;
+    }
     bool CanAdvance(SQInteger n) {
         if(_ptr+n>_size)return false;
         return true;
@@ -97,12 +116,21 @@ struct SQBlob : public SQStream
     SQInteger Tell() { return _ptr; }
     SQInteger Len() { return _size; }
     SQUserPointer GetBuf(){ return _buf; }
+    //Typed arrays share the storage, which lives until the blob and every view of it are released
+    void AddRef() { _refs++; }
+    bool Release() { return --_refs == 0; }
 private:
     SQInteger _size;
     SQInteger _allocated;
     SQInteger _ptr;
     unsigned char *_buf;
     bool _owns;
+    SQInteger _refs;
 };
 
+SQInteger _blob_releasehook(SQUserPointer p, SQInteger size);
+SQRESULT sqstd_register_typedarrays(HSQUIRRELVM v);
+SQRESULT sqstd_register_pack(HSQUIRRELVM v);
+SQRESULT sqstd_register_msgpack(HSQUIRRELVM v);
+
 #endif //_SQSTD_BLOBIMPL_H_
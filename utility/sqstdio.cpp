@@ -1,5 +1,6 @@
 /* see copyright notice in squirrel.h */
 #include <new>
+#include <string.h>
 #include <squirrel.h>
 #include <sqstdio.h>
 #include "sqstdstream.h"
@@ -7,6 +8,8 @@
 
 
 #define SQSTD_FILE_TYPE_TAG ((SQUnsignedInteger)(SQSTD_STREAM_TYPE_TAG | 0x00000001))
+//Default buffer for files opened by name, wrapped FILE handles like stdout are unbuffered
+#define SQSTD_FILE_BUFSIZE 256
 //basic API
 SQFILE sqstd_fopen(const SQChar *filename ,const SQChar *mode)
 {
@@ -61,10 +64,16 @@ SQInteger sqstd_feof(SQFILE file)
 }
 
 //File
+//Small reads and writes go through a buffer, so readn() and readline() don't cost a call into the
+//filesystem each. The one buffer holds either unread data or unwritten data, never both: writing
+//after a read seeks the file back to where the reader is, and reading after a write flushes it.
 struct SQFile : public SQStream {
-    SQFile() { _handle = NULL; _owns = false;}
-    SQFile(SQFILE file, bool owns) { _handle = file; _owns = owns;}
-    virtual ~SQFile() { Close(); }
+    SQFile() { _handle = NULL; _owns = false; Init(0); }
+    SQFile(SQFILE file, bool owns, SQInteger bufsize = 0) { _handle = file; _owns = owns; Init(bufsize); }
+    virtual ~SQFile() {
+        Close();
+        if(_buf) sq_free(_buf,_bufsize);
+    }
     bool Open(const SQChar *filename ,const SQChar *mode) {
         Close();
         if( (_handle = sqstd_fopen(filename,mode)) ) {
@@ -74,6 +83,10 @@ struct SQFile : public SQStream {
         return false;
     }
     void Close() {
+        if(_handle) {
+            FlushWrites();
+            DropReads();
+        }
         if(_handle && _owns) {
             sqstd_fclose(_handle);
             _handle = NULL;
@@ -81,33 +94,123 @@ struct SQFile : public SQStream {
         }
     }
     SQInteger Read(void *buffer,SQInteger size) {
-        return sqstd_fread(buffer,1,size,_handle);
+        SQInteger done = 0, n;
+        FlushWrites();
+        if(_rpos < _rlen) {
+            done = _rlen - _rpos < size ? _rlen - _rpos : size;
+            memcpy(buffer,_buf + _rpos,done);
+            _rpos += done;
+            if(done == size) return done;
+        }
+        //Big reads skip the buffer
+        if(size - done >= _bufsize) {
+            n = sqstd_fread((unsigned char *)buffer + done,1,size - done,_handle);
+            return n > 0 ? done + n : done;
+        }
+        if(!Fill()) return done;
+        n = _rlen < size - done ? _rlen : size - done;
+        memcpy((unsigned char *)buffer + done,_buf,n);
+        _rpos = n;
+        return done + n;
+    }
+    SQInteger ReadUntil(void *buffer,SQInteger size,int delim) {
+        if(!_bufsize) return SQStream::ReadUntil(buffer,size,delim);
+        unsigned char *out = (unsigned char *)buffer;
+        SQInteger done = 0;
+        FlushWrites();
+        while(done < size) {
+            if(_rpos == _rlen && !Fill()) break;
+            SQInteger n = _rlen - _rpos < size - done ? _rlen - _rpos : size - done;
+            unsigned char *p = _buf + _rpos;
+            unsigned char *e = (unsigned char *)memchr(p,delim,n);
+            if(e) n = e - p + 1;
+            memcpy(out + done,p,n);
+            _rpos += n;
+            done += n;
+            if(e) break;
+        }
+        return done;
     }
     SQInteger Write(void *buffer,SQInteger size) {
-        return sqstd_fwrite(buffer,1,size,_handle);
+        DropReads();
+        if(_wlen + size > _bufsize && !FlushWrites()) return 0;
+        if(size >= _bufsize) return sqstd_fwrite(buffer,1,size,_handle);
+        if(!_buf) _buf = (unsigned char *)sq_malloc(_bufsize);
+        memcpy(_buf + _wlen,buffer,size);
+        _wlen += size;
+        return size;
     }
     SQInteger Flush() {
+        if(!FlushWrites()) return -1;
         return sqstd_fflush(_handle);
     }
     SQInteger Tell() {
-        return sqstd_ftell(_handle);
+        return sqstd_ftell(_handle) - (_rlen - _rpos) + _wlen;
     }
+    //Goes around the buffer, so it doesn't have to be dropped
     SQInteger Len() {
-        SQInteger prevpos=Tell();
-        Seek(0,SQ_SEEK_END);
-        SQInteger size=Tell();
-        Seek(prevpos,SQ_SEEK_SET);
+        FlushWrites();
+        SQInteger prevpos=sqstd_ftell(_handle);
+        sqstd_fseek(_handle,0,SQ_SEEK_END);
+        SQInteger size=sqstd_ftell(_handle);
+        sqstd_fseek(_handle,prevpos,SQ_SEEK_SET);
         return size;
     }
     SQInteger Seek(SQInteger offset, SQInteger origin)  {
+        if(origin == SQ_SEEK_CUR) {
+            //Short hops within what's been read stay in the buffer
+            if(_rlen && offset >= -_rpos && offset <= _rlen - _rpos) {
+                _rpos += offset;
+                return 0;
+            }
+            offset -= _rlen - _rpos;
+        }
+        FlushWrites();
+        _rpos = _rlen = 0;
         return sqstd_fseek(_handle,offset,origin);
     }
     bool IsValid() { return _handle?true:false; }
-    bool EOS() { return Tell()==Len()?true:false;}
-    SQFILE GetHandle() {return _handle;}
+    bool EOS() { return _rpos < _rlen ? false : (Tell()==Len()?true:false);}
+    //Native code gets the handle positioned where the script left off
+    SQFILE GetHandle() {
+        if(_handle) {
+            FlushWrites();
+            DropReads();
+        }
+        return _handle;
+    }
 private:
+    void Init(SQInteger bufsize) {
+        _buf = NULL;
+        _bufsize = bufsize;
+        _rpos = _rlen = _wlen = 0;
+    }
+    bool Fill() {
+        if(!_buf) _buf = (unsigned char *)sq_malloc(_bufsize);
+        _rpos = 0;
+        _rlen = sqstd_fread(_buf,1,_bufsize,_handle);
+        if(_rlen < 0) _rlen = 0;
+        return _rlen > 0;
+    }
+    bool FlushWrites() {
+        if(!_wlen) return true;
+        SQInteger n = sqstd_fwrite(_buf,1,_wlen,_handle);
+        bool ok = n == _wlen;
+        _wlen = 0;
+        return ok;
+    }
+    //Puts the file position back where the reader is
+    void DropReads() {
+        if(_rpos < _rlen) sqstd_fseek(_handle,-(_rlen - _rpos),SQ_SEEK_CUR);
+        _rpos = _rlen = 0;
+    }
     SQFILE _handle;
     bool _owns;
+    unsigned char *_buf;
+    SQInteger _bufsize;
+    SQInteger _rpos;
+    SQInteger _rlen;
+    SQInteger _wlen;
 };
 
 static SQInteger _file__typeof(HSQUIRRELVM v)
@@ -124,25 +227,32 @@ static SQInteger _file_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size
     return 1;
 }
 
+//file(name,mode,[bufsize]), a bufsize of 0 turns buffering off
 static SQInteger _file_constructor(HSQUIRRELVM v)
 {
     const SQChar *filename,*mode;
     bool owns = true;
     SQFile *f;
     SQFILE newf;
+    SQInteger bufsize = 0;
     if(sq_gettype(v,2) == OT_STRING && sq_gettype(v,3) == OT_STRING) {
         sq_getstring(v, 2, &filename);
         sq_getstring(v, 3, &mode);
-        newf = sqstd_fopen(filename, mode);
-        if(!newf) return sq_throwerror(v, _SC("cannot open file"));
+        bufsize = SQSTD_FILE_BUFSIZE;
     } else if(sq_gettype(v,2) == OT_USERPOINTER) {
         owns = !(sq_gettype(v,3) == OT_NULL);
         sq_getuserpointer(v,2,&newf);
     } else {
         return sq_throwerror(v,_SC("wrong parameter"));
     }
+    if(sq_gettop(v) > 3) sq_getinteger(v,4,&bufsize);
+    if(bufsize < 0) return sq_throwerror(v,_SC("invalid buffer size"));
+    if(sq_gettype(v,2) == OT_STRING) {
+        newf = sqstd_fopen(filename, mode);
+        if(!newf) return sq_throwerror(v, _SC("cannot open file"));
+    }
 
-    f = new (sq_malloc(sizeof(SQFile)))SQFile(newf,owns);
+    f = new (sq_malloc(sizeof(SQFile)))SQFile(newf,owns,bufsize);
     if(SQ_FAILED(sq_setinstanceup(v,1,f))) {
         f->~SQFile();
         sq_free(f,sizeof(SQFile));
@@ -166,7 +276,7 @@ static SQInteger _file_close(HSQUIRRELVM v)
 //bindings
 #define _DECL_FILE_FUNC(name,nparams,typecheck) {_SC(#name),_file_##name,nparams,typecheck}
 static const SQRegFunction _file_methods[] = {
-    _DECL_FILE_FUNC(constructor,3,_SC("x")),
+    _DECL_FILE_FUNC(constructor,-3,_SC("x..n")),
     _DECL_FILE_FUNC(_typeof,1,_SC("x")),
     _DECL_FILE_FUNC(close,1,_SC("x")),
     {NULL,(SQFUNCTION)0,0,NULL}
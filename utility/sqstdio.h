@@ -16,6 +16,16 @@ struct SQStream {
     virtual SQInteger Seek(SQInteger offset, SQInteger origin) = 0;
     virtual bool IsValid() = 0;
     virtual bool EOS() = 0;
+    //Reads up to size bytes, stopping after the first delim. This goes a byte at a time,
+    //streams that can search their own buffer override it.
+    virtual SQInteger ReadUntil(void *buffer, SQInteger size, int delim) {
+        unsigned char *p = (unsigned char *)buffer;
+        SQInteger n = 0;
+        while(n < size && Read(p + n, 1) == 1) {
+            if(p[n++] == (unsigned char)delim) break;
+        }
+        return n;
+    }
 };
 
 extern "C" {
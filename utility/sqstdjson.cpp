@@ -0,0 +1,549 @@
+/* see copyright notice in squirrel.h */
+#include <new>
+#include <squirrel.h>
+#include <sqstdio.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sqstdjson.h>
+
+//jsonencode(value, [stream]) writes tables, arrays, strings, numbers, bools and null as JSON in one pass,
+//into a string or straight to a stream. jsondecode(source, [callback]) reads one JSON value from a string or
+//stream. Streams are read a chunk at a time, so a document is never held in memory as text. With a callback
+//nothing is built at all, the callback gets each piece as it's parsed.
+
+#define SQSTD_JSON_MAXDEPTH 64
+#define SQSTD_JSON_CHUNK 128
+
+#ifdef _SQ64
+#define _json_strtoint strtoll
+#else
+#define _json_strtoint strtol
+#endif
+
+struct SQJsonWriter {
+    HSQUIRRELVM v;
+    SQChar *buf;
+    SQInteger len;
+    SQInteger size;
+    SQStream *out; //NULL to keep everything in buf
+    SQInteger written;
+};
+
+static bool _json_flush(SQJsonWriter *w)
+{
+    if(w->out && w->len) {
+        if(w->out->Write(w->buf,w->len) != w->len) return false;
+        w->written += w->len;
+        w->len = 0;
+    }
+    return true;
+}
+
+static SQRESULT _json_put(SQJsonWriter *w,const SQChar *s,SQInteger n)
+{
+    if(w->len + n > w->size) {
+        if(w->out) {
+            if(!_json_flush(w)) return sq_throwerror(w->v,_SC("write failed"));
+            if(n > w->size) {
+                if(w->out->Write((void *)s,n) != n) return sq_throwerror(w->v,_SC("write failed"));
+                w->written += n;
+                return SQ_OK;
+            }
+        }
+        else {
+            SQInteger newsize = w->size * 2;
+            while(newsize < w->len + n) newsize *= 2;
+            w->buf = (SQChar *)sq_realloc(w->buf,w->size,newsize);
+            w->size = newsize;
+        }
+    }
+    memcpy(w->buf + w->len,s,n);
+    w->len += n;
+    return SQ_OK;
+}
+
+static SQRESULT _json_putstring(SQJsonWriter *w,const SQChar *s,SQInteger n)
+{
+    SQInteger start = 0;
+    if(SQ_FAILED(_json_put(w,_SC("\""),1))) return SQ_ERROR;
+    for(SQInteger i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        const SQChar *esc;
+        SQChar ubuf[8];
+        switch(c) {
+        case '"': esc = _SC("\\\""); break;
+        case '\\': esc = _SC("\\\\"); break;
+        case '\n': esc = _SC("\\n"); break;
+        case '\r': esc = _SC("\\r"); break;
+        case '\t': esc = _SC("\\t"); break;
+        case '\b': esc = _SC("\\b"); break;
+        case '\f': esc = _SC("\\f"); break;
+        default:
+            if(c >= 0x20) continue;
+            scsprintf(ubuf,sizeof(ubuf),_SC("\\u%04x"),(unsigned int)c);
+            esc = ubuf;
+        }
+        //Plain characters are copied a run at a time
+        if(SQ_FAILED(_json_put(w,s + start,i - start))) return SQ_ERROR;
+        if(SQ_FAILED(_json_put(w,esc,scstrlen(esc)))) return SQ_ERROR;
+        start = i + 1;
+    }
+    if(SQ_FAILED(_json_put(w,s + start,n - start))) return SQ_ERROR;
+    return _json_put(w,_SC("\""),1);
+}
+
+//The shortest form that reads back as the same number. JSON has no NaN or infinity, they become null.
+static SQRESULT _json_putfloat(SQJsonWriter *w,SQFloat f)
+{
+    SQChar buf[32];
+    if(f != f || f - f != 0) return _json_put(w,_SC("null"),4);
+    for(int prec = 6; ; prec++) {
+        scsprintf(buf,sizeof(buf),_SC("%.*g"),prec,(double)f);
+        if(prec >= 17 || (SQFloat)scstrtod(buf,NULL) == f) break;
+    }
+    //Keep a trailing .0 so a whole number comes back as a float
+    if(!strpbrk(buf,".eEn")) strcat(buf,".0");
+    return _json_put(w,buf,scstrlen(buf));
+}
+
+static SQRESULT _json_encode(SQJsonWriter *w,SQInteger idx,SQInteger depth)
+{
+    HSQUIRRELVM v = w->v;
+    SQChar buf[32];
+    switch(sq_gettype(v,idx)) {
+    case OT_NULL:
+        return _json_put(w,_SC("null"),4);
+    case OT_BOOL: {
+        SQBool b;
+        sq_getbool(v,idx,&b);
+        return b ? _json_put(w,_SC("true"),4) : _json_put(w,_SC("false"),5);
+    }
+    case OT_INTEGER: {
+        SQInteger i;
+        sq_getinteger(v,idx,&i);
+        scsprintf(buf,sizeof(buf),_PRINT_INT_FMT,i);
+        return _json_put(w,buf,scstrlen(buf));
+    }
+    case OT_FLOAT: {
+        SQFloat f;
+        sq_getfloat(v,idx,&f);
+        return _json_putfloat(w,f);
+    }
+    case OT_STRING: {
+        const SQChar *s;
+        sq_getstring(v,idx,&s);
+        return _json_putstring(w,s,sq_getsize(v,idx));
+    }
+    case OT_ARRAY: {
+        if(depth == SQSTD_JSON_MAXDEPTH) return sq_throwerror(v,_SC("nested too deeply, or contains itself"));
+        SQInteger n = sq_getsize(v,idx);
+        if(SQ_FAILED(_json_put(w,_SC("["),1))) return SQ_ERROR;
+        for(SQInteger i = 0; i < n; i++) {
+            if(i && SQ_FAILED(_json_put(w,_SC(","),1))) return SQ_ERROR;
+            sq_pushinteger(v,i);
+            if(SQ_FAILED(sq_rawget(v,idx))) return SQ_ERROR;
+            if(SQ_FAILED(_json_encode(w,sq_gettop(v),depth + 1))) return SQ_ERROR;
+            sq_pop(v,1);
+        }
+        return _json_put(w,_SC("]"),1);
+    }
+    case OT_TABLE: {
+        if(depth == SQSTD_JSON_MAXDEPTH) return sq_throwerror(v,_SC("nested too deeply, or contains itself"));
+        bool first = true;
+        if(SQ_FAILED(_json_put(w,_SC("{"),1))) return SQ_ERROR;
+        sq_pushnull(v);
+        while(SQ_SUCCEEDED(sq_next(v,idx))) {
+            if(!first && SQ_FAILED(_json_put(w,_SC(","),1))) return SQ_ERROR;
+            first = false;
+            //Object keys have to be strings, numeric keys are quoted
+            SQObjectType kt = sq_gettype(v,-2);
+            if(kt == OT_STRING) {
+                if(SQ_FAILED(_json_encode(w,sq_gettop(v) - 1,depth + 1))) return SQ_ERROR;
+            }
+            else if(kt == OT_INTEGER || kt == OT_FLOAT) {
+                if(SQ_FAILED(_json_put(w,_SC("\""),1))
+                    || SQ_FAILED(_json_encode(w,sq_gettop(v) - 1,depth + 1))
+                    || SQ_FAILED(_json_put(w,_SC("\""),1))) return SQ_ERROR;
+            }
+            else return sq_throwerror(v,_SC("object keys must be strings or numbers"));
+            if(SQ_FAILED(_json_put(w,_SC(":"),1))) return SQ_ERROR;
+            if(SQ_FAILED(_json_encode(w,sq_gettop(v),depth + 1))) return SQ_ERROR;
+            sq_pop(v,2);
+        }
+        sq_pop(v,1);
+        return _json_put(w,_SC("}"),1);
+    }
+    default:
+        return sq_throwerror(v,_SC("only tables, arrays, strings, numbers, bools and null can be encoded"));
+    }
+}
+
+static SQInteger _g_json_jsonencode(HSQUIRRELVM v)
+{
+    SQJsonWriter w;
+    w.v = v;
+    w.out = NULL;
+    w.written = 0;
+    if(sq_gettop(v) > 2) {
+        SQUserPointer p = NULL;
+        if(SQ_FAILED(sq_getinstanceup(v,3,&p,(SQUserPointer)((SQUnsignedInteger)SQSTD_STREAM_TYPE_TAG))) || !p || !((SQStream *)p)->IsValid())
+            return sq_throwerror(v,_SC("expected a stream"));
+        w.out = (SQStream *)p;
+    }
+    if(SQ_FAILED(sq_reservestack(v,SQSTD_JSON_MAXDEPTH * 3 + 8))) return SQ_ERROR;
+    w.len = 0;
+    w.size = w.out ? 256 : 64;
+    w.buf = (SQChar *)sq_malloc(w.size);
+    SQRESULT r = _json_encode(&w,2,0);
+    if(SQ_SUCCEEDED(r) && w.out && !_json_flush(&w)) r = sq_throwerror(v,_SC("write failed"));
+    if(SQ_SUCCEEDED(r)) {
+        if(w.out) sq_pushinteger(v,w.written);
+        else sq_pushstring(v,w.buf,w.len);
+    }
+    sq_free(w.buf,w.size);
+    return SQ_SUCCEEDED(r) ? 1 : SQ_ERROR;
+}
+
+struct SQJsonReader {
+    HSQUIRRELVM v;
+    const unsigned char *p;
+    const unsigned char *end;
+    const unsigned char *base;
+    SQInteger consumed; //bytes before base, for error offsets
+    SQStream *in; //refills the window when set
+    unsigned char chunk[SQSTD_JSON_CHUNK];
+    SQChar *sbuf; //scratch for strings and numbers
+    SQInteger slen;
+    SQInteger ssize;
+    SQInteger callback; //stack index, 0 to build the value
+    bool stopped;
+};
+
+static SQRESULT _json_error(SQJsonReader *r,const SQChar *msg)
+{
+    SQChar buf[96];
+    scsprintf(buf,sizeof(buf) / sizeof(SQChar),_SC("%s at offset %d"),msg,(int)(r->consumed + (r->p - r->base)));
+    return sq_throwerror(r->v,buf);
+}
+
+//The next byte without consuming it, or -1 at the end of the input
+static int _json_peek(SQJsonReader *r)
+{
+    if(r->p == r->end) {
+        if(!r->in) return -1;
+        r->consumed += r->end - r->base;
+        SQInteger n = r->in->Read(r->chunk,SQSTD_JSON_CHUNK);
+        if(n <= 0) {
+            r->base = r->p = r->end = r->chunk;
+            return -1;
+        }
+        r->base = r->p = r->chunk;
+        r->end = r->chunk + n;
+    }
+    return *r->p;
+}
+
+static int _json_skipws(SQJsonReader *r)
+{
+    for(;;) {
+        int c = _json_peek(r);
+        if(c != ' ' && c != '\t' && c != '\n' && c != '\r') return c;
+        r->p++;
+    }
+}
+
+static void _json_addchar(SQJsonReader *r,SQChar c)
+{
+    if(r->slen == r->ssize) {
+        r->sbuf = (SQChar *)sq_realloc(r->sbuf,r->ssize,r->ssize * 2);
+        r->ssize *= 2;
+    }
+    r->sbuf[r->slen++] = c;
+}
+
+static SQRESULT _json_expectword(SQJsonReader *r,const char *word)
+{
+    for(; *word; word++) {
+        if(_json_peek(r) != *word) return _json_error(r,_SC("invalid literal"));
+        r->p++;
+    }
+    return SQ_OK;
+}
+
+static int _json_hex4(SQJsonReader *r)
+{
+    int u = 0;
+    for(int i = 0; i < 4; i++) {
+        int c = _json_peek(r);
+        if(c >= '0' && c <= '9') u = u * 16 + c - '0';
+        else if(c >= 'a' && c <= 'f') u = u * 16 + c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F') u = u * 16 + c - 'A' + 10;
+        else return -1;
+        r->p++;
+    }
+    return u;
+}
+
+//Reads a string into sbuf and pushes it. \u escapes become UTF-8.
+static SQRESULT _json_string(SQJsonReader *r)
+{
+    r->p++; //the opening quote
+    r->slen = 0;
+    for(;;) {
+        int c = _json_peek(r);
+        if(c < 0) return _json_error(r,_SC("unterminated string"));
+        r->p++;
+        if(c == '"') break;
+        if(c < 0x20) return _json_error(r,_SC("control character in string"));
+        if(c != '\\') {
+            _json_addchar(r,(SQChar)c);
+            continue;
+        }
+        c = _json_peek(r);
+        r->p++;
+        switch(c) {
+        case '"': case '\\': case '/': _json_addchar(r,(SQChar)c); break;
+        case 'n': _json_addchar(r,'\n'); break;
+        case 'r': _json_addchar(r,'\r'); break;
+        case 't': _json_addchar(r,'\t'); break;
+        case 'b': _json_addchar(r,'\b'); break;
+        case 'f': _json_addchar(r,'\f'); break;
+        case 'u': {
+            int u = _json_hex4(r);
+            if(u < 0) return _json_error(r,_SC("invalid \\u escape"));
+            if(u >= 0xD800 && u < 0xDC00) {
+                //A surrogate pair
+                int lo = -1;
+                if(_json_peek(r) == '\\') {
+                    r->p++;
+                    if(_json_peek(r) == 'u') {
+                        r->p++;
+                        lo = _json_hex4(r);
+                    }
+                }
+                if(lo < 0xDC00 || lo > 0xDFFF) return _json_error(r,_SC("invalid surrogate pair"));
+                u = 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+            }
+            if(u < 0x80) _json_addchar(r,(SQChar)u);
+            else if(u < 0x800) {
+                _json_addchar(r,(SQChar)(0xC0 | (u >> 6)));
+                _json_addchar(r,(SQChar)(0x80 | (u & 0x3F)));
+            }
+            else if(u < 0x10000) {
+                _json_addchar(r,(SQChar)(0xE0 | (u >> 12)));
+                _json_addchar(r,(SQChar)(0x80 | ((u >> 6) & 0x3F)));
+                _json_addchar(r,(SQChar)(0x80 | (u & 0x3F)));
+            }
+            else {
+                _json_addchar(r,(SQChar)(0xF0 | (u >> 18)));
+                _json_addchar(r,(SQChar)(0x80 | ((u >> 12) & 0x3F)));
+                _json_addchar(r,(SQChar)(0x80 | ((u >> 6) & 0x3F)));
+                _json_addchar(r,(SQChar)(0x80 | (u & 0x3F)));
+            }
+            break;
+        }
+        default: return _json_error(r,_SC("invalid escape"));
+        }
+    }
+    sq_pushstring(r->v,r->sbuf,r->slen);
+    return SQ_OK;
+}
+
+//Integers stay integers unless they don't fit
+static SQRESULT _json_number(SQJsonReader *r)
+{
+    bool isfloat = false;
+    r->slen = 0;
+    for(;;) {
+        int c = _json_peek(r);
+        if(c == '.' || c == 'e' || c == 'E') isfloat = true;
+        else if(!((c >= '0' && c <= '9') || c == '-' || c == '+')) break;
+        _json_addchar(r,(SQChar)c);
+        r->p++;
+    }
+    _json_addchar(r,0);
+    SQChar *end;
+    if(!isfloat) {
+        errno = 0;
+        SQInteger i = (SQInteger)_json_strtoint(r->sbuf,&end,10);
+        if(*end == 0 && errno == 0 && end != r->sbuf) {
+            sq_pushinteger(r->v,i);
+            return SQ_OK;
+        }
+    }
+    SQFloat f = (SQFloat)scstrtod(r->sbuf,&end);
+    if(*end != 0 || end == r->sbuf) return _json_error(r,_SC("invalid number"));
+    sq_pushfloat(r->v,f);
+    return SQ_OK;
+}
+
+//Hands the value on top of the stack to the callback as event, and pops it
+static SQRESULT _json_event(SQJsonReader *r,const SQChar *event)
+{
+    HSQUIRRELVM v = r->v;
+    sq_push(v,r->callback);
+    sq_pushroottable(v);
+    sq_pushstring(v,event,-1);
+    sq_push(v,-4);
+    if(SQ_FAILED(sq_call(v,3,SQTrue,SQFalse))) return SQ_ERROR;
+    SQBool b = SQTrue;
+    if(sq_gettype(v,-1) == OT_BOOL) sq_getbool(v,-1,&b);
+    if(!b) r->stopped = true;
+    sq_pop(v,3);
+    return SQ_OK;
+}
+
+static SQRESULT _json_key(SQJsonReader *r)
+{
+    if(_json_skipws(r) != '"') return _json_error(r,_SC("expected a string key"));
+    if(SQ_FAILED(_json_string(r))) return SQ_ERROR;
+    if(r->callback && SQ_FAILED(_json_event(r,_SC("key")))) return SQ_ERROR;
+    if(_json_skipws(r) != ':') return _json_error(r,_SC("expected :"));
+    r->p++;
+    return SQ_OK;
+}
+
+//Without a callback, open containers sit on the stack with the pending key and value above them
+//until the value is slotted in, so nesting doesn't recurse.
+static SQRESULT _json_parse(SQJsonReader *r)
+{
+    HSQUIRRELVM v = r->v;
+    char open[SQSTD_JSON_MAXDEPTH];
+    SQInteger depth = 0;
+    for(;;) {
+        bool complete = true;
+        int c = _json_skipws(r);
+        if(c == '{' || c == '[') {
+            r->p++;
+            if(depth == SQSTD_JSON_MAXDEPTH) return _json_error(r,_SC("nested too deeply"));
+            open[depth++] = (char)c;
+            if(r->callback) {
+                sq_pushnull(v);
+                if(SQ_FAILED(_json_event(r,c == '{' ? _SC("object") : _SC("array")))) return SQ_ERROR;
+            }
+            else if(c == '{') sq_newtable(v);
+            else sq_newarray(v,0);
+            if(_json_skipws(r) == (c == '{' ? '}' : ']')) {
+                r->p++;
+                depth--;
+                if(r->callback) {
+                    sq_pushnull(v);
+                    if(SQ_FAILED(_json_event(r,_SC("end")))) return SQ_ERROR;
+                }
+            }
+            else {
+                if(c == '{' && SQ_FAILED(_json_key(r))) return SQ_ERROR;
+                complete = false;
+            }
+        }
+        else {
+            SQRESULT res;
+            switch(c) {
+            case '"': res = _json_string(r); break;
+            case 't': res = _json_expectword(r,"true"); sq_pushbool(v,SQTrue); break;
+            case 'f': res = _json_expectword(r,"false"); sq_pushbool(v,SQFalse); break;
+            case 'n': res = _json_expectword(r,"null"); sq_pushnull(v); break;
+            case -1: return _json_error(r,_SC("unexpected end of input"));
+            default:
+                if(c == '-' || (c >= '0' && c <= '9')) res = _json_number(r);
+                else return _json_error(r,_SC("unexpected character"));
+            }
+            if(SQ_FAILED(res)) return SQ_ERROR;
+            if(r->callback && SQ_FAILED(_json_event(r,_SC("value")))) return SQ_ERROR;
+        }
+        if(r->stopped) return SQ_OK;
+        if(!complete) continue;
+        //A whole value is done, put it in its container and close any that end here
+        for(;;) {
+            if(depth == 0) return SQ_OK;
+            char o = open[depth - 1];
+            if(!r->callback) {
+                if(o == '[') sq_arrayappend(v,-2);
+                else sq_newslot(v,-3,SQFalse);
+            }
+            c = _json_skipws(r);
+            if(c == ',') {
+                r->p++;
+                if(o == '{' && SQ_FAILED(_json_key(r))) return SQ_ERROR;
+                if(r->stopped) return SQ_OK;
+                break;
+            }
+            if(c != (o == '{' ? '}' : ']')) return _json_error(r,o == '{' ? _SC("expected , or }") : _SC("expected , or ]"));
+            r->p++;
+            depth--;
+            if(r->callback) {
+                sq_pushnull(v);
+                if(SQ_FAILED(_json_event(r,_SC("end")))) return SQ_ERROR;
+                if(r->stopped) return SQ_OK;
+            }
+        }
+    }
+}
+
+//jsondecode(source, [callback]). source is a string or a stream, read from its current position. A
+//stream is left just after the value, so a stream of documents can be read one call at a time. callback(event, value)
+//gets "object", "array", "key", "value" and "end" events instead of the value being built, and can return false to stop.
+static SQInteger _g_json_jsondecode(HSQUIRRELVM v)
+{
+    SQJsonReader r;
+    r.v = v;
+    r.in = NULL;
+    r.consumed = 0;
+    r.callback = 0;
+    r.stopped = false;
+    if(sq_gettype(v,2) == OT_STRING) {
+        const SQChar *s;
+        sq_getstring(v,2,&s);
+        r.base = r.p = (const unsigned char *)s;
+        r.end = r.p + sq_getsize(v,2);
+    }
+    else {
+        SQUserPointer p = NULL;
+        if(SQ_FAILED(sq_getinstanceup(v,2,&p,(SQUserPointer)((SQUnsignedInteger)SQSTD_STREAM_TYPE_TAG))) || !p || !((SQStream *)p)->IsValid())
+            return sq_throwerror(v,_SC("expected a string or a stream"));
+        r.in = (SQStream *)p;
+        r.base = r.p = r.end = r.chunk;
+    }
+    if(sq_gettop(v) > 2) r.callback = 3;
+    if(SQ_FAILED(sq_reservestack(v,SQSTD_JSON_MAXDEPTH * 2 + 8))) return SQ_ERROR;
+    r.ssize = 32;
+    r.slen = 0;
+    r.sbuf = (SQChar *)sq_malloc(r.ssize);
+    SQRESULT res = _json_parse(&r);
+    if(SQ_SUCCEEDED(res) && !r.stopped) {
+        if(r.in) {
+            //Give back what was read past the value
+            if(r.end > r.p) r.in->Seek(-(SQInteger)(r.end - r.p),SQ_SEEK_CUR);
+        }
+        else if(_json_skipws(&r) != -1) res = _json_error(&r,_SC("unexpected data after the value"));
+    }
+    sq_free(r.sbuf,r.ssize);
+    if(SQ_FAILED(res)) return SQ_ERROR;
+    if(r.callback) sq_pushbool(v,r.stopped ? SQFalse : SQTrue);
+    return 1;
+}
+
+#define _DECL_GLOBALJSON_FUNC(name,nparams,typecheck) {_SC(#name),_g_json_##name,nparams,typecheck}
+static const SQRegFunction jsonlib_funcs[]={
+    _DECL_GLOBALJSON_FUNC(jsonencode,-2,_SC("..x")),
+    _DECL_GLOBALJSON_FUNC(jsondecode,-2,_SC(".s|xc")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_GLOBALJSON_FUNC
+
+SQRESULT sqstd_register_jsonlib(HSQUIRRELVM v)
+{
+    SQInteger i = 0;
+    while(jsonlib_funcs[i].name != 0) {
+        const SQRegFunction &f = jsonlib_funcs[i];
+        sq_pushstring(v,f.name,-1);
+        sq_newclosure(v,f.f,0);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    return SQ_OK;
+}
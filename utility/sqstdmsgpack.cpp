@@ -0,0 +1,407 @@
+/* see copyright notice in squirrel.h */
+#include <new>
+#include <squirrel.h>
+#include <sqstdio.h>
+#include <string.h>
+#include <sqstdblob.h>
+#include "sqstdstream.h"
+#include "sqstdblobimpl.h"
+
+//msgpack(value, [stream]) and msgunpack(source) convert values to and from MessagePack, a binary
+//format that's smaller and much quicker to read back than JSON. Tables, arrays, integers, floats,
+//strings, blobs(as bin), bools and null round trip, keys of any of those types included. Other
+//programs and hosts can read it with any MessagePack library.
+
+#define SQSTD_MSGPACK_MAXDEPTH 64
+#define SQSTD_MSGPACK_BUFSIZE 256
+#define SQSTD_MSGPACK_CHUNK 4096
+
+struct SQMsgPackWriter {
+    HSQUIRRELVM v;
+    SQStream *out;
+    unsigned char buf[SQSTD_MSGPACK_BUFSIZE];
+    SQInteger len;
+    SQInteger written;
+};
+
+static SQRESULT _mp_flush(SQMsgPackWriter *w)
+{
+    if(w->len) {
+        if(w->out->Write(w->buf,w->len) != w->len) return sq_throwerror(w->v,_SC("write failed"));
+        w->written += w->len;
+        w->len = 0;
+    }
+    return SQ_OK;
+}
+
+static SQRESULT _mp_put(SQMsgPackWriter *w,const void *p,SQInteger n)
+{
+    if(w->len + n > SQSTD_MSGPACK_BUFSIZE) {
+        if(SQ_FAILED(_mp_flush(w))) return SQ_ERROR;
+        if(n > SQSTD_MSGPACK_BUFSIZE) {
+            if(w->out->Write((void *)p,n) != n) return sq_throwerror(w->v,_SC("write failed"));
+            w->written += n;
+            return SQ_OK;
+        }
+    }
+    memcpy(w->buf + w->len,p,n);
+    w->len += n;
+    return SQ_OK;
+}
+
+//A type byte followed by size bytes of x, big endian
+static SQRESULT _mp_puthead(SQMsgPackWriter *w,unsigned char type,unsigned long long x,SQInteger size)
+{
+    unsigned char b[9];
+    b[0] = type;
+    for(SQInteger i = 0; i < size; i++) b[size - i] = (unsigned char)(x >> (i * 8));
+    return _mp_put(w,b,size + 1);
+}
+
+//str, bin, array and map headers: a fix form for small counts, then 8(not for array and map), 16 and 32 bit
+static SQRESULT _mp_putcount(SQMsgPackWriter *w,unsigned char fix,SQInteger fixmax,unsigned char t8,unsigned char t16,SQInteger n)
+{
+    if(n <= fixmax) return _mp_puthead(w,(unsigned char)(fix | n),0,0);
+    if(t8 && n <= 0xFF) return _mp_puthead(w,t8,n,1);
+    if(n <= 0xFFFF) return _mp_puthead(w,t16,n,2);
+    return _mp_puthead(w,t16 + 1,n,4);
+}
+
+static SQRESULT _mp_putint(SQMsgPackWriter *w,SQInteger i)
+{
+    if(i >= 0) {
+        if(i < 128) return _mp_puthead(w,(unsigned char)i,0,0);
+        if(i <= 0xFF) return _mp_puthead(w,0xcc,i,1);
+        if(i <= 0xFFFF) return _mp_puthead(w,0xcd,i,2);
+        if((unsigned long long)i <= 0xFFFFFFFFull) return _mp_puthead(w,0xce,i,4);
+        return _mp_puthead(w,0xcf,(unsigned long long)i,8);
+    }
+    if(i >= -32) return _mp_puthead(w,(unsigned char)i,0,0);
+    if(i >= -128) return _mp_puthead(w,0xd0,(unsigned long long)i,1);
+    if(i >= -32768) return _mp_puthead(w,0xd1,(unsigned long long)i,2);
+    if((long long)i >= -2147483647ll - 1) return _mp_puthead(w,0xd2,(unsigned long long)i,4);
+    return _mp_puthead(w,0xd3,(unsigned long long)i,8);
+}
+
+static SQRESULT _mp_encode(SQMsgPackWriter *w,SQInteger idx,SQInteger depth)
+{
+    HSQUIRRELVM v = w->v;
+    switch(sq_gettype(v,idx)) {
+    case OT_NULL: return _mp_puthead(w,0xc0,0,0);
+    case OT_BOOL: {
+        SQBool b;
+        sq_getbool(v,idx,&b);
+        return _mp_puthead(w,b ? 0xc3 : 0xc2,0,0);
+    }
+    case OT_INTEGER: {
+        SQInteger i;
+        sq_getinteger(v,idx,&i);
+        return _mp_putint(w,i);
+    }
+    case OT_FLOAT: {
+        SQFloat f;
+        sq_getfloat(v,idx,&f);
+        //Floats go out at the VM's own precision
+        if(sizeof(SQFloat) == 4) {
+            float x = (float)f;
+            unsigned int u;
+            memcpy(&u,&x,4);
+            return _mp_puthead(w,0xca,u,4);
+        }
+        double x = (double)f;
+        unsigned long long u;
+        memcpy(&u,&x,8);
+        return _mp_puthead(w,0xcb,u,8);
+    }
+    case OT_STRING: {
+        const SQChar *s;
+        sq_getstring(v,idx,&s);
+        SQInteger n = sq_getsize(v,idx);
+        if(SQ_FAILED(_mp_putcount(w,0xa0,31,0xd9,0xda,n))) return SQ_ERROR;
+        return _mp_put(w,s,n);
+    }
+    case OT_ARRAY: {
+        if(depth == SQSTD_MSGPACK_MAXDEPTH) return sq_throwerror(v,_SC("nested too deeply, or contains itself"));
+        SQInteger n = sq_getsize(v,idx);
+        if(SQ_FAILED(_mp_putcount(w,0x90,15,0,0xdc,n))) return SQ_ERROR;
+        for(SQInteger i = 0; i < n; i++) {
+            sq_pushinteger(v,i);
+            if(SQ_FAILED(sq_rawget(v,idx))) return SQ_ERROR;
+            if(SQ_FAILED(_mp_encode(w,sq_gettop(v),depth + 1))) return SQ_ERROR;
+            sq_pop(v,1);
+        }
+        return SQ_OK;
+    }
+    case OT_TABLE: {
+        if(depth == SQSTD_MSGPACK_MAXDEPTH) return sq_throwerror(v,_SC("nested too deeply, or contains itself"));
+        if(SQ_FAILED(_mp_putcount(w,0x80,15,0,0xde,sq_getsize(v,idx)))) return SQ_ERROR;
+        sq_pushnull(v);
+        while(SQ_SUCCEEDED(sq_next(v,idx))) {
+            if(SQ_FAILED(_mp_encode(w,sq_gettop(v) - 1,depth + 1))) return SQ_ERROR;
+            if(SQ_FAILED(_mp_encode(w,sq_gettop(v),depth + 1))) return SQ_ERROR;
+            sq_pop(v,2);
+        }
+        sq_pop(v,1);
+        return SQ_OK;
+    }
+    case OT_INSTANCE: {
+        SQUserPointer p;
+        if(SQ_SUCCEEDED(sqstd_getblob(v,idx,&p))) {
+            SQInteger n = sqstd_getblobsize(v,idx);
+            if(SQ_FAILED(_mp_putcount(w,0,-1,0xc4,0xc5,n))) return SQ_ERROR;
+            return _mp_put(w,p,n);
+        }
+    }
+    //fall through
+    default:
+        return sq_throwerror(v,_SC("only tables, arrays, strings, blobs, numbers, bools and null can be packed"));
+    }
+}
+
+static SQInteger _g_msgpack_msgpack(HSQUIRRELVM v)
+{
+    SQMsgPackWriter w;
+    bool created = false;
+    w.v = v;
+    w.len = 0;
+    w.written = 0;
+    if(sq_gettop(v) > 2) {
+        SQUserPointer p = NULL;
+        if(SQ_FAILED(sq_getinstanceup(v,3,&p,(SQUserPointer)((SQUnsignedInteger)SQSTD_STREAM_TYPE_TAG))) || !p || !((SQStream *)p)->IsValid())
+            return sq_throwerror(v,_SC("expected a stream"));
+        w.out = (SQStream *)p;
+    }
+    else {
+        SQUserPointer p = NULL;
+        if(!sqstd_createblob(v,0) || SQ_FAILED(sq_getinstanceup(v,-1,&p,(SQUserPointer)SQSTD_BLOB_TYPE_TAG)))
+            return sq_throwerror(v,_SC("cannot create blob"));
+        w.out = (SQBlob *)p;
+        created = true;
+    }
+    if(SQ_FAILED(sq_reservestack(v,SQSTD_MSGPACK_MAXDEPTH * 3 + 8))) return SQ_ERROR;
+    if(SQ_FAILED(_mp_encode(&w,2,0)) || SQ_FAILED(_mp_flush(&w))) return SQ_ERROR;
+    if(created) {
+        //Ready to be read back from the start
+        w.out->Seek(0,SQ_SEEK_SET);
+        return 1;
+    }
+    sq_pushinteger(v,w.written);
+    return 1;
+}
+
+struct SQMsgPackReader {
+    HSQUIRRELVM v;
+    const unsigned char *p; //reading from memory when in is NULL
+    const unsigned char *end;
+    SQStream *in;
+};
+
+static bool _mp_read(SQMsgPackReader *r,void *dst,SQInteger n)
+{
+    if(r->in) return r->in->Read(dst,n) == n;
+    if(r->end - r->p < n) return false;
+    memcpy(dst,r->p,n);
+    r->p += n;
+    return true;
+}
+
+static bool _mp_readuint(SQMsgPackReader *r,SQInteger size,unsigned long long &x)
+{
+    unsigned char b[8];
+    if(!_mp_read(r,b,size)) return false;
+    x = 0;
+    for(SQInteger i = 0; i < size; i++) x = (x << 8) | b[i];
+    return true;
+}
+
+//For streams that can't say how long they are, so memory only grows as the bytes arrive
+static SQRESULT _mp_readchunks(SQMsgPackReader *r,SQInteger n,bool isblob)
+{
+    HSQUIRRELVM v = r->v;
+    SQBlob *blob = NULL;
+    if(isblob) {
+        SQUserPointer p = NULL;
+        if(!sqstd_createblob(v,0) || SQ_FAILED(sq_getinstanceup(v,-1,&p,(SQUserPointer)SQSTD_BLOB_TYPE_TAG)))
+            return sq_throwerror(v,_SC("cannot create blob"));
+        blob = (SQBlob *)p;
+    }
+    for(SQInteger done = 0; done < n; ) {
+        SQInteger chunk = n - done < SQSTD_MSGPACK_CHUNK ? n - done : SQSTD_MSGPACK_CHUNK;
+        //A blob gets each chunk as it comes, a string is built up in the scratchpad
+        SQInteger at = blob ? 0 : done;
+        unsigned char *buf = (unsigned char *)sq_getscratchpad(v,at + chunk) + at;
+        if(!_mp_read(r,buf,chunk)) return sq_throwerror(v,_SC("truncated data"));
+        if(blob && blob->Write(buf,chunk) != chunk) return sq_throwerror(v,_SC("cannot create blob"));
+        done += chunk;
+    }
+    if(blob) blob->Seek(0,SQ_SEEK_SET);
+    else sq_pushstring(v,sq_getscratchpad(v,-1),n);
+    return SQ_OK;
+}
+
+//Pushes n bytes as a string or a blob. n comes from the data, so a stream has to have that
+//many bytes left before much more than a chunk is allocated for them.
+static SQRESULT _mp_readbytes(SQMsgPackReader *r,SQInteger n,bool isblob)
+{
+    HSQUIRRELVM v = r->v;
+    if(!r->in && r->end - r->p < n) return sq_throwerror(v,_SC("truncated data"));
+    if(r->in && n > SQSTD_MSGPACK_CHUNK) {
+        SQInteger len = r->in->Len(), pos = r->in->Tell();
+        if(len < 0 || pos < 0) return _mp_readchunks(r,n,isblob);
+        if(n > len - pos) return sq_throwerror(v,_SC("truncated data"));
+    }
+    if(isblob) {
+        SQUserPointer p = sqstd_createblob(v,n);
+        if(!p) return sq_throwerror(v,_SC("cannot create blob"));
+        if(!_mp_read(r,p,n)) return sq_throwerror(v,_SC("truncated data"));
+        return SQ_OK;
+    }
+    if(!r->in) {
+        sq_pushstring(v,(const SQChar *)r->p,n);
+        r->p += n;
+        return SQ_OK;
+    }
+    SQChar *buf = sq_getscratchpad(v,n);
+    if(!_mp_read(r,buf,n)) return sq_throwerror(v,_SC("truncated data"));
+    sq_pushstring(v,buf,n);
+    return SQ_OK;
+}
+
+static SQRESULT _mp_decode(SQMsgPackReader *r,SQInteger depth)
+{
+    HSQUIRRELVM v = r->v;
+    unsigned char t;
+    unsigned long long x;
+    SQInteger n = 0;
+    enum { MP_STR, MP_BIN, MP_ARRAY, MP_MAP } kind;
+    if(!_mp_read(r,&t,1)) return sq_throwerror(v,_SC("truncated data"));
+    if(t <= 0x7f) {
+        sq_pushinteger(v,t);
+        return SQ_OK;
+    }
+    if(t >= 0xe0) {
+        sq_pushinteger(v,(SQInteger)(signed char)t);
+        return SQ_OK;
+    }
+    if(t <= 0x8f) { kind = MP_MAP; n = t & 0x0f; }
+    else if(t <= 0x9f) { kind = MP_ARRAY; n = t & 0x0f; }
+    else if(t <= 0xbf) { kind = MP_STR; n = t & 0x1f; }
+    else {
+        SQInteger size = 0;
+        switch(t) {
+        case 0xc0: sq_pushnull(v); return SQ_OK;
+        case 0xc2: sq_pushbool(v,SQFalse); return SQ_OK;
+        case 0xc3: sq_pushbool(v,SQTrue); return SQ_OK;
+        case 0xc4: case 0xc5: case 0xc6: kind = MP_BIN; size = 1 << (t - 0xc4); break;
+        case 0xd9: case 0xda: case 0xdb: kind = MP_STR; size = 1 << (t - 0xd9); break;
+        case 0xdc: case 0xdd: kind = MP_ARRAY; size = 2 << (t - 0xdc); break;
+        case 0xde: case 0xdf: kind = MP_MAP; size = 2 << (t - 0xde); break;
+        case 0xca: case 0xcb: {
+            SQInteger fsize = t == 0xca ? 4 : 8;
+            if(!_mp_readuint(r,fsize,x)) return sq_throwerror(v,_SC("truncated data"));
+            if(fsize == 4) {
+                unsigned int u = (unsigned int)x;
+                float f;
+                memcpy(&f,&u,4);
+                sq_pushfloat(v,(SQFloat)f);
+            }
+            else {
+                double d;
+                memcpy(&d,&x,8);
+                sq_pushfloat(v,(SQFloat)d);
+            }
+            return SQ_OK;
+        }
+        case 0xcc: case 0xcd: case 0xce: case 0xcf:
+        case 0xd0: case 0xd1: case 0xd2: case 0xd3: {
+            bool sign = t >= 0xd0;
+            SQInteger isize = 1 << (t - (sign ? 0xd0 : 0xcc));
+            if(!_mp_readuint(r,isize,x)) return sq_throwerror(v,_SC("truncated data"));
+            if(sign && isize < 8 && (x >> (isize * 8 - 1))) x |= ~0ull << (isize * 8);
+            //uint64 above the integer range wraps, like unpack("Q")
+            sq_pushinteger(v,(SQInteger)(long long)x);
+            return SQ_OK;
+        }
+        default: return sq_throwerror(v,_SC("unsupported MessagePack type"));
+        }
+        if(!_mp_readuint(r,size,x)) return sq_throwerror(v,_SC("truncated data"));
+        if(x > 0x7FFFFFFF) return sq_throwerror(v,_SC("too large"));
+        n = (SQInteger)x;
+    }
+    switch(kind) {
+    case MP_STR: return _mp_readbytes(r,n,false);
+    case MP_BIN: return _mp_readbytes(r,n,true);
+    case MP_ARRAY:
+        if(depth == SQSTD_MSGPACK_MAXDEPTH) return sq_throwerror(v,_SC("nested too deeply"));
+        {
+            //Every element takes at least a byte, so a bad count can't allocate a huge array up front
+            bool presized = !r->in && n <= r->end - r->p;
+            sq_newarray(v,presized ? n : 0);
+            for(SQInteger i = 0; i < n; i++) {
+                if(presized) sq_pushinteger(v,i);
+                if(SQ_FAILED(_mp_decode(r,depth + 1))) return SQ_ERROR;
+                if(presized) sq_rawset(v,-3);
+                else sq_arrayappend(v,-2);
+            }
+        }
+        return SQ_OK;
+    case MP_MAP:
+        if(depth == SQSTD_MSGPACK_MAXDEPTH) return sq_throwerror(v,_SC("nested too deeply"));
+        sq_newtable(v);
+        for(SQInteger i = 0; i < n; i++) {
+            if(SQ_FAILED(_mp_decode(r,depth + 1)) || SQ_FAILED(_mp_decode(r,depth + 1))) return SQ_ERROR;
+            if(sq_gettype(v,-2) == OT_NULL) return sq_throwerror(v,_SC("null map key"));
+            sq_newslot(v,-3,SQFalse);
+        }
+        return SQ_OK;
+    }
+    return SQ_ERROR;
+}
+
+//msgunpack(source) reads one value from a string, or from a stream or blob at its current
+//position, leaving the stream just after it.
+static SQInteger _g_msgpack_msgunpack(HSQUIRRELVM v)
+{
+    SQMsgPackReader r;
+    r.v = v;
+    r.in = NULL;
+    r.p = r.end = NULL;
+    if(sq_gettype(v,2) == OT_STRING) {
+        const SQChar *s;
+        sq_getstring(v,2,&s);
+        r.p = (const unsigned char *)s;
+        r.end = r.p + sq_getsize(v,2);
+    }
+    else {
+        SQUserPointer p = NULL;
+        if(SQ_FAILED(sq_getinstanceup(v,2,&p,(SQUserPointer)((SQUnsignedInteger)SQSTD_STREAM_TYPE_TAG))) || !p || !((SQStream *)p)->IsValid())
+            return sq_throwerror(v,_SC("expected a string or a stream"));
+        r.in = (SQStream *)p;
+    }
+    if(SQ_FAILED(sq_reservestack(v,SQSTD_MSGPACK_MAXDEPTH * 3 + 8))) return SQ_ERROR;
+    if(SQ_FAILED(_mp_decode(&r,0))) return SQ_ERROR;
+    return 1;
+}
+
+#define _DECL_GLOBALMSGPACK_FUNC(name,nparams,typecheck) {_SC(#name),_g_msgpack_##name,nparams,typecheck}
+static const SQRegFunction msgpacklib_funcs[]={
+    _DECL_GLOBALMSGPACK_FUNC(msgpack,-2,_SC("..x")),
+    _DECL_GLOBALMSGPACK_FUNC(msgunpack,2,_SC(".s|x")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_GLOBALMSGPACK_FUNC
+
+SQRESULT sqstd_register_msgpack(HSQUIRRELVM v)
+{
+    SQInteger i = 0;
+    while(msgpacklib_funcs[i].name != 0) {
+        const SQRegFunction &f = msgpacklib_funcs[i];
+        sq_pushstring(v,f.name,-1);
+        sq_newclosure(v,f.f,0);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    return SQ_OK;
+}
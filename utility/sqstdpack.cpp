@@ -0,0 +1,299 @@
+/* see copyright notice in squirrel.h */
+#include <new>
+#include <squirrel.h>
+#include <sqstdio.h>
+#include <string.h>
+#include <sqstdblob.h>
+#include "sqstdstream.h"
+#include "sqstdblobimpl.h"
+
+//pack(fmt,...) and unpack(fmt,data,[offset]) encode and decode a whole binary record in one call.
+//The format is like Python's struct module: an optional byte order, < or = for little endian and > or ! for big,
+//then fields with an optional repeat count, b/B 8 bit, h/H 16 bit, i/I 32 bit, q/Q 64 bit, f float, d double,
+//? bool, x a pad byte and s a string whose count is its length. Little endian is the default.
+//Compiled formats are kept in a small cache keyed by the format text, so a format used in a loop
+//is only parsed once. The VMs only run under the GIL, so one cache can be shared.
+
+#define SQSTD_PACK_MAXOPS 24
+#define SQSTD_PACK_MAXFMT 48
+#define SQSTD_PACK_CACHE 8
+
+struct SQPackOp {
+    unsigned char code;
+    unsigned char size;
+    unsigned short count;
+};
+
+struct SQPackFormat {
+    SQChar src[SQSTD_PACK_MAXFMT];
+    SQInteger srclen; //0 for an empty cache slot
+    SQPackOp ops[SQSTD_PACK_MAXOPS];
+    SQInteger nops;
+    SQInteger size;
+    SQInteger nvalues;
+    bool big;
+};
+
+static SQPackFormat _pack_cache[SQSTD_PACK_CACHE];
+
+static SQInteger _pack_fieldsize(SQChar c)
+{
+    switch(c) {
+    case 'b': case 'B': case 'x': case '?': case 's': return 1;
+    case 'h': case 'H': return 2;
+    case 'i': case 'I': case 'f': return 4;
+    case 'q': case 'Q': case 'd': return 8;
+    default: return 0;
+    }
+}
+
+static SQRESULT _pack_compile(HSQUIRRELVM v,const SQChar *fmt,SQInteger len,SQPackFormat *pf)
+{
+    SQInteger i = 0;
+    pf->nops = 0;
+    pf->size = 0;
+    pf->nvalues = 0;
+    pf->big = false;
+    if(len > 0) {
+        switch(fmt[0]) {
+        case '<': case '=': i++; break;
+        case '>': case '!': pf->big = true; i++; break;
+        }
+    }
+    while(i < len) {
+        SQChar c = fmt[i];
+        if(c == ' ') {
+            i++;
+            continue;
+        }
+        SQInteger count = 1;
+        if(c >= '0' && c <= '9') {
+            count = 0;
+            while(i < len && fmt[i] >= '0' && fmt[i] <= '9') {
+                count = count * 10 + (fmt[i++] - '0');
+                if(count > 0xFFFF) return sq_throwerror(v,_SC("repeat count too large"));
+            }
+            if(i == len) return sq_throwerror(v,_SC("repeat count without a field"));
+            c = fmt[i];
+        }
+        SQInteger size = _pack_fieldsize(c);
+        if(!size) return sq_throwerror(v,_SC("invalid format character"));
+        i++;
+        if(count == 0) continue;
+        //Repeats of the same field, as in "hhh", merge into one op
+        SQPackOp *last = pf->nops ? &pf->ops[pf->nops - 1] : NULL;
+        if(last && last->code == c && c != 's' && last->count + count <= 0xFFFF) {
+            last->count += (unsigned short)count;
+        }
+        else {
+            if(pf->nops == SQSTD_PACK_MAXOPS) return sq_throwerror(v,_SC("too many fields in the format"));
+            pf->ops[pf->nops].code = (unsigned char)c;
+            pf->ops[pf->nops].size = (unsigned char)size;
+            pf->ops[pf->nops].count = (unsigned short)count;
+            pf->nops++;
+        }
+        pf->size += size * count;
+        if(c == 's') pf->nvalues++;
+        else if(c != 'x') pf->nvalues += count;
+    }
+    return SQ_OK;
+}
+
+//Finds the format at idx in the cache, compiling it on a miss. Formats too long for the cache
+//are compiled into scratch every time.
+static SQPackFormat *_pack_getformat(HSQUIRRELVM v,SQInteger idx,SQPackFormat *scratch)
+{
+    const SQChar *fmt;
+    sq_getstring(v,idx,&fmt);
+    SQInteger len = sq_getsize(v,idx);
+    if(len >= SQSTD_PACK_MAXFMT) {
+        return SQ_SUCCEEDED(_pack_compile(v,fmt,len,scratch)) ? scratch : NULL;
+    }
+    SQUnsignedInteger h = 2166136261u;
+    for(SQInteger i = 0; i < len; i++) h = (h ^ (unsigned char)fmt[i]) * 16777619u;
+    SQPackFormat *pf = &_pack_cache[h % SQSTD_PACK_CACHE];
+    if(pf->srclen == len + 1 && memcmp(pf->src,fmt,len) == 0) return pf;
+    pf->srclen = 0;
+    if(SQ_FAILED(_pack_compile(v,fmt,len,pf))) return NULL;
+    memcpy(pf->src,fmt,len);
+    pf->srclen = len + 1;
+    return pf;
+}
+
+static void _pack_putint(unsigned char *p,unsigned long long x,SQInteger size,bool big)
+{
+    for(SQInteger i = 0; i < size; i++) {
+        p[big ? size - 1 - i : i] = (unsigned char)x;
+        x >>= 8;
+    }
+}
+
+static unsigned long long _pack_getint(const unsigned char *p,SQInteger size,bool big)
+{
+    unsigned long long x = 0;
+    for(SQInteger i = 0; i < size; i++) {
+        x = (x << 8) | p[big ? i : size - 1 - i];
+    }
+    return x;
+}
+
+static SQInteger _g_blob_pack(HSQUIRRELVM v)
+{
+    SQPackFormat scratch;
+    SQPackFormat *pf = _pack_getformat(v,2,&scratch);
+    if(!pf) return SQ_ERROR;
+    if(sq_gettop(v) - 2 != pf->nvalues)
+        return sq_throwerror(v,_SC("wrong number of values for the format"));
+    unsigned char *p = (unsigned char *)sqstd_createblob(v,pf->size);
+    if(!p) return sq_throwerror(v,_SC("cannot create blob"));
+    SQInteger arg = 3;
+    for(SQInteger o = 0; o < pf->nops; o++) {
+        const SQPackOp &op = pf->ops[o];
+        if(op.code == 'x') {
+            //The blob starts zeroed
+            p += op.count;
+            continue;
+        }
+        if(op.code == 's') {
+            const SQChar *s;
+            if(SQ_FAILED(sq_getstring(v,arg,&s)))
+                return sq_throwerror(v,_SC("expected a string"));
+            SQInteger n = sq_getsize(v,arg++);
+            memcpy(p,s,n < op.count ? n : op.count);
+            p += op.count;
+            continue;
+        }
+        for(SQInteger c = 0; c < op.count; c++, arg++, p += op.size) {
+            if(op.code == 'f' || op.code == 'd') {
+                SQFloat f;
+                if(SQ_FAILED(sq_getfloat(v,arg,&f)))
+                    return sq_throwerror(v,_SC("expected a number"));
+                if(op.code == 'f') {
+                    float x = (float)f;
+                    unsigned int u;
+                    memcpy(&u,&x,4);
+                    _pack_putint(p,u,4,pf->big);
+                }
+                else {
+                    double x = (double)f;
+                    unsigned long long u;
+                    memcpy(&u,&x,8);
+                    _pack_putint(p,u,8,pf->big);
+                }
+            }
+            else {
+                SQInteger i;
+                if(sq_gettype(v,arg) == OT_BOOL) {
+                    SQBool b;
+                    sq_getbool(v,arg,&b);
+                    i = b ? 1 : 0;
+                }
+                else if(SQ_FAILED(sq_getinteger(v,arg,&i)))
+                    return sq_throwerror(v,_SC("expected a number"));
+                if(op.code == '?') i = i ? 1 : 0;
+                _pack_putint(p,(unsigned long long)(long long)i,op.size,pf->big);
+            }
+        }
+    }
+    return 1;
+}
+
+static SQInteger _g_blob_unpack(HSQUIRRELVM v)
+{
+    SQPackFormat scratch;
+    SQPackFormat *pf = _pack_getformat(v,2,&scratch);
+    if(!pf) return SQ_ERROR;
+    const unsigned char *data;
+    SQInteger len, offset = 0;
+    SQUserPointer bp;
+    if(sq_gettype(v,3) == OT_STRING) {
+        const SQChar *s;
+        sq_getstring(v,3,&s);
+        data = (const unsigned char *)s;
+        len = sq_getsize(v,3);
+    }
+    else if(SQ_SUCCEEDED(sqstd_getblob(v,3,&bp))) {
+        data = (const unsigned char *)bp;
+        len = sqstd_getblobsize(v,3);
+    }
+    else return sq_throwerror(v,_SC("expected a string or a blob"));
+    if(sq_gettop(v) > 3) sq_getinteger(v,4,&offset);
+    if(offset < 0 || offset > len || pf->size > len - offset)
+        return sq_throwerror(v,_SC("not enough data for the format"));
+    const unsigned char *p = data + offset;
+    SQInteger n = 0;
+    sq_newarray(v,pf->nvalues);
+    for(SQInteger o = 0; o < pf->nops; o++) {
+        const SQPackOp &op = pf->ops[o];
+        if(op.code == 'x') {
+            p += op.count;
+            continue;
+        }
+        if(op.code == 's') {
+            sq_pushinteger(v,n++);
+            sq_pushstring(v,(const SQChar *)p,op.count);
+            sq_set(v,-3);
+            p += op.count;
+            continue;
+        }
+        for(SQInteger c = 0; c < op.count; c++, p += op.size) {
+            unsigned long long u = _pack_getint(p,op.size,pf->big);
+            sq_pushinteger(v,n++);
+            switch(op.code) {
+            case 'b': sq_pushinteger(v,(SQInteger)(signed char)u); break;
+            case 'h': sq_pushinteger(v,(SQInteger)(short)u); break;
+            case 'i': sq_pushinteger(v,(SQInteger)(SQInt32)u); break;
+            case '?': sq_pushbool(v,u ? SQTrue : SQFalse); break;
+            case 'f': {
+                unsigned int w = (unsigned int)u;
+                float f;
+                memcpy(&f,&w,4);
+                sq_pushfloat(v,(SQFloat)f);
+                break;
+            }
+            case 'd': {
+                double d;
+                memcpy(&d,&u,8);
+                sq_pushfloat(v,(SQFloat)d);
+                break;
+            }
+            //B, H, I, q and Q, which wrap if they don't fit in an SQInteger
+            default: sq_pushinteger(v,(SQInteger)u); break;
+            }
+            sq_set(v,-3);
+        }
+    }
+    return 1;
+}
+
+static SQInteger _g_blob_packsize(HSQUIRRELVM v)
+{
+    SQPackFormat scratch;
+    SQPackFormat *pf = _pack_getformat(v,2,&scratch);
+    if(!pf) return SQ_ERROR;
+    sq_pushinteger(v,pf->size);
+    return 1;
+}
+
+#define _DECL_GLOBALBLOB_FUNC(name,nparams,typecheck) {_SC(#name),_g_blob_##name,nparams,typecheck}
+static const SQRegFunction packlib_funcs[]={
+    _DECL_GLOBALBLOB_FUNC(pack,-2,_SC(".s")),
+    _DECL_GLOBALBLOB_FUNC(unpack,-3,_SC(".s.n")),
+    _DECL_GLOBALBLOB_FUNC(packsize,2,_SC(".s")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+
+SQRESULT sqstd_register_pack(HSQUIRRELVM v)
+{
+    SQInteger i = 0;
+    while(packlib_funcs[i].name != 0) {
+        const SQRegFunction &f = packlib_funcs[i];
+        sq_pushstring(v,f.name,-1);
+        sq_newclosure(v,f.f,0);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    return SQ_OK;
+}
@@ -43,6 +43,23 @@ static const SQChar *g_nnames[] =
 #define SQREX_SYMBOL_ESCAPE_CHAR ('\\')
 
 
+//Pike VM instructions. The parsed node tree is compiled to these so matching runs every
+//alternative in lockstep, one pass over the text with no recursion and no backtracking.
+#define RI_CHAR         0
+#define RI_ANY          1
+#define RI_CLASS        2 //x = first member node, y = 1 if negated
+#define RI_CCLASS       3
+#define RI_MATCH        4
+#define RI_SPLIT        5 //try x first, then y
+#define RI_JMP          6
+#define RI_SAVE         7
+#define RI_BOL          8
+#define RI_EOL          9
+#define RI_WB           10 //x = 'b' or 'B'
+
+//Bigger programs(long counted repeats) and \m use the backtracker
+#define SQREX_MAXPROG   512
+
 typedef int SQRexNodeType;
 
 typedef struct tagSQRexNode{
@@ -52,6 +69,29 @@ typedef struct tagSQRexNode{
     SQInteger next;
 }SQRexNode;
 
+typedef struct tagSQRexInst{
+    SQInteger op;
+    SQInteger x;
+    SQInteger y;
+}SQRexInst;
+
+//Threads waiting on one position of the text, highest priority first.
+//A pc is only added once per position, marks[pc] == gen says it already was.
+typedef struct tagSQRexThreadList{
+    SQInteger n;
+    SQInteger *pcs;
+    const SQChar **caps;
+    SQUnsignedInteger *marks;
+    SQUnsignedInteger gen;
+}SQRexThreadList;
+
+//Work left for sqstd_rex_addthread, a branch to follow or a capture to restore
+typedef struct tagSQRexPending{
+    SQInteger pc;
+    SQInteger slot;
+    const SQChar *old;
+}SQRexPending;
+
 struct SQRex{
     const SQChar *_eol;
     const SQChar *_bol;
@@ -66,6 +106,17 @@ struct SQRex{
     SQInteger _currsubexp;
     void *_jmpbuf;
     const SQChar **_error;
+    SQRexInst *_prog; //NULL when the pattern is matched by the backtracker
+    SQInteger _nprog;
+    SQInteger _progalloc;
+    SQInteger _nthreads;
+    SQInteger _firstchar; //literal every match starts with, or -1
+    void *_vm; //thread lists and scratch, allocated with the program so they're charged together
+    SQInteger _vmsize;
+    SQRexThreadList _lists[2];
+    SQRexPending *_pending;
+    const SQChar **_caps;
+    const SQChar **_best;
 };
 
 static SQInteger sqstd_rex_list(SQRex *exp);
@@ -550,6 +601,288 @@ static const SQChar *sqstd_rex_matchnode(SQRex* exp,SQRexNode *node,const SQChar
     return NULL;
 }
 
+#ifndef SQ_REX_BACKTRACK
+static SQInteger sqstd_rex_emit(SQRex *exp,SQInteger op,SQInteger x,SQInteger y)
+{
+    if(exp->_nprog == exp->_progalloc) {
+        SQInteger oldsize = exp->_progalloc;
+        exp->_progalloc *= 2;
+        exp->_prog = (SQRexInst *)sq_realloc(exp->_prog, oldsize * sizeof(SQRexInst), exp->_progalloc * sizeof(SQRexInst));
+    }
+    SQRexInst *i = &exp->_prog[exp->_nprog];
+    i->op = op;
+    i->x = x;
+    i->y = y;
+    return exp->_nprog++;
+}
+
+static SQBool sqstd_rex_compilenode(SQRex *exp,SQInteger n);
+
+static SQBool sqstd_rex_compilechain(SQRex *exp,SQInteger n)
+{
+    while(n != -1) {
+        if(!sqstd_rex_compilenode(exp,n)) return SQFalse;
+        n = exp->_nodes[n].next;
+    }
+    return SQTrue;
+}
+
+//Compiles one node, not the ones chained after it. False if the pattern is unsuitable.
+static SQBool sqstd_rex_compilenode(SQRex *exp,SQInteger n)
+{
+    if(exp->_nprog >= SQREX_MAXPROG) return SQFalse;
+    SQRexNode *node = &exp->_nodes[n];
+    switch(node->type) {
+    case OP_GREEDY: {
+        SQInteger p0 = (node->right >> 16)&0x0000FFFF, p1 = node->right&0x0000FFFF;
+        for(SQInteger i = 0; i < p0; i++) {
+            if(!sqstd_rex_compilenode(exp,node->left)) return SQFalse;
+        }
+        if(p1 == 0xFFFF) {
+            SQInteger loop = sqstd_rex_emit(exp,RI_SPLIT,exp->_nprog + 1,-1);
+            if(!sqstd_rex_compilenode(exp,node->left)) return SQFalse;
+            sqstd_rex_emit(exp,RI_JMP,loop,0);
+            exp->_prog[loop].y = exp->_nprog;
+        }
+        else {
+            //x{2,4} is xx(x(x)?)?, every optional copy skips straight to the end
+            SQInteger start = exp->_nprog;
+            for(SQInteger i = p0; i < p1; i++) {
+                sqstd_rex_emit(exp,RI_SPLIT,exp->_nprog + 1,-1);
+                if(!sqstd_rex_compilenode(exp,node->left)) return SQFalse;
+            }
+            for(SQInteger i = start; i < exp->_nprog; i++) {
+                if(exp->_prog[i].op == RI_SPLIT && exp->_prog[i].y == -1) exp->_prog[i].y = exp->_nprog;
+            }
+        }
+        return SQTrue;
+    }
+    case OP_OR: {
+        SQInteger split = sqstd_rex_emit(exp,RI_SPLIT,exp->_nprog + 1,-1);
+        if(!sqstd_rex_compilechain(exp,node->left)) return SQFalse;
+        SQInteger jmp = sqstd_rex_emit(exp,RI_JMP,-1,0);
+        exp->_prog[split].y = exp->_nprog;
+        if(!sqstd_rex_compilechain(exp,node->right)) return SQFalse;
+        exp->_prog[jmp].x = exp->_nprog;
+        return SQTrue;
+    }
+    case OP_EXPR: {
+        SQInteger sub = node->right;
+        sqstd_rex_emit(exp,RI_SAVE,sub * 2,0);
+        if(!sqstd_rex_compilechain(exp,node->left)) return SQFalse;
+        sqstd_rex_emit(exp,RI_SAVE,sub * 2 + 1,0);
+        return SQTrue;
+    }
+    case OP_NOCAPEXPR: return sqstd_rex_compilechain(exp,node->left);
+    case OP_DOT: sqstd_rex_emit(exp,RI_ANY,0,0); return SQTrue;
+    case OP_CLASS: sqstd_rex_emit(exp,RI_CLASS,node->left,0); return SQTrue;
+    case OP_NCLASS: sqstd_rex_emit(exp,RI_CLASS,node->left,1); return SQTrue;
+    case OP_CCLASS: sqstd_rex_emit(exp,RI_CCLASS,node->left,0); return SQTrue;
+    case OP_BOL: sqstd_rex_emit(exp,RI_BOL,0,0); return SQTrue;
+    case OP_EOL: sqstd_rex_emit(exp,RI_EOL,0,0); return SQTrue;
+    case OP_WB: sqstd_rex_emit(exp,RI_WB,node->left,0); return SQTrue;
+    case OP_MB: return SQFalse;
+    default:
+        if(node->type > MAX_CHAR) return SQFalse;
+        sqstd_rex_emit(exp,RI_CHAR,node->type,0);
+        return SQTrue;
+    }
+}
+
+static void sqstd_rex_compileprog(SQRex *exp)
+{
+    exp->_progalloc = 16;
+    exp->_prog = (SQRexInst *)sq_malloc(exp->_progalloc * sizeof(SQRexInst));
+    exp->_nprog = 0;
+    if(!sqstd_rex_compilenode(exp,exp->_first)) {
+        sq_free(exp->_prog,exp->_progalloc * sizeof(SQRexInst));
+        exp->_prog = NULL;
+        exp->_nprog = exp->_progalloc = 0;
+        return;
+    }
+    sqstd_rex_emit(exp,RI_MATCH,0,0);
+    exp->_nthreads = 0;
+    for(SQInteger i = 0; i < exp->_nprog; i++) {
+        if(exp->_prog[i].op <= RI_MATCH) exp->_nthreads++;
+    }
+    //prog[0] saves the start of the whole match
+    exp->_firstchar = exp->_prog[1].op == RI_CHAR ? exp->_prog[1].x : -1;
+}
+
+static SQBool sqstd_rex_allocvm(SQRex *exp)
+{
+    SQInteger ncap = exp->_nsubexpr * 2;
+    SQInteger size = (exp->_nprog + 1) * sizeof(SQRexPending)
+        + 2 * exp->_nthreads * sizeof(SQInteger)
+        + 2 * exp->_nprog * sizeof(SQUnsignedInteger)
+        + (2 * exp->_nthreads * ncap + 2 * ncap) * sizeof(const SQChar *);
+    unsigned char *p = (unsigned char *)sq_malloc(size);
+    if(!p) return SQFalse;
+    memset(p,0,size);
+    exp->_vm = p;
+    exp->_vmsize = size;
+    //Widest elements first so everything stays aligned
+    exp->_pending = (SQRexPending *)p;
+    p += (exp->_nprog + 1) * sizeof(SQRexPending);
+    for(SQInteger i = 0; i < 2; i++) {
+        exp->_lists[i].pcs = (SQInteger *)p;
+        p += exp->_nthreads * sizeof(SQInteger);
+    }
+    for(SQInteger i = 0; i < 2; i++) {
+        exp->_lists[i].marks = (SQUnsignedInteger *)p;
+        exp->_lists[i].gen = 0;
+        p += exp->_nprog * sizeof(SQUnsignedInteger);
+    }
+    for(SQInteger i = 0; i < 2; i++) {
+        exp->_lists[i].caps = (const SQChar **)p;
+        p += exp->_nthreads * ncap * sizeof(const SQChar *);
+    }
+    exp->_caps = (const SQChar **)p;
+    exp->_best = exp->_caps + ncap;
+    return SQTrue;
+}
+
+static void sqstd_rex_clearlist(SQRex *exp,SQRexThreadList *l)
+{
+    l->n = 0;
+    if(++l->gen == 0) {
+        memset(l->marks,0,exp->_nprog * sizeof(SQUnsignedInteger));
+        l->gen = 1;
+    }
+}
+
+//Same test as OP_WB in the backtracker, without reading outside the text
+static SQBool sqstd_rex_iswordbound(SQRex *exp,const SQChar *str)
+{
+    SQInteger c = str < exp->_eol ? *str : 0;
+    SQInteger prev = str > exp->_bol ? *(str-1) : 0;
+    SQInteger next = str + 1 < exp->_eol ? *(str+1) : 0;
+    return ((str == exp->_bol && !isspace(c))
+        || (str == exp->_eol && !isspace(prev))
+        || (!isspace(c) && isspace(next))
+        || (isspace(c) && !isspace(next))) ? SQTrue : SQFalse;
+}
+
+//Follows jumps, splits and assertions from pc at str, adding a thread to l for every
+//instruction reached that consumes a character. caps is left as it was found.
+static void sqstd_rex_addthread(SQRex *exp,SQRexThreadList *l,SQInteger pc,const SQChar **caps,const SQChar *str)
+{
+    SQRexPending *stack = exp->_pending;
+    SQInteger ncap = exp->_nsubexpr * 2;
+    SQInteger top = 0;
+    stack[top].pc = pc;
+    stack[top].slot = -1;
+    top++;
+    while(top > 0) {
+        SQRexPending *e = &stack[--top];
+        if(e->slot >= 0) {
+            caps[e->slot] = e->old;
+            continue;
+        }
+        pc = e->pc;
+        while(l->marks[pc] != l->gen) {
+            l->marks[pc] = l->gen;
+            SQRexInst *i = &exp->_prog[pc];
+            if(i->op == RI_JMP) {
+                pc = i->x;
+            }
+            else if(i->op == RI_SPLIT) {
+                stack[top].pc = i->y;
+                stack[top].slot = -1;
+                top++;
+                pc = i->x;
+            }
+            else if(i->op == RI_SAVE) {
+                stack[top].slot = i->x;
+                stack[top].old = caps[i->x];
+                top++;
+                caps[i->x] = str;
+                pc++;
+            }
+            else if(i->op == RI_BOL) {
+                if(str != exp->_bol) break;
+                pc++;
+            }
+            else if(i->op == RI_EOL) {
+                if(str != exp->_eol) break;
+                pc++;
+            }
+            else if(i->op == RI_WB) {
+                if(sqstd_rex_iswordbound(exp,str) != (i->x == 'b' ? SQTrue : SQFalse)) break;
+                pc++;
+            }
+            else {
+                l->pcs[l->n] = pc;
+                memcpy(&l->caps[l->n * ncap],caps,ncap * sizeof(const SQChar *));
+                l->n++;
+                break;
+            }
+        }
+    }
+}
+
+//Runs the program over _bol.._eol. Anchored matches must start at _bol and end at _eol,
+//otherwise the leftmost match is found, preferring greedy repeats and earlier alternatives.
+static SQBool sqstd_rex_pikeexec(SQRex *exp,SQBool anchored,const SQChar **out_begin,const SQChar **out_end)
+{
+    if(!exp->_vm && !sqstd_rex_allocvm(exp)) return SQFalse;
+    SQInteger ncap = exp->_nsubexpr * 2;
+    SQRexThreadList *cl = &exp->_lists[0], *nl = &exp->_lists[1];
+    const SQChar *str = exp->_bol, *end = exp->_eol;
+    SQBool matched = SQFalse;
+    sqstd_rex_clearlist(exp,cl);
+    for(;;) {
+        if(!matched && (!anchored || str == exp->_bol)) {
+            if(cl->n == 0 && !anchored && exp->_firstchar != -1) {
+                //Nothing is in progress, skip to where a match could start
+                while(str < end && *str != exp->_firstchar) str++;
+                if(str == end) break;
+                sqstd_rex_clearlist(exp,cl);
+            }
+            for(SQInteger i = 0; i < ncap; i++) exp->_caps[i] = NULL;
+            sqstd_rex_addthread(exp,cl,0,exp->_caps,str);
+        }
+        if(cl->n == 0 && (matched || anchored || str >= end)) break;
+        sqstd_rex_clearlist(exp,nl);
+        for(SQInteger t = 0; t < cl->n; t++) {
+            SQRexInst *i = &exp->_prog[cl->pcs[t]];
+            const SQChar **caps = &cl->caps[t * ncap];
+            SQBool ok = SQFalse;
+            switch(i->op) {
+            case RI_MATCH:
+                if(anchored && str != end) continue;
+                matched = SQTrue;
+                memcpy(exp->_best,caps,ncap * sizeof(const SQChar *));
+                //Every thread after this one has lower priority
+                t = cl->n;
+                continue;
+            case RI_CHAR: ok = (str < end && *str == i->x) ? SQTrue : SQFalse; break;
+            case RI_ANY: ok = (str < end) ? SQTrue : SQFalse; break;
+            case RI_CLASS:
+                ok = (str < end && sqstd_rex_matchclass(exp,&exp->_nodes[i->x],*str) != (i->y ? SQTrue : SQFalse)) ? SQTrue : SQFalse;
+                break;
+            case RI_CCLASS: ok = (str < end && sqstd_rex_matchcclass(i->x,*str)) ? SQTrue : SQFalse; break;
+            }
+            if(ok) sqstd_rex_addthread(exp,nl,cl->pcs[t] + 1,caps,str + 1);
+        }
+        if(str >= end) break;
+        SQRexThreadList *temp = cl;
+        cl = nl;
+        nl = temp;
+        str++;
+    }
+    if(!matched) return SQFalse;
+    for(SQInteger i = 0; i < exp->_nsubexpr; i++) {
+        const SQChar *b = exp->_best[i * 2], *e = exp->_best[i * 2 + 1];
+        exp->_matches[i].begin = (b && e) ? b : 0;
+        exp->_matches[i].len = (b && e) ? e - b : 0;
+    }
+    if(out_begin) *out_begin = exp->_best[0];
+    if(out_end) *out_end = exp->_best[1];
+    return SQTrue;
+}
+#endif
+
 /* public api */
 SQRex *sqstd_rex_compile(const SQChar *pattern,const SQChar **error)
 {
@@ -561,6 +894,10 @@ SQRex *sqstd_rex_compile(const SQChar *pattern,const SQChar **error)
     exp->_nsize = 0;
     exp->_matches = 0;
     exp->_nsubexpr = 0;
+    exp->_prog = NULL;
+    exp->_nprog = exp->_progalloc = 0;
+    exp->_vm = NULL;
+    exp->_vmsize = 0;
     exp->_first = sqstd_rex_newnode(exp,OP_EXPR);
     exp->_error = error;
     exp->_jmpbuf = sq_malloc(sizeof(jmp_buf));
@@ -588,6 +925,10 @@ SQRex *sqstd_rex_compile(const SQChar *pattern,const SQChar **error)
 #endif
         exp->_matches = (SQRexMatch *) sq_malloc(exp->_nsubexpr * sizeof(SQRexMatch));
         memset(exp->_matches,0,exp->_nsubexpr * sizeof(SQRexMatch));
+#ifndef SQ_REX_BACKTRACK
+        sqstd_rex_compileprog(exp);
+        if(exp->_prog) sqstd_rex_allocvm(exp);
+#endif
     }
     else{
         sqstd_rex_free(exp);
@@ -602,6 +943,8 @@ void sqstd_rex_free(SQRex *exp)
         if(exp->_nodes) sq_free(exp->_nodes,exp->_nallocated * sizeof(SQRexNode));
         if(exp->_jmpbuf) sq_free(exp->_jmpbuf,sizeof(jmp_buf));
         if(exp->_matches) sq_free(exp->_matches,exp->_nsubexpr * sizeof(SQRexMatch));
+        if(exp->_prog) sq_free(exp->_prog,exp->_progalloc * sizeof(SQRexInst));
+        if(exp->_vm) sq_free(exp->_vm,exp->_vmsize);
         sq_free(exp,sizeof(SQRex));
     }
 }
@@ -611,6 +954,9 @@ SQBool sqstd_rex_match(SQRex* exp,const SQChar* text)
     const SQChar* res = NULL;
     exp->_bol = text;
     exp->_eol = text + scstrlen(text);
+#ifndef SQ_REX_BACKTRACK
+    if(exp->_prog) return sqstd_rex_pikeexec(exp,SQTrue,NULL,NULL);
+#endif
     exp->_currsubexp = 0;
     res = sqstd_rex_matchnode(exp,exp->_nodes,text,NULL);
     if(res == NULL || res != exp->_eol)
@@ -625,6 +971,9 @@ SQBool sqstd_rex_searchrange(SQRex* exp,const SQChar* text_begin,const SQChar* t
     if(text_begin >= text_end) return SQFalse;
     exp->_bol = text_begin;
     exp->_eol = text_end;
+#ifndef SQ_REX_BACKTRACK
+    if(exp->_prog) return sqstd_rex_pikeexec(exp,SQFalse,out_begin,out_end);
+#endif
     do {
         cur = text_begin;
         while(node != -1) {
@@ -16,43 +16,170 @@
     if(!self || !self->IsValid())  \
         return sq_throwerror_f(v,F("the stream is invalid"));
 
+//Caps a read at what's left in the stream, so the destination can be made the right size up front
+static SQInteger _stream_readable(SQStream *self,SQInteger size)
+{
+    SQInteger left = self->Len() - self->Tell();
+    if(left >= 0 && size > left) size = left;
+    return size;
+}
+
+//Reads straight into the new blob's buffer
 SQInteger _stream_readblob(HSQUIRRELVM v)
 {
     SETUP_STREAM(v);
-    SQUserPointer data,blobp;
+    SQUserPointer blobp;
+    SQBlob *blob;
     SQInteger size,res;
     sq_getinteger(v,2,&size);
-    if(size > self->Len()) {
-        size = self->Len();
-    }
-    data = sq_getscratchpad(v,size);
-    res = self->Read(data,size);
+    size = _stream_readable(self,size);
+    if(size <= 0)
+        return sq_throwerror_f(v,F("no data left to read"));
+    blobp = sqstd_createblob(v,size);
+    res = self->Read(blobp,size);
     if(res <= 0)
         return sq_throwerror_f(v,F("no data left to read"));
-    blobp = sqstd_createblob(v,res);
-    memcpy(blobp,data,res);
+    if(res < size) {
+        sq_getinstanceup(v,-1,(SQUserPointer*)&blob,(SQUserPointer)SQSTD_BLOB_TYPE_TAG);
+        blob->Truncate(res);
+    }
     return 1;
 }
 
-
-
+//Long strings are read straight into the new string, short ones go through the stack
 SQInteger _stream_reads(HSQUIRRELVM v)
 {
     SETUP_STREAM(v);
-    const char * data;
+    SQChar small[SQ_TRANSIENT_MINLEN];
+    SQChar *data;
     SQInteger size,res;
     sq_getinteger(v,2,&size);
-    if(size > self->Len()) {
-        size = self->Len();
+    size = _stream_readable(self,size);
+    if(size <= 0)
+        return sq_throwerror_f(v,F("no data left to read"));
+    data = sq_pushnewstring(v,size);
+    if(!data) {
+        res = self->Read(small,size);
+        if(res <= 0)
+            return sq_throwerror_f(v,F("no data left to read"));
+        sq_pushstring(v,small,res);
+        return 1;
     }
-    data = sq_getscratchpad(v,size);
-    res = self->Read((void *)data,size);
+    res = self->Read(data,size);
     if(res <= 0)
         return sq_throwerror_f(v,F("no data left to read"));
-    sq_pushstring(v, data, res);
+    if(res < size) {
+        //The string's length is fixed, so a short read needs a new one
+        sq_pushstring(v,data,res);
+        sq_remove(v,-2);
+    }
     return 1;
 }
 
+//readinto(blob,[offset],[len]) reads up to len bytes into an existing blob at offset,
+//growing it if needed, and returns how many were read, 0 at the end of the stream.
+//len defaults to the rest of the blob after offset.
+SQInteger _stream_readinto(HSQUIRRELVM v)
+{
+    SETUP_STREAM(v);
+    SQBlob *blob;
+    SQInteger offset = 0,len,res;
+    if(SQ_FAILED(sq_getinstanceup(v,2,(SQUserPointer*)&blob,(SQUserPointer)SQSTD_BLOB_TYPE_TAG)) || !blob)
+        return sq_throwerror_f(v,F("invalid parameter"));
+    if(sq_gettop(v) > 2) sq_getinteger(v,3,&offset);
+    if(offset < 0 || offset > blob->Len())
+        return sq_throwerror_f(v,F("offset out of range"));
+    len = blob->Len() - offset;
+    if(sq_gettop(v) > 3) sq_getinteger(v,4,&len);
+    if(len < 0)
+        return sq_throwerror_f(v,F("invalid length"));
+    len = _stream_readable(self,len);
+    if(offset + len > blob->Len() && !blob->GrowBufOf(offset + len - blob->Len()))
+        return sq_throwerror_f(v,F("cannot resize the blob"));
+    res = len > 0 ? self->Read(((unsigned char *)blob->GetBuf()) + offset,len) : 0;
+    sq_pushinteger(v,res > 0 ? res : 0);
+    return 1;
+}
+
+//Pushes the next line without its line ending, or null at the end of the stream.
+//Most lines fit on the stack, longer ones grow a heap buffer.
+static SQRESULT _stream_pushline(HSQUIRRELVM v,SQStream *self)
+{
+    SQChar small[128];
+    SQChar *buf = small;
+    SQInteger cap = sizeof(small), len = 0, n;
+    while((n = self->ReadUntil(buf + len,cap - len,'\n')) > 0) {
+        len += n;
+        if(buf[len - 1] == '\n') break;
+        if(len == cap) {
+            SQChar *nbuf = (SQChar *)sq_malloc(cap * 2);
+            memcpy(nbuf,buf,len);
+            if(buf != small) sq_free(buf,cap);
+            buf = nbuf;
+            cap *= 2;
+        }
+    }
+    if(len == 0) sq_pushnull(v);
+    else {
+        if(buf[len - 1] == '\n') len--;
+        if(len > 0 && buf[len - 1] == '\r') len--;
+        sq_pushstring(v,buf,len);
+    }
+    if(buf != small) sq_free(buf,cap);
+    return SQ_OK;
+}
+
+SQInteger _stream_readline(HSQUIRRELVM v)
+{
+    SETUP_STREAM(v);
+    _stream_pushline(v,self);
+    return 1;
+}
+
+//lines() is for foreach(i,line in f.lines()), reading a line per iteration with i counting from 0.
+//The iterator keeps the stream and the current line in its members.
+SQInteger _stream_lines(HSQUIRRELVM v)
+{
+    SETUP_STREAM(v);
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_lines"),-1);
+    if(SQ_FAILED(sq_get(v,-2)))
+        return sq_throwerror_f(v,F("the lines class is missing"));
+    sq_createinstance(v,-1);
+    sq_pushstring(v,_SC("_stream"),-1);
+    sq_push(v,1);
+    sq_set(v,-3);
+    return 1;
+}
+
+static SQInteger _lines__nexti(HSQUIRRELVM v)
+{
+    SQStream *self = NULL;
+    SQInteger idx = 0;
+    sq_pushstring(v,_SC("_stream"),-1);
+    if(SQ_FAILED(sq_get(v,1))
+        || SQ_FAILED(sq_getinstanceup(v,-1,(SQUserPointer*)&self,(SQUserPointer)((SQUnsignedInteger)SQSTD_STREAM_TYPE_TAG)))
+        || !self || !self->IsValid())
+        return sq_throwerror_f(v,F("the stream is invalid"));
+    _stream_pushline(v,self);
+    if(sq_gettype(v,-1) == OT_NULL) return 1;
+    sq_pushstring(v,_SC("_line"),-1);
+    sq_push(v,-2);
+    sq_set(v,1);
+    if(sq_gettype(v,2) != OT_NULL) {
+        sq_getinteger(v,2,&idx);
+        idx++;
+    }
+    sq_pushinteger(v,idx);
+    return 1;
+}
+
+static SQInteger _lines__get(HSQUIRRELVM v)
+{
+    sq_pushstring(v,_SC("_line"),-1);
+    if(SQ_FAILED(sq_get(v,1))) return SQ_ERROR;
+    return 1;
+}
 
 #define SAFE_READN(ptr,len) { \
     if(self->Read(ptr,len) != len) return sq_throwerror_f(v,F("io error")); \
@@ -278,6 +405,9 @@ static const SQRegFunction _stream_methods[] = {
     _DECL_STREAM_FUNC(readblob,2,_SC("xn")),
     _DECL_STREAM_FUNC(reads,2,_SC("xn")),
     _DECL_STREAM_FUNC(readn,2,_SC("xn")),
+    _DECL_STREAM_FUNC(readinto,-2,_SC("xxnn")),
+    _DECL_STREAM_FUNC(readline,1,_SC("x")),
+    _DECL_STREAM_FUNC(lines,1,_SC("x")),
     _DECL_STREAM_FUNC(writeblob,-2,_SC("xx")),
     _DECL_STREAM_FUNC(writes,-2,_SC("xs")),
 
@@ -309,6 +439,23 @@ void init_streamclass(HSQUIRRELVM v)
             i++;
         }
         sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("std_lines"),-1);
+        sq_newclass(v,SQFalse);
+        sq_pushstring(v,_SC("_stream"),-1);
+        sq_pushnull(v);
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("_line"),-1);
+        sq_pushnull(v);
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("_nexti"),-1);
+        sq_newclosure(v,_lines__nexti,0);
+        sq_setparamscheck(v,2,_SC("x"));
+        sq_newslot(v,-3,SQFalse);
+        sq_pushstring(v,_SC("_get"),-1);
+        sq_newclosure(v,_lines__get,0);
+        sq_setparamscheck(v,2,_SC("x"));
+        sq_newslot(v,-3,SQFalse);
+        sq_newslot(v,-3,SQFalse);
         sq_pushroottable(v);
         sq_pushstring(v,_SC("stream"),-1);
         sq_pushstring(v,_SC("std_stream"),-1);
@@ -5,6 +5,8 @@
 SQInteger _stream_readblob(HSQUIRRELVM v);
 SQInteger _stream_readline(HSQUIRRELVM v);
 SQInteger _stream_readn(HSQUIRRELVM v);
+SQInteger _stream_readinto(HSQUIRRELVM v);
+SQInteger _stream_lines(HSQUIRRELVM v);
 SQInteger _stream_writeblob(HSQUIRRELVM v);
 SQInteger _stream_writen(HSQUIRRELVM v);
 SQInteger _stream_seek(HSQUIRRELVM v);
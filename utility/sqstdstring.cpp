@@ -362,14 +362,109 @@ static SQInteger _string_endswith(HSQUIRRELVM v)
     return 1;
 }
 
+//Compiled patterns are shared through a small LRU cache keyed by the pattern text, so
+//regexp() in a loop only compiles once. An entry lives while the cache or any instance
+//holds it. The cache is a userdata in the registry, so each shared state has its own and
+//sq_close() frees it. Cached entries outlive the program that made them, so they aren't
+//charged to any memory account, and patterns longer than SQSTD_REX_CACHEMAX aren't cached.
+#define SQSTD_REX_CACHE 8
+#define SQSTD_REX_CACHEMAX 256
+
+struct SQRexCacheEntry {
+    SQRex *rex;
+    SQChar *pattern;
+    SQInteger len;
+    SQInteger refs;
+    SQUnsignedInteger stamp;
+};
+
+struct SQRexCache {
+    SQRexCacheEntry *entries[SQSTD_REX_CACHE];
+    SQUnsignedInteger clock;
+};
+
+static void _rex_release(SQRexCacheEntry *e)
+{
+    if(--e->refs > 0) return;
+    sqstd_rex_free(e->rex);
+    sq_free(e->pattern,(e->len + 1) * sizeof(SQChar));
+    sq_free(e,sizeof(SQRexCacheEntry));
+}
+
+static SQRexCacheEntry *_rex_new(const SQChar *pattern,SQInteger len,const SQChar **error)
+{
+    SQRex *rex = sqstd_rex_compile(pattern,error);
+    if(!rex) return NULL;
+    SQRexCacheEntry *e = (SQRexCacheEntry *)sq_malloc(sizeof(SQRexCacheEntry));
+    e->rex = rex;
+    e->len = len;
+    e->pattern = (SQChar *)sq_malloc((len + 1) * sizeof(SQChar));
+    memcpy(e->pattern,pattern,sq_rsl(len + 1));
+    e->refs = 1;
+    e->stamp = 0;
+    return e;
+}
+
+static SQInteger _rex_cache_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    SQRexCache *c = (SQRexCache *)p;
+    for(SQInteger i = 0; i < SQSTD_REX_CACHE; i++) {
+        if(c->entries[i]) _rex_release(c->entries[i]);
+    }
+    return 1;
+}
+
+static SQRexCache *_rex_getcache(HSQUIRRELVM v)
+{
+    SQRexCache *c = NULL;
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_rexcache"),-1);
+    if(SQ_SUCCEEDED(sq_rawget(v,-2))) {
+        sq_getuserdata(v,-1,(SQUserPointer *)&c,NULL);
+        sq_pop(v,1);
+    }
+    sq_pop(v,1);
+    return c;
+}
+
+static SQRexCacheEntry *_rex_get(HSQUIRRELVM v,const SQChar *pattern,SQInteger len,const SQChar **error)
+{
+    SQRexCache *c = len <= SQSTD_REX_CACHEMAX ? _rex_getcache(v) : NULL;
+    if(!c) return _rex_new(pattern,len,error);
+    SQInteger victim = 0;
+    for(SQInteger i = 0; i < SQSTD_REX_CACHE; i++) {
+        SQRexCacheEntry *e = c->entries[i];
+        if(!e) {
+            victim = i;
+            continue;
+        }
+        if(e->len == len && memcmp(e->pattern,pattern,sq_rsl(len)) == 0) {
+            e->stamp = ++c->clock;
+            e->refs++;
+            return e;
+        }
+        if(c->entries[victim] && e->stamp < c->entries[victim]->stamp) victim = i;
+    }
+    SQMemAccount *prev = sq_setcurrentmemaccount(NULL);
+    SQRexCacheEntry *e = _rex_new(pattern,len,error);
+    if(e) {
+        e->refs = 2;
+        e->stamp = ++c->clock;
+        if(c->entries[victim]) _rex_release(c->entries[victim]);
+        c->entries[victim] = e;
+    }
+    sq_setcurrentmemaccount(prev);
+    return e;
+}
+
 #define SETUP_REX(v) \
-    SQRex *self = NULL; \
-    sq_getinstanceup(v,1,(SQUserPointer *)&self,0);
+    SQRexCacheEntry *entry = NULL; \
+    sq_getinstanceup(v,1,(SQUserPointer *)&entry,0); \
+    SQRex *self = entry->rex;
 
 static SQInteger _rexobj_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
 {
-    SQRex *self = ((SQRex *)p);
-    sqstd_rex_free(self);
+    _rex_release((SQRexCacheEntry *)p);
     return 1;
 }
 
@@ -447,7 +542,7 @@ static SQInteger _regexp_constructor(HSQUIRRELVM v)
 {
     const SQChar *error,*pattern;
     sq_getstring(v,2,&pattern);
-    SQRex *rex = sqstd_rex_compile(pattern,&error);
+    SQRexCacheEntry *rex = _rex_get(v,pattern,sq_getsize(v,2),&error);
     if(!rex) return sq_throwerror(v,error);
     sq_setinstanceup(v,1,rex);
     sq_setreleasehook(v,1,_rexobj_releasehook);
@@ -472,6 +567,160 @@ static const SQRegFunction rexobj_funcs[]={
 };
 #undef _DECL_REX_FUNC
 
+//stringbuilder, a growable buffer so building a long string doesn't copy it on every append
+
+#define SQSTD_STRINGBUILDER_MINSIZE 64
+
+struct SQStringBuilder {
+    SQChar *buf;
+    SQInteger len;
+    SQInteger allocated;
+};
+
+#define SETUP_SB(v) \
+    SQStringBuilder *self = NULL; \
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer *)&self,0)) || !self) \
+        return sq_throwerror(v,_SC("invalid stringbuilder"));
+
+static SQInteger _sbobj_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    SQStringBuilder *self = (SQStringBuilder *)p;
+    sq_free(self->buf,sq_rsl(self->allocated));
+    sq_free(self,sizeof(SQStringBuilder));
+    return 1;
+}
+
+static void _sb_append(SQStringBuilder *self,const SQChar *s,SQInteger len)
+{
+    if(self->len + len > self->allocated) {
+        SQInteger n = self->allocated * 2;
+        if(n < self->len + len) n = self->len + len;
+        self->buf = (SQChar *)sq_realloc(self->buf,sq_rsl(self->allocated),sq_rsl(n));
+        self->allocated = n;
+    }
+    memcpy(self->buf + self->len,s,sq_rsl(len));
+    self->len += len;
+}
+
+//Appends the value at idx, converted like tostring() would
+static SQRESULT _sb_appendobj(HSQUIRRELVM v,SQStringBuilder *self,SQInteger idx)
+{
+    const SQChar *s;
+    if(sq_gettype(v,idx) == OT_STRING) {
+        sq_getstring(v,idx,&s);
+        _sb_append(self,s,sq_getsize(v,idx));
+        return SQ_OK;
+    }
+    if(SQ_FAILED(sq_tostring(v,idx))) return SQ_ERROR;
+    sq_getstring(v,-1,&s);
+    _sb_append(self,s,sq_getsize(v,-1));
+    sq_poptop(v);
+    return SQ_OK;
+}
+
+static SQInteger _stringbuilder_constructor(HSQUIRRELVM v)
+{
+    SQInteger size = SQSTD_STRINGBUILDER_MINSIZE;
+    if(sq_gettop(v) > 1) sq_getinteger(v,2,&size);
+    if(size < SQSTD_STRINGBUILDER_MINSIZE) size = SQSTD_STRINGBUILDER_MINSIZE;
+    SQStringBuilder *self = (SQStringBuilder *)sq_malloc(sizeof(SQStringBuilder));
+    self->buf = (SQChar *)sq_malloc(sq_rsl(size));
+    self->len = 0;
+    self->allocated = size;
+    sq_setinstanceup(v,1,self);
+    sq_setreleasehook(v,1,_sbobj_releasehook);
+    return 0;
+}
+
+//All the appending methods return the builder so they can be chained
+static SQInteger _stringbuilder_append(HSQUIRRELVM v)
+{
+    SETUP_SB(v);
+    SQInteger top = sq_gettop(v);
+    for(SQInteger i = 2; i <= top; i++) {
+        if(SQ_FAILED(_sb_appendobj(v,self,i))) return SQ_ERROR;
+    }
+    sq_push(v,1);
+    return 1;
+}
+
+static SQInteger _stringbuilder_appendf(HSQUIRRELVM v)
+{
+    SETUP_SB(v);
+    SQChar *dest = NULL;
+    SQInteger length = 0;
+    if(SQ_FAILED(sqstd_format(v,2,&length,&dest)))
+        return -1;
+    _sb_append(self,dest,length);
+    sq_push(v,1);
+    return 1;
+}
+
+//join(array, [separator]) appends every element of the array, with the separator between them
+static SQInteger _stringbuilder_join(HSQUIRRELVM v)
+{
+    SETUP_SB(v);
+    const SQChar *sep = _SC("");
+    SQInteger seplen = 0;
+    if(sq_gettop(v) > 2) {
+        sq_getstring(v,3,&sep);
+        seplen = sq_getsize(v,3);
+    }
+    SQInteger n = sq_getsize(v,2);
+    for(SQInteger i = 0; i < n; i++) {
+        if(i > 0) _sb_append(self,sep,seplen);
+        sq_pushinteger(v,i);
+        if(SQ_FAILED(sq_rawget(v,2))) return SQ_ERROR;
+        if(SQ_FAILED(_sb_appendobj(v,self,-1))) return SQ_ERROR;
+        sq_poptop(v);
+    }
+    sq_push(v,1);
+    return 1;
+}
+
+static SQInteger _stringbuilder_tostring(HSQUIRRELVM v)
+{
+    SETUP_SB(v);
+    sq_pushstring(v,self->buf,self->len);
+    return 1;
+}
+
+static SQInteger _stringbuilder_len(HSQUIRRELVM v)
+{
+    SETUP_SB(v);
+    sq_pushinteger(v,self->len);
+    return 1;
+}
+
+static SQInteger _stringbuilder_clear(HSQUIRRELVM v)
+{
+    SETUP_SB(v);
+    self->len = 0;
+    sq_push(v,1);
+    return 1;
+}
+
+static SQInteger _stringbuilder__typeof(HSQUIRRELVM v)
+{
+    sq_pushstring(v,_SC("stringbuilder"),-1);
+    return 1;
+}
+
+#define _DECL_SB_FUNC(name,nparams,pmask) {_SC(#name),_stringbuilder_##name,nparams,pmask}
+static const SQRegFunction sbobj_funcs[]={
+    _DECL_SB_FUNC(constructor,-1,_SC("xn")),
+    _DECL_SB_FUNC(append,-1,_SC("x")),
+    _DECL_SB_FUNC(appendf,-2,_SC("xs")),
+    _DECL_SB_FUNC(join,-2,_SC("xas")),
+    _DECL_SB_FUNC(tostring,1,_SC("x")),
+    _DECL_SB_FUNC(len,1,_SC("x")),
+    _DECL_SB_FUNC(clear,1,_SC("x")),
+    {_SC("_tostring"),_stringbuilder_tostring,1,_SC("x")},
+    _DECL_SB_FUNC(_typeof,1,_SC("x")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+#undef _DECL_SB_FUNC
+
 #define _DECL_FUNC(name,nparams,pmask) {_SC(#name),_string_##name,nparams,pmask}
 static const SQRegFunction stringlib_funcs[]={
     _DECL_FUNC(format,-2,_SC(".s")),
@@ -488,13 +737,13 @@ static const SQRegFunction stringlib_funcs[]={
 #undef _DECL_FUNC
 
 
-SQInteger sqstd_register_stringlib(HSQUIRRELVM v)
+static void _register_class(HSQUIRRELVM v,const SQChar *name,const SQRegFunction *funcs)
 {
-    sq_pushstring(v,_SC("regexp"),-1);
+    sq_pushstring(v,name,-1);
     sq_newclass(v,SQFalse);
     SQInteger i = 0;
-    while(rexobj_funcs[i].name != 0) {
-        const SQRegFunction &f = rexobj_funcs[i];
+    while(funcs[i].name != 0) {
+        const SQRegFunction &f = funcs[i];
         sq_pushstring(v,f.name,-1);
         sq_newclosure(v,f.f,0);
         sq_setparamscheck(v,f.nparamscheck,f.typemask);
@@ -503,8 +752,22 @@ SQInteger sqstd_register_stringlib(HSQUIRRELVM v)
         i++;
     }
     sq_newslot(v,-3,SQFalse);
+}
 
-    i = 0;
+SQInteger sqstd_register_stringlib(HSQUIRRELVM v)
+{
+    sq_pushregistrytable(v);
+    sq_pushstring(v,_SC("std_rexcache"),-1);
+    SQRexCache *c = (SQRexCache *)sq_newuserdata(v,sizeof(SQRexCache));
+    memset(c,0,sizeof(SQRexCache));
+    sq_setreleasehook(v,-1,_rex_cache_releasehook);
+    sq_rawset(v,-3);
+    sq_pop(v,1);
+
+    _register_class(v,_SC("regexp"),rexobj_funcs);
+    _register_class(v,_SC("stringbuilder"),sbobj_funcs);
+
+    SQInteger i = 0;
     while(stringlib_funcs[i].name!=0)
     {
         sq_pushstring(v,stringlib_funcs[i].name,-1);
@@ -0,0 +1,617 @@
+/* see copyright notice in squirrel.h */
+#include <new>
+#include <squirrel.h>
+#include <sqstdio.h>
+#include <string.h>
+#include <sqstdblob.h>
+#include "sqstdstream.h"
+#include "sqstdblobimpl.h"
+
+//Typed arrays, Int16Array(n) and friends. They are views of blob storage, so a buffer of samples costs
+//2 or 4 bytes an element instead of a whole object, and slicing one or viewing an existing blob copies
+//nothing. The element-wise ops are plain loops over the native type, which the compiler can
+//vectorize on hosts. Integer results saturate at the limits of the type instead of wrapping.
+
+enum SQTypedArrayType {
+    SQTA_INT8,
+    SQTA_UINT8,
+    SQTA_INT16,
+    SQTA_UINT16,
+    SQTA_INT32,
+    SQTA_FLOAT32,
+    SQTA_NTYPES
+};
+
+static const struct {
+    const SQChar *name;
+    SQInteger size;
+} _ta_types[SQTA_NTYPES] = {
+    {_SC("Int8Array"),1},
+    {_SC("Uint8Array"),1},
+    {_SC("Int16Array"),2},
+    {_SC("Uint16Array"),2},
+    {_SC("Int32Array"),4},
+    {_SC("Float32Array"),4}
+};
+
+struct SQTypedArray {
+    SQBlob *blob;
+    SQInteger type;
+    SQInteger offset; //In bytes
+    SQInteger length; //In elements
+};
+
+//Integer sums are added up in 64 bits, but SQInteger may only have 32. Ones that don't fit
+//come back as a float instead of wrapping.
+static void _ta_pushsum(HSQUIRRELVM v,long long s)
+{
+    if((long long)(SQInteger)s == s) sq_pushinteger(v,(SQInteger)s);
+    else sq_pushfloat(v,(SQFloat)s);
+}
+
+//AddAcc and MulAcc are wide enough that adding or multiplying by an operand clamped to Limit
+//can't overflow before saturating.
+template<typename T> struct SQTATraits {};
+
+#define SQTA_INTTRAITS(T,LO,HI,ADDACC,MULACC) \
+template<> struct SQTATraits<T> { \
+    typedef ADDACC AddAcc; \
+    typedef MULACC MulAcc; \
+    typedef long long Sum; \
+    static const bool isfloat = false; \
+    static T FromInt(long long x) { return x < (LO) ? (T)(LO) : (x > (HI) ? (T)(HI) : (T)x); } \
+    static T FromFloat(SQFloat f) { return f < (LO) ? (T)(LO) : (f > (HI) ? (T)(HI) : (f == f ? (T)f : 0)); } \
+    static long long Limit(SQInteger x) { \
+        const long long lim = (long long)(HI) - (long long)(LO); \
+        return x < -lim ? -lim : (x > lim ? lim : x); } \
+    static T Sat(long long x) { return FromInt(x); } \
+    static void Push(HSQUIRRELVM v,Sum s) { _ta_pushsum(v,s); } \
+};
+
+SQTA_INTTRAITS(signed char,-128,127,SQInt32,SQInt32)
+SQTA_INTTRAITS(unsigned char,0,255,SQInt32,SQInt32)
+SQTA_INTTRAITS(short,-32768,32767,SQInt32,long long)
+SQTA_INTTRAITS(unsigned short,0,65535,SQInt32,long long)
+SQTA_INTTRAITS(SQInt32,-2147483647LL - 1,2147483647LL,long long,long long)
+
+template<> struct SQTATraits<float> {
+    typedef float AddAcc;
+    typedef float MulAcc;
+    typedef SQFloat Sum;
+    static const bool isfloat = true;
+    static float FromInt(long long x) { return (float)x; }
+    static float FromFloat(SQFloat f) { return (float)f; }
+    static float Limit(SQInteger x) { return (float)x; }
+    static float Sat(float x) { return x; }
+    static void Push(HSQUIRRELVM v,Sum s) { sq_pushfloat(v,s); }
+};
+
+#define SETUP_TA(v) \
+    SQTypedArray *self = NULL; \
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_TYPEDARRAY_TYPE_TAG)) || !self) \
+        return sq_throwerror(v,_SC("invalid typed array")); \
+    void *data = _ta_data(self); \
+    if(!data) \
+        return sq_throwerror(v,_SC("the blob was resized out from under the typed array"));
+
+//Calls the version of fn for the array's element type
+#define SQTA_DISPATCH(fn) \
+    switch(self->type) { \
+    case SQTA_INT8: return fn<signed char>(v,self,(signed char *)data); \
+    case SQTA_UINT8: return fn<unsigned char>(v,self,(unsigned char *)data); \
+    case SQTA_INT16: return fn<short>(v,self,(short *)data); \
+    case SQTA_UINT16: return fn<unsigned short>(v,self,(unsigned short *)data); \
+    case SQTA_INT32: return fn<SQInt32>(v,self,(SQInt32 *)data); \
+    default: return fn<float>(v,self,(float *)data); \
+    }
+
+//NULL if the blob has shrunk past the end of the view
+static void *_ta_data(SQTypedArray *self)
+{
+    static unsigned char empty;
+    if(self->offset + self->length * _ta_types[self->type].size > self->blob->Len()) return NULL;
+    if(self->length == 0) return &empty;
+    return ((unsigned char *)self->blob->GetBuf()) + self->offset;
+}
+
+static SQRESULT _ta_getother(HSQUIRRELVM v,SQInteger idx,SQTypedArray *self,SQTypedArray *&other,void *&odata)
+{
+    if(SQ_FAILED(sq_getinstanceup(v,idx,(SQUserPointer*)&other,(SQUserPointer)SQSTD_TYPEDARRAY_TYPE_TAG)) || !other)
+        return sq_throwerror(v,_SC("expected a number or a typed array"));
+    odata = _ta_data(other);
+    if(!odata)
+        return sq_throwerror(v,_SC("the blob was resized out from under the typed array"));
+    if(other->length != self->length)
+        return sq_throwerror(v,_SC("the typed arrays have different lengths"));
+    return SQ_OK;
+}
+
+static long long _ta_geti(SQTypedArray *ta,void *data,SQInteger i)
+{
+    switch(ta->type) {
+    case SQTA_INT8: return ((signed char *)data)[i];
+    case SQTA_UINT8: return ((unsigned char *)data)[i];
+    case SQTA_INT16: return ((short *)data)[i];
+    case SQTA_UINT16: return ((unsigned short *)data)[i];
+    case SQTA_INT32: return ((SQInt32 *)data)[i];
+    default: return (long long)((float *)data)[i];
+    }
+}
+
+static SQFloat _ta_getf(SQTypedArray *ta,void *data,SQInteger i)
+{
+    if(ta->type == SQTA_FLOAT32) return ((float *)data)[i];
+    return (SQFloat)_ta_geti(ta,data,i);
+}
+
+//The number at idx converted to T
+template<typename T> static SQRESULT _ta_getnumber(HSQUIRRELVM v,SQInteger idx,T &out)
+{
+    SQInteger i;
+    SQFloat f;
+    switch(sq_gettype(v,idx)) {
+    case OT_INTEGER:
+    case OT_BOOL:
+        sq_getinteger(v,idx,&i);
+        out = SQTATraits<T>::FromInt(i);
+        return SQ_OK;
+    case OT_FLOAT:
+        sq_getfloat(v,idx,&f);
+        out = SQTATraits<T>::FromFloat(f);
+        return SQ_OK;
+    default:
+        return sq_throwerror(v,_SC("typed arrays can only hold numbers"));
+    }
+}
+
+static SQInteger _ta_releasehook(SQUserPointer p, SQInteger SQ_UNUSED_ARG(size))
+{
+    SQTypedArray *self = (SQTypedArray *)p;
+    _blob_releasehook(self->blob,0);
+    sq_free(self,sizeof(SQTypedArray));
+    return 1;
+}
+
+//Sets up the instance at idx as a view of blob, taking over one reference to it
+static SQRESULT _ta_setup(HSQUIRRELVM v,SQInteger idx,SQBlob *blob,SQInteger type,SQInteger offset,SQInteger length)
+{
+    SQTypedArray *self = (SQTypedArray *)sq_malloc(sizeof(SQTypedArray));
+    self->blob = blob;
+    self->type = type;
+    self->offset = offset;
+    self->length = length;
+    if(SQ_FAILED(sq_setinstanceup(v,idx,self))) {
+        _ta_releasehook(self,0);
+        return sq_throwerror(v,_SC("cannot create typed array"));
+    }
+    sq_setreleasehook(v,idx,_ta_releasehook);
+    return SQ_OK;
+}
+
+static SQBlob *_ta_newblob(SQInteger size)
+{
+    return new (sq_malloc(sizeof(SQBlob)))SQBlob(size);
+}
+
+template<typename T> static SQInteger _ta_fromarray(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    for(SQInteger i = 0; i < self->length; i++) {
+        sq_pushinteger(v,i);
+        if(SQ_FAILED(sq_get(v,2))) return SQ_ERROR;
+        if(SQ_FAILED(_ta_getnumber<T>(v,-1,data[i]))) return SQ_ERROR;
+        sq_poptop(v);
+    }
+    return 0;
+}
+
+//Int16Array(length), Int16Array(array) or Int16Array(blob,[byteoffset],[length]).
+//The element type is the constructor's free variable, after the arguments on the stack.
+static SQInteger _typedarray_constructor(HSQUIRRELVM v)
+{
+    SQInteger nargs = sq_gettop(v) - 1, type, offset = 0, length = 0;
+    sq_getinteger(v,nargs + 1,&type);
+    SQInteger size = _ta_types[type].size;
+    SQBlob *blob = NULL;
+    if(nargs >= 2 && sq_gettype(v,2) == OT_INSTANCE
+        && SQ_SUCCEEDED(sq_getinstanceup(v,2,(SQUserPointer*)&blob,(SQUserPointer)SQSTD_BLOB_TYPE_TAG)) && blob) {
+        if(nargs >= 3) sq_getinteger(v,3,&offset);
+        if(offset < 0 || offset > blob->Len())
+            return sq_throwerror(v,_SC("offset out of range"));
+        //Elements have to be aligned, the ESP32 can't load them otherwise
+        if(offset % size)
+            return sq_throwerror(v,_SC("the offset must be a multiple of the element size"));
+        length = (blob->Len() - offset) / size;
+        if(nargs >= 4) {
+            sq_getinteger(v,4,&length);
+            if(length < 0 || length > (blob->Len() - offset) / size)
+                return sq_throwerror(v,_SC("length out of range"));
+        }
+        blob->AddRef();
+        return _ta_setup(v,1,blob,type,offset,length);
+    }
+    if(nargs >= 2) {
+        if(sq_gettype(v,2) == OT_ARRAY) length = sq_getsize(v,2);
+        else if(sq_gettype(v,2) & SQOBJECT_NUMERIC) sq_getinteger(v,2,&length);
+        else return sq_throwerror(v,_SC("expected a length, an array or a blob"));
+    }
+    if(length < 0)
+        return sq_throwerror(v,_SC("cannot create a typed array with negative length"));
+    if(SQ_FAILED(_ta_setup(v,1,_ta_newblob(length * size),type,0,length)))
+        return SQ_ERROR;
+    if(sq_gettype(v,2) == OT_ARRAY) {
+        SETUP_TA(v);
+        SQTA_DISPATCH(_ta_fromarray);
+    }
+    return 0;
+}
+
+static SQInteger _typedarray__cloned(HSQUIRRELVM v)
+{
+    SQTypedArray *other = NULL;
+    if(SQ_FAILED(sq_getinstanceup(v,2,(SQUserPointer*)&other,(SQUserPointer)SQSTD_TYPEDARRAY_TYPE_TAG)) || !other)
+        return SQ_ERROR;
+    void *odata = _ta_data(other);
+    if(!odata)
+        return sq_throwerror(v,_SC("the blob was resized out from under the typed array"));
+    SQInteger bytes = other->length * _ta_types[other->type].size;
+    SQBlob *blob = _ta_newblob(bytes);
+    memcpy(blob->GetBuf(),odata,bytes);
+    return _ta_setup(v,1,blob,other->type,0,other->length);
+}
+
+static SQInteger _typedarray_len(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    sq_pushinteger(v,self->length);
+    return 1;
+}
+
+template<typename T> static SQInteger _ta_get(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    SQInteger idx;
+    sq_getinteger(v,2,&idx);
+    if(idx < 0 || idx >= self->length)
+        return sq_throwerror(v,_SC("index out of range"));
+    SQTATraits<T>::Push(v,data[idx]);
+    return 1;
+}
+
+static SQInteger _typedarray__get(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    if((sq_gettype(v,2) & SQOBJECT_NUMERIC) == 0) {
+        sq_pushnull(v);
+        return sq_throwobject(v);
+    }
+    SQTA_DISPATCH(_ta_get);
+}
+
+template<typename T> static SQInteger _ta_set(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    SQInteger idx;
+    sq_getinteger(v,2,&idx);
+    if(idx < 0 || idx >= self->length)
+        return sq_throwerror(v,_SC("index out of range"));
+    if(SQ_FAILED(_ta_getnumber<T>(v,3,data[idx]))) return SQ_ERROR;
+    sq_push(v,3);
+    return 1;
+}
+
+static SQInteger _typedarray__set(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_set);
+}
+
+static SQInteger _typedarray__nexti(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    if(sq_gettype(v,2) == OT_NULL) {
+        if(self->length > 0) sq_pushinteger(v,0);
+        else sq_pushnull(v);
+        return 1;
+    }
+    SQInteger idx;
+    if(SQ_SUCCEEDED(sq_getinteger(v,2,&idx))) {
+        if(idx + 1 < self->length) {
+            sq_pushinteger(v,idx + 1);
+            return 1;
+        }
+        sq_pushnull(v);
+        return 1;
+    }
+    return sq_throwerror(v,_SC("internal error (_nexti) wrong argument type"));
+}
+
+static SQInteger _typedarray__typeof(HSQUIRRELVM v)
+{
+    SQTypedArray *self = NULL;
+    if(SQ_FAILED(sq_getinstanceup(v,1,(SQUserPointer*)&self,(SQUserPointer)SQSTD_TYPEDARRAY_TYPE_TAG)) || !self)
+        return sq_throwerror(v,_SC("invalid typed array"));
+    sq_pushstring(v,_ta_types[self->type].name,-1);
+    return 1;
+}
+
+//slice(start,[end]) is a new view of the same storage, negative indices count from the end like array.slice
+static SQInteger _typedarray_slice(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQInteger start,end = self->length;
+    sq_getinteger(v,2,&start);
+    if(sq_gettop(v) > 2) sq_getinteger(v,3,&end);
+    if(start < 0) start += self->length;
+    if(end < 0) end += self->length;
+    if(start < 0 || end > self->length || start > end)
+        return sq_throwerror(v,_SC("slice out of range"));
+    sq_getclass(v,1);
+    sq_createinstance(v,-1);
+    sq_remove(v,-2);
+    self->blob->AddRef();
+    if(SQ_FAILED(_ta_setup(v,-1,self->blob,self->type,self->offset + start * _ta_types[self->type].size,end - start)))
+        return SQ_ERROR;
+    return 1;
+}
+
+template<typename T> static SQInteger _ta_toarray(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    sq_newarray(v,self->length);
+    for(SQInteger i = 0; i < self->length; i++) {
+        sq_pushinteger(v,i);
+        SQTATraits<T>::Push(v,data[i]);
+        sq_set(v,-3);
+    }
+    return 1;
+}
+
+static SQInteger _typedarray_toarray(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_toarray);
+}
+
+//The in place ops below return the array so they can be chained
+
+template<typename T> static SQInteger _ta_fill(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    T val;
+    if(SQ_FAILED(_ta_getnumber<T>(v,2,val))) return SQ_ERROR;
+    for(SQInteger i = 0; i < self->length; i++) data[i] = val;
+    sq_push(v,1);
+    return 1;
+}
+
+static SQInteger _typedarray_fill(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_fill);
+}
+
+//add(x), x is a number or a typed array of the same length
+template<typename T> static SQInteger _ta_add(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    typedef SQTATraits<T> Tr;
+    typedef typename Tr::AddAcc Acc;
+    SQInteger n = self->length;
+    if(sq_gettype(v,2) == OT_INTEGER) {
+        SQInteger x;
+        sq_getinteger(v,2,&x);
+        Acc a = (Acc)Tr::Limit(x);
+        for(SQInteger i = 0; i < n; i++) data[i] = Tr::Sat(data[i] + a);
+    }
+    else if(sq_gettype(v,2) == OT_FLOAT) {
+        SQFloat f;
+        sq_getfloat(v,2,&f);
+        for(SQInteger i = 0; i < n; i++) data[i] = Tr::FromFloat(data[i] + f);
+    }
+    else {
+        SQTypedArray *other;
+        void *odata;
+        if(SQ_FAILED(_ta_getother(v,2,self,other,odata))) return SQ_ERROR;
+        if(other->type == self->type) {
+            const T *o = (const T *)odata;
+            for(SQInteger i = 0; i < n; i++) data[i] = Tr::Sat((Acc)data[i] + (Acc)o[i]);
+        }
+        else if(Tr::isfloat || other->type == SQTA_FLOAT32) {
+            for(SQInteger i = 0; i < n; i++) data[i] = Tr::FromFloat(data[i] + _ta_getf(other,odata,i));
+        }
+        else {
+            for(SQInteger i = 0; i < n; i++) data[i] = Tr::FromInt(data[i] + _ta_geti(other,odata,i));
+        }
+    }
+    sq_push(v,1);
+    return 1;
+}
+
+static SQInteger _typedarray_add(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_add);
+}
+
+//scale(k), multiplies every element by k
+template<typename T> static SQInteger _ta_scale(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    typedef SQTATraits<T> Tr;
+    typedef typename Tr::MulAcc Acc;
+    SQInteger n = self->length;
+    if(sq_gettype(v,2) == OT_INTEGER) {
+        SQInteger k;
+        sq_getinteger(v,2,&k);
+        Acc m = (Acc)Tr::Limit(k);
+        for(SQInteger i = 0; i < n; i++) data[i] = Tr::Sat((Acc)data[i] * m);
+    }
+    else {
+        SQFloat f;
+        sq_getfloat(v,2,&f);
+        for(SQInteger i = 0; i < n; i++) data[i] = Tr::FromFloat(data[i] * f);
+    }
+    sq_push(v,1);
+    return 1;
+}
+
+static SQInteger _typedarray_scale(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_scale);
+}
+
+//clamp(lo,hi)
+template<typename T> static SQInteger _ta_clamp(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    T lo,hi;
+    if(SQ_FAILED(_ta_getnumber<T>(v,2,lo)) || SQ_FAILED(_ta_getnumber<T>(v,3,hi))) return SQ_ERROR;
+    if(lo > hi)
+        return sq_throwerror(v,_SC("the lower bound is greater than the upper bound"));
+    for(SQInteger i = 0; i < self->length; i++) {
+        T e = data[i];
+        data[i] = e < lo ? lo : (e > hi ? hi : e);
+    }
+    sq_push(v,1);
+    return 1;
+}
+
+static SQInteger _typedarray_clamp(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_clamp);
+}
+
+template<typename T> static SQInteger _ta_sum(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    typename SQTATraits<T>::Sum s = 0;
+    for(SQInteger i = 0; i < self->length; i++) s += data[i];
+    SQTATraits<T>::Push(v,s);
+    return 1;
+}
+
+static SQInteger _typedarray_sum(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_sum);
+}
+
+//min() and max() are null for an empty array
+template<typename T> static SQInteger _ta_min(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    if(self->length == 0) {
+        sq_pushnull(v);
+        return 1;
+    }
+    T m = data[0];
+    for(SQInteger i = 1; i < self->length; i++) m = data[i] < m ? data[i] : m;
+    SQTATraits<T>::Push(v,m);
+    return 1;
+}
+
+static SQInteger _typedarray_min(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_min);
+}
+
+template<typename T> static SQInteger _ta_max(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    if(self->length == 0) {
+        sq_pushnull(v);
+        return 1;
+    }
+    T m = data[0];
+    for(SQInteger i = 1; i < self->length; i++) m = data[i] > m ? data[i] : m;
+    SQTATraits<T>::Push(v,m);
+    return 1;
+}
+
+static SQInteger _typedarray_max(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_max);
+}
+
+//dot(other), an integer unless either array is a Float32Array
+template<typename T> static SQInteger _ta_dot(HSQUIRRELVM v,SQTypedArray *self,T *data)
+{
+    typedef SQTATraits<T> Tr;
+    SQTypedArray *other;
+    void *odata;
+    SQInteger n = self->length;
+    if(SQ_FAILED(_ta_getother(v,2,self,other,odata))) return SQ_ERROR;
+    if(other->type == self->type) {
+        const T *o = (const T *)odata;
+        typename Tr::Sum s = 0;
+        for(SQInteger i = 0; i < n; i++) s += (typename Tr::Sum)((typename Tr::MulAcc)data[i] * o[i]);
+        Tr::Push(v,s);
+    }
+    else if(Tr::isfloat || other->type == SQTA_FLOAT32) {
+        SQFloat s = 0;
+        for(SQInteger i = 0; i < n; i++) s += (SQFloat)data[i] * _ta_getf(other,odata,i);
+        sq_pushfloat(v,s);
+    }
+    else {
+        long long s = 0;
+        for(SQInteger i = 0; i < n; i++) s += (long long)data[i] * _ta_geti(other,odata,i);
+        _ta_pushsum(v,s);
+    }
+    return 1;
+}
+
+static SQInteger _typedarray_dot(HSQUIRRELVM v)
+{
+    SETUP_TA(v);
+    SQTA_DISPATCH(_ta_dot);
+}
+
+#define _DECL_TA_FUNC(name,nparams,typecheck) {_SC(#name),_typedarray_##name,nparams,typecheck}
+static const SQRegFunction _typedarray_methods[] = {
+    _DECL_TA_FUNC(len,1,_SC("x")),
+    _DECL_TA_FUNC(slice,-2,_SC("xnn")),
+    _DECL_TA_FUNC(toarray,1,_SC("x")),
+    _DECL_TA_FUNC(fill,2,_SC("xn|b")),
+    _DECL_TA_FUNC(add,2,_SC("x.")),
+    _DECL_TA_FUNC(scale,2,_SC("xn")),
+    _DECL_TA_FUNC(clamp,3,_SC("xnn")),
+    _DECL_TA_FUNC(sum,1,_SC("x")),
+    _DECL_TA_FUNC(min,1,_SC("x")),
+    _DECL_TA_FUNC(max,1,_SC("x")),
+    _DECL_TA_FUNC(dot,2,_SC("xx")),
+    _DECL_TA_FUNC(_set,3,_SC("xn.")),
+    _DECL_TA_FUNC(_get,2,_SC("x.")),
+    _DECL_TA_FUNC(_typeof,1,_SC("x")),
+    _DECL_TA_FUNC(_nexti,2,_SC("x")),
+    _DECL_TA_FUNC(_cloned,2,_SC("xx")),
+    {NULL,(SQFUNCTION)0,0,NULL}
+};
+
+//The methods live in one typedarray base class. Each element type is a subclass of it
+//that only adds a constructor, so the method closures aren't repeated per type.
+SQRESULT sqstd_register_typedarrays(HSQUIRRELVM v)
+{
+    SQInteger top = sq_gettop(v);
+    sq_pushstring(v,_SC("typedarray"),-1);
+    sq_newclass(v,SQFalse);
+    sq_settypetag(v,-1,(SQUserPointer)SQSTD_TYPEDARRAY_TYPE_TAG);
+    SQInteger i = 0;
+    while(_typedarray_methods[i].name != 0) {
+        const SQRegFunction &f = _typedarray_methods[i];
+        sq_pushstring(v,f.name,-1);
+        sq_newclosure(v,f.f,0);
+        sq_setparamscheck(v,f.nparamscheck,f.typemask);
+        sq_setnativeclosurename(v,-1,f.name);
+        sq_newslot(v,-3,SQFalse);
+        i++;
+    }
+    for(SQInteger t = 0; t < SQTA_NTYPES; t++) {
+        sq_pushstring(v,_ta_types[t].name,-1);
+        sq_push(v,-2);
+        sq_newclass(v,SQTrue);
+        sq_pushstring(v,_SC("constructor"),-1);
+        sq_pushinteger(v,t);
+        sq_newclosure(v,_typedarray_constructor,1);
+        sq_setparamscheck(v,-1,_SC("x."));
+        sq_setnativeclosurename(v,-1,_SC("constructor"));
+        sq_newslot(v,-3,SQFalse);
+        sq_newslot(v,-5,SQFalse);
+    }
+    sq_newslot(v,-3,SQFalse);
+    sq_settop(v,top);
+    return SQ_OK;
+}
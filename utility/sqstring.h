@@ -2,13 +2,47 @@
 #ifndef _SQSTRING_H_
 #define _SQSTRING_H_
 
-inline SQHash _hashstr (const SQChar *s, size_t l)
+/*
+* Hashes every byte a word at a time, so long strings that only differ near the end
+* still spread out. MurmurHash64A on 64 bit builds, MurmurHash3 on 32 bit ones, which
+* only needs 32 bit multiplies. The seed comes from the shared state.
+*/
+inline SQHash _hashstr (const SQChar *s, size_t l, SQHash seed)
 {
-        SQHash h = (SQHash)l;  /* seed */
-        size_t step = (l>>5)|1;  /* if string is too long, don't hash all its chars */
-        for (; l>=step; l-=step)
-            h = h ^ ((h<<5)+(h>>2)+(unsigned short)*(s++));
-        return h;
+    const unsigned char *p = (const unsigned char *)s;
+    size_t n = sq_rsl(l);
+#ifdef _SQ64
+    const SQHash m = 0xc6a4a7935bd1e995ULL;
+    SQHash h = seed ^ (n * m);
+    for (; n >= 8; n -= 8, p += 8) {
+        SQHash k;
+        memcpy(&k, p, 8);
+        k *= m; k ^= k >> 47; k *= m;
+        h ^= k; h *= m;
+    }
+    if (n) {
+        SQHash k = 0;
+        memcpy(&k, p, n);
+        h ^= k; h *= m;
+    }
+    h ^= h >> 47; h *= m; h ^= h >> 47;
+#else
+    SQHash h = seed ^ (SQHash)n;
+    for (; n >= 4; n -= 4, p += 4) {
+        SQHash k;
+        memcpy(&k, p, 4);
+        k *= 0xcc9e2d51; k = (k << 15) | (k >> 17); k *= 0x1b873593;
+        h ^= k; h = (h << 13) | (h >> 19); h = h * 5 + 0xe6546b64;
+    }
+    if (n) {
+        SQHash k = 0;
+        memcpy(&k, p, n);
+        k *= 0xcc9e2d51; k = (k << 15) | (k >> 17); k *= 0x1b873593;
+        h ^= k;
+    }
+    h ^= h >> 16; h *= 0x85ebca6b; h ^= h >> 13; h *= 0xc2b2ae35; h ^= h >> 16;
+#endif
+    return h;
 }
 
 struct SQString : public SQRefCounted
@@ -17,8 +51,17 @@ struct SQString : public SQRefCounted
     ~SQString(){}
 public:
     static SQString *Create(SQSharedState *ss, const SQChar *, SQInteger len = -1 );
+    //Long strings made at runtime skip the string table until they're used as a key
+    static SQString *CreateTransient(SQSharedState *ss, const SQChar *, SQInteger len);
     SQInteger Next(const SQObjectPtr &refpos, SQObjectPtr &outkey, SQObjectPtr &outval);
     void Release();
+    //Transient strings aren't in the string table, so there can be several equal ones
+    //and they have to be compared by content. They point their chain at themselves.
+    bool IsTransient() { return _next == this; }
+    //and they only get hashed once something needs it
+    SQHash Hash() { return (_hash || !IsTransient()) ? _hash : ComputeHash(); }
+    SQHash ComputeHash();
+    SQString *Intern();
     SQSharedState *_sharedstate;
     SQString *_next; //chain for the string table
     SQInteger _len;
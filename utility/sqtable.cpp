@@ -7,6 +7,158 @@ see copyright notice in squirrel.h
 #include "sqfuncproto.h"
 #include "sqclosure.h"
 
+#ifdef SQ_OPEN_TABLES
+
+SQTable::SQTable(SQSharedState *ss,SQInteger nInitialSize)
+{
+    SQInteger pow2size=MINPOWER2;
+    while(nInitialSize>SQ_TABLE_CAPACITY(pow2size))pow2size=pow2size<<1;
+    AllocNodes(pow2size);
+    _delegate = NULL;
+    INIT_CHAIN();
+    ADD_TO_CHAIN(&_sharedstate->_gc_chain,this);
+}
+
+//nSize is the size of the index, the entries get 3/4 of that
+void SQTable::AllocNodes(SQInteger nSize)
+{
+    SQInteger nentries = SQ_TABLE_CAPACITY(nSize);
+    _HashNode *nodes=(_HashNode *)SQ_MALLOC(sizeof(_HashNode)*nentries);
+    for(SQInteger i=0;i<nentries;i++) new (&nodes[i]) _HashNode;
+    _nodes=nodes;
+    _numofnodes=nentries;
+    _fill=0;
+    _usednodes=0;
+    _slots=(SQUnsignedInteger32 *)SQ_MALLOC(SQ_TABLE_INDEXBYTES(nSize));
+    _ctrl=(unsigned char *)(_slots+nSize);
+    _indexsize=nSize;
+    memset(_ctrl,SQ_CTRL_EMPTY,nSize+SQ_TABLE_GROUP);
+}
+
+void SQTable::_InsertSlot(SQHash hash, SQInteger entry)
+{
+    SQInteger mask = _indexsize - 1;
+    SQInteger pos = hash & mask;
+    SQTableMatch m;
+    while(!(m = sq_groupempty(_ctrl + pos))) pos = (pos + SQ_TABLE_GROUP) & mask;
+    SQInteger i = (pos + sq_matchindex(m)) & mask;
+    _slots[i] = (SQUnsignedInteger32)entry;
+    _SetCtrl(i, sq_ctrlhash(hash));
+}
+
+//Backward shift deletion: pull each following slot of the probe run into the gap
+//unless its home position is after the gap, so lookups never need tombstones.
+void SQTable::_RemoveSlot(SQInteger i)
+{
+    SQInteger mask = _indexsize - 1;
+    SQInteger j = i;
+    for(;;) {
+        j = (j + 1) & mask;
+        if(_ctrl[j] == SQ_CTRL_EMPTY) break;
+        SQInteger home = HashObj(_nodes[_slots[j]].key) & mask;
+        if(((j - home) & mask) >= ((j - i) & mask)) {
+            _slots[i] = _slots[j];
+            _SetCtrl(i, _ctrl[j]);
+            i = j;
+        }
+    }
+    _SetCtrl(i, SQ_CTRL_EMPTY);
+}
+
+void SQTable::Remove(const SQObjectPtr &key)
+{
+    if(IsTransientKey(key)) { Remove(SQObjectPtr(_string(key)->Intern())); return; }
+    SQInteger i = _FindSlot(key, HashObj(key));
+    if (i >= 0) {
+        SQInteger e = _slots[i];
+        _RemoveSlot(i);
+        _nodes[e].val.Null();
+        _nodes[e].key.Null();
+        _usednodes--;
+        //The entries aren't moved, so removing while iterating is safe
+        if(e == _fill - 1) _fill--;
+    }
+}
+
+//Moves the live entries into a fresh index sized for them, which also squeezes out
+//the holes left by removed entries
+void SQTable::Rehash(bool SQ_UNUSED_ARG(force))
+{
+    _HashNode *nold=_nodes;
+    SQInteger oldsize=_numofnodes;
+    SQInteger oldfill=_fill;
+    SQUnsignedInteger32 *oldslots=_slots;
+    SQInteger oldindexsize=_indexsize;
+    SQInteger nelems=CountUsed();
+    SQInteger pow2size=MINPOWER2;
+    while(SQ_TABLE_CAPACITY(pow2size) <= nelems+(nelems>>1)) pow2size=pow2size<<1;
+    AllocNodes(pow2size);
+#ifdef SQ_INSTRUMENT
+    _sharedstate->_rehashes++;
+#endif
+    for (SQInteger i=0; i<oldfill; i++) {
+        _HashNode *old = nold+i;
+        if (sq_type(old->key) != OT_NULL) {
+            _HashNode &n = _nodes[_fill];
+            n.key = old->key;
+            n.val = old->val;
+            _InsertSlot(HashObj(n.key), _fill++);
+        }
+    }
+    _usednodes = nelems;
+    for(SQInteger k=0;k<oldsize;k++)
+        nold[k].~_HashNode();
+    SQ_FREE(nold,oldsize*sizeof(_HashNode));
+    SQ_FREE(oldslots,SQ_TABLE_INDEXBYTES(oldindexsize));
+}
+
+bool SQTable::NewSlot(const SQObjectPtr &key,const SQObjectPtr &val)
+{
+    if(IsTransientKey(key)) return NewSlot(SQObjectPtr(_string(key)->Intern()),val);
+    assert(sq_type(key) != OT_NULL);
+    SQHash hash = HashObj(key);
+    SQInteger i = _FindSlot(key, hash);
+    if (i >= 0) {
+        _nodes[_slots[i]].val = val;
+        SQ_BARRIER(this,val);
+        return false;
+    }
+    if(_fill == _numofnodes) Rehash(true);
+    _HashNode &n = _nodes[_fill];
+    n.key = key;
+    n.val = val;
+    _InsertSlot(hash, _fill++);
+    SQ_BARRIER(this,key);
+    SQ_BARRIER(this,val);
+    _usednodes++;
+    return true;
+}
+
+//Iterates in insertion order
+SQInteger SQTable::Next(bool getweakrefs,const SQObjectPtr &refpos, SQObjectPtr &outkey, SQObjectPtr &outval)
+{
+    SQInteger idx = (SQInteger)TranslateIndex(refpos);
+    while (idx < _fill) {
+        if(sq_type(_nodes[idx].key) != OT_NULL) {
+            _HashNode &n = _nodes[idx];
+            outkey = n.key;
+            outval = getweakrefs?(SQObject)n.val:_realval(n.val);
+            return ++idx;
+        }
+        ++idx;
+    }
+    return -1;
+}
+
+void SQTable::_ClearNodes()
+{
+    for(SQInteger i = 0;i < _fill; i++) { _HashNode &n = _nodes[i]; n.key.Null(); n.val.Null(); }
+    memset(_ctrl,SQ_CTRL_EMPTY,_indexsize+SQ_TABLE_GROUP);
+    _fill = 0;
+}
+
+#else
+
 SQTable::SQTable(SQSharedState *ss,SQInteger nInitialSize)
 {
     SQInteger pow2size=MINPOWER2;
@@ -20,7 +172,7 @@ SQTable::SQTable(SQSharedState *ss,SQInteger nInitialSize)
 
 void SQTable::Remove(const SQObjectPtr &key)
 {
-
+    if(IsTransientKey(key)) { Remove(SQObjectPtr(_string(key)->Intern())); return; }
     _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
     if (n) {
         n->val.Null();
@@ -59,6 +211,9 @@ void SQTable::Rehash(bool force)
         AllocNodes(oldsize);
     else
         return;
+#ifdef SQ_INSTRUMENT
+    _sharedstate->_rehashes++;
+#endif
     _usednodes = 0;
     for (SQInteger i=0; i<oldsize; i++) {
         _HashNode *old = nold+i;
@@ -70,59 +225,15 @@ void SQTable::Rehash(bool force)
     SQ_FREE(nold,oldsize*sizeof(_HashNode));
 }
 
-SQTable *SQTable::Clone()
-{
-    SQTable *nt=Create(_opt_ss(this),_numofnodes);
-#ifdef _FAST_CLONE
-    _HashNode *basesrc = _nodes;
-    _HashNode *basedst = nt->_nodes;
-    _HashNode *src = _nodes;
-    _HashNode *dst = nt->_nodes;
-    SQInteger n = 0;
-    for(n = 0; n < _numofnodes; n++) {
-        dst->key = src->key;
-        dst->val = src->val;
-        if(src->next) {
-            assert(src->next > basesrc);
-            dst->next = basedst + (src->next - basesrc);
-            assert(dst != dst->next);
-        }
-        dst++;
-        src++;
-    }
-    assert(_firstfree > basesrc);
-    assert(_firstfree != NULL);
-    nt->_firstfree = basedst + (_firstfree - basesrc);
-    nt->_usednodes = _usednodes;
-#else
-    SQInteger ridx=0;
-    SQObjectPtr key,val;
-    while((ridx=Next(true,ridx,key,val))!=-1){
-        nt->NewSlot(key,val);
-    }
-#endif
-    nt->SetDelegate(_delegate);
-    return nt;
-}
-
-bool SQTable::Get(const SQObjectPtr &key,SQObjectPtr &val)
-{
-    if(sq_type(key) == OT_NULL)
-        return false;
-    _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
-    if (n) {
-        val = _realval(n->val);
-        return true;
-    }
-    return false;
-}
 bool SQTable::NewSlot(const SQObjectPtr &key,const SQObjectPtr &val)
 {
+    if(IsTransientKey(key)) return NewSlot(SQObjectPtr(_string(key)->Intern()),val);
     assert(sq_type(key) != OT_NULL);
     SQHash h = HashObj(key) & (_numofnodes - 1);
     _HashNode *n = _Get(key, h);
     if (n) {
         n->val = val;
+        SQ_BARRIER(this,val);
         return false;
     }
     _HashNode *mp = &_nodes[h];
@@ -163,6 +274,8 @@ bool SQTable::NewSlot(const SQObjectPtr &key,const SQObjectPtr &val)
     for (;;) {  /* correct `firstfree' */
         if (sq_type(_firstfree->key) == OT_NULL && _firstfree->next == NULL) {
             mp->val = val;
+            SQ_BARRIER(this,key);
+            SQ_BARRIER(this,val);
             _usednodes++;
             return true;  /* OK; table still has a free place */
         }
@@ -192,19 +305,71 @@ SQInteger SQTable::Next(bool getweakrefs,const SQObjectPtr &refpos, SQObjectPtr
 }
 
 
-bool SQTable::Set(const SQObjectPtr &key, const SQObjectPtr &val)
+void SQTable::_ClearNodes()
 {
-    _HashNode *n = _Get(key, HashObj(key) & (_numofnodes - 1));
+    for(SQInteger i = 0;i < _numofnodes; i++) { _HashNode &n = _nodes[i]; n.key.Null(); n.val.Null(); }
+}
+
+#endif
+
+SQTable *SQTable::Clone()
+{
+    SQTable *nt=Create(_opt_ss(this),_numofnodes);
+#if defined(_FAST_CLONE) && !defined(SQ_OPEN_TABLES)
+    _HashNode *basesrc = _nodes;
+    _HashNode *basedst = nt->_nodes;
+    _HashNode *src = _nodes;
+    _HashNode *dst = nt->_nodes;
+    SQInteger n = 0;
+    for(n = 0; n < _numofnodes; n++) {
+        dst->key = src->key;
+        dst->val = src->val;
+        if(src->next) {
+            assert(src->next > basesrc);
+            dst->next = basedst + (src->next - basesrc);
+            assert(dst != dst->next);
+        }
+        dst++;
+        src++;
+    }
+    assert(_firstfree > basesrc);
+    assert(_firstfree != NULL);
+    nt->_firstfree = basedst + (_firstfree - basesrc);
+    nt->_usednodes = _usednodes;
+#else
+    SQInteger ridx=0;
+    SQObjectPtr key,val;
+    while((ridx=Next(true,ridx,key,val))!=-1){
+        nt->NewSlot(key,val);
+    }
+#endif
+    nt->SetDelegate(_delegate);
+    return nt;
+}
+
+bool SQTable::Get(const SQObjectPtr &key,SQObjectPtr &val)
+{
+    if(IsTransientKey(key)) return Get(SQObjectPtr(_string(key)->Intern()),val);
+    if(sq_type(key) == OT_NULL)
+        return false;
+    _HashNode *n = _Get(key);
     if (n) {
-        n->val = val;
+        val = _realval(n->val);
         return true;
     }
     return false;
 }
 
-void SQTable::_ClearNodes()
+bool SQTable::Set(const SQObjectPtr &key, const SQObjectPtr &val)
 {
-    for(SQInteger i = 0;i < _numofnodes; i++) { _HashNode &n = _nodes[i]; n.key.Null(); n.val.Null(); }
+    if(IsTransientKey(key)) return Set(SQObjectPtr(_string(key)->Intern()),val);
+    _HashNode *n = _Get(key);
+    if (n) {
+        n->val = val;
+        SQ_BARRIER(this,val);
+        return true;
+    }
+    return false;
 }
 
 void SQTable::Finalize()
@@ -15,16 +15,134 @@
 inline SQHash HashObj(const SQObjectPtr &key)
 {
     switch(sq_type(key)) {
-        case OT_STRING:     return _string(key)->_hash;
+        case OT_STRING:     return _string(key)->Hash();
         case OT_FLOAT:      return (SQHash)((SQInteger)_float(key));
         case OT_BOOL: case OT_INTEGER:  return (SQHash)((SQInteger)_integer(key));
         default:            return hashptr(key._unVal.pRefCounted);
     }
 }
 
+//Tables only hold interned strings, see SQString::IsTransient()
+inline bool IsTransientKey(const SQObjectPtr &key)
+{
+    return sq_type(key) == OT_STRING && _string(key)->IsTransient();
+}
+
+#ifdef SQ_OPEN_TABLES
+/*
+* Open addressing engine. The entries live in _nodes in insertion order, and a separate
+* linear probing index maps hash positions to them. Every index slot has a control byte,
+* SQ_CTRL_EMPTY or 7 bits of the key's hash, and probing compares a whole group of control
+* bytes against the hash at once. Removing shifts the following slots back, so there are no
+* tombstones, and the entry is left as a hole that Next() skips until the next rehash.
+*/
+#define SQ_CTRL_EMPTY 0x80
+//Index slots per entry slot, the index is never more than 3/4 full
+#define SQ_TABLE_CAPACITY(indexsize) ((indexsize) - ((indexsize) >> 2))
+//The control bytes follow the slots, with the first group repeated past the end so a
+//group can be loaded from any position without wrapping
+#define SQ_TABLE_INDEXBYTES(indexsize) ((indexsize) * (sizeof(SQUnsignedInteger32) + 1) + SQ_TABLE_GROUP)
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SQ_TABLE_GROUP 16
+typedef unsigned int SQTableMatch;
+inline SQTableMatch sq_groupmatch(const unsigned char *g, unsigned char c)
+{
+    return (SQTableMatch)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)g), _mm_set1_epi8((char)c)));
+}
+inline SQTableMatch sq_groupempty(const unsigned char *g)
+{
+    return (SQTableMatch)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+}
+#define sq_matchindex(m) __builtin_ctz(m)
+#else
+//SWAR, a group is one machine word. The match can give false positives next to a real match,
+//which the key comparison weeds out, but never on an empty slot. Assumes a little endian CPU.
+#ifdef _SQ64
+#define SQ_TABLE_GROUP 8
+typedef unsigned long long SQTableMatch;
+#define sq_matchindex(m) (__builtin_ctzll(m) >> 3)
+#else
+#define SQ_TABLE_GROUP 4
+typedef SQUnsignedInteger32 SQTableMatch;
+#define sq_matchindex(m) (__builtin_ctz(m) >> 3)
+#endif
+#define SQ_GROUP_LSB (((SQTableMatch)-1) / 0xFF)
+#define SQ_GROUP_MSB (SQ_GROUP_LSB << 7)
+inline SQTableMatch sq_groupload(const unsigned char *g)
+{
+    SQTableMatch x;
+    memcpy(&x, g, sizeof(x));
+    return x;
+}
+inline SQTableMatch sq_groupmatch(const unsigned char *g, unsigned char c)
+{
+    SQTableMatch x = sq_groupload(g) ^ (SQ_GROUP_LSB * c);
+    return (x - SQ_GROUP_LSB) & ~x & SQ_GROUP_MSB;
+}
+inline SQTableMatch sq_groupempty(const unsigned char *g)
+{
+    return sq_groupload(g) & SQ_GROUP_MSB;
+}
+#endif
+
+//The control byte takes the top bits of a multiplicative hash, so it doesn't just repeat
+//the low bits that already picked the position
+inline unsigned char sq_ctrlhash(SQHash h)
+{
+    return (unsigned char)(((SQUnsignedInteger32)h * 2654435769u) >> 25);
+}
+#endif
+
 struct SQTable : public SQDelegable
 {
 private:
+#ifdef SQ_OPEN_TABLES
+    struct _HashNode
+    {
+        SQObjectPtr val;
+        SQObjectPtr key;
+    };
+    _HashNode *_nodes;
+    SQInteger _numofnodes;
+    SQInteger _usednodes;
+    //Entries handed out so far, including removed ones
+    SQInteger _fill;
+    SQUnsignedInteger32 *_slots;
+    unsigned char *_ctrl;
+    SQInteger _indexsize;
+
+    void _SetCtrl(SQInteger i, unsigned char c)
+    {
+        _ctrl[i] = c;
+        for(SQInteger k = i + _indexsize; k < _indexsize + SQ_TABLE_GROUP; k += _indexsize) _ctrl[k] = c;
+    }
+    void _InsertSlot(SQHash hash, SQInteger entry);
+    void _RemoveSlot(SQInteger i);
+    //Returns the index slot of key, or -1
+    inline SQInteger _FindSlot(const SQObjectPtr &key,SQHash hash)
+    {
+        SQInteger mask = _indexsize - 1;
+        SQInteger pos = hash & mask;
+        unsigned char h2 = sq_ctrlhash(hash);
+        //Most keys sit in their home slot, try that before loading a group
+        if(_ctrl[pos] == h2) {
+            _HashNode &n = _nodes[_slots[pos]];
+            if(_rawval(n.key) == _rawval(key) && sq_type(n.key) == sq_type(key)) return pos;
+        }
+        for(;;) {
+            const unsigned char *g = _ctrl + pos;
+            for(SQTableMatch m = sq_groupmatch(g, h2); m; m &= m - 1) {
+                SQInteger i = (pos + sq_matchindex(m)) & mask;
+                _HashNode &n = _nodes[_slots[i]];
+                if(_rawval(n.key) == _rawval(key) && sq_type(n.key) == sq_type(key)) return i;
+            }
+            if(sq_groupempty(g)) return -1;
+            pos = (pos + SQ_TABLE_GROUP) & mask;
+        }
+    }
+#else
     struct _HashNode
     {
         _HashNode() { next = NULL; }
@@ -36,6 +154,7 @@ private:
     _HashNode *_nodes;
     SQInteger _numofnodes;
     SQInteger _usednodes;
+#endif
 
 ///////////////////////////
     void AllocNodes(SQInteger nSize);
@@ -58,11 +177,45 @@ public:
         REMOVE_FROM_CHAIN(&_sharedstate->_gc_chain, this);
         for (SQInteger i = 0; i < _numofnodes; i++) _nodes[i].~_HashNode();
         SQ_FREE(_nodes, _numofnodes * sizeof(_HashNode));
+#ifdef SQ_OPEN_TABLES
+        SQ_FREE(_slots, SQ_TABLE_INDEXBYTES(_indexsize));
+#endif
     }
 #ifndef NO_GARBAGE_COLLECTOR
     void Mark(SQCollectable **chain);
     SQObjectType GetType() {return OT_TABLE;}
 #endif
+#ifdef SQ_OPEN_TABLES
+    inline _HashNode *_Get(const SQObjectPtr &key)
+    {
+        SQInteger i = _FindSlot(key, HashObj(key));
+        return (i < 0) ? NULL : &_nodes[_slots[i]];
+    }
+    //for compiler use
+    inline bool GetStr(const SQChar* key,SQInteger keylen,SQHash seed,SQObjectPtr &val)
+    {
+        SQHash hash = _hashstr(key,keylen,seed);
+        SQInteger mask = _indexsize - 1;
+        SQInteger pos = hash & mask;
+        unsigned char h2 = sq_ctrlhash(hash);
+        for(;;) {
+            const unsigned char *g = _ctrl + pos;
+            for(SQTableMatch m = sq_groupmatch(g, h2); m; m &= m - 1) {
+                _HashNode &n = _nodes[_slots[(pos + sq_matchindex(m)) & mask]];
+                if(sq_type(n.key) == OT_STRING && (scstrcmp(_stringval(n.key),key) == 0)){
+                    val = _realval(n.val);
+                    return true;
+                }
+            }
+            if(sq_groupempty(g)) return false;
+            pos = (pos + SQ_TABLE_GROUP) & mask;
+        }
+    }
+#else
+    inline _HashNode *_Get(const SQObjectPtr &key)
+    {
+        return _Get(key, HashObj(key) & (_numofnodes - 1));
+    }
     inline _HashNode *_Get(const SQObjectPtr &key,SQHash hash)
     {
         _HashNode *n = &_nodes[hash];
@@ -74,9 +227,9 @@ public:
         return NULL;
     }
     //for compiler use
-    inline bool GetStr(const SQChar* key,SQInteger keylen,SQObjectPtr &val)
+    inline bool GetStr(const SQChar* key,SQInteger keylen,SQHash seed,SQObjectPtr &val)
     {
-        SQHash hash = _hashstr(key,keylen);
+        SQHash hash = _hashstr(key,keylen,seed);
         _HashNode *n = &_nodes[hash & (_numofnodes - 1)];
         _HashNode *res = NULL;
         do{
@@ -91,6 +244,7 @@ public:
         }
         return false;
     }
+#endif
     bool Get(const SQObjectPtr &key,SQObjectPtr &val);
     void Remove(const SQObjectPtr &key);
     bool Set(const SQObjectPtr &key, const SQObjectPtr &val);
@@ -155,11 +155,21 @@ typedef union tagSQObjectValue
 }SQObjectValue;
 
 
+/*With 64 bit values the type tag gets padded out to 8 bytes, SQ_PACKED_OBJECTS drops the padding.
+  Pointers would lose their natural alignment on 64 bit hosts, so there it's ignored and objects
+  stay 16 bytes*/
+#if defined(SQ_PACKED_OBJECTS) && (defined(_SQ64) || defined(SQUSEDOUBLE)) && defined(__SIZEOF_POINTER__) && __SIZEOF_POINTER__ == 4
+#pragma pack(push,4)
+#define SQ_OBJECT_PACKED
+#endif
 typedef struct tagSQObject
 {
     SQObjectType _type;
     SQObjectValue _unVal;
 }SQObject;
+#ifdef SQ_OBJECT_PACKED
+#pragma pack(pop)
+#endif
 
 typedef struct  tagSQMemberHandle{
     SQBool _static;
@@ -172,9 +182,88 @@ typedef struct tagSQStackInfos{
     SQInteger line;
 }SQStackInfos;
 
+typedef struct tagSQProfileSample{
+    const SQChar* funcname;
+    const SQChar* source;
+    SQInteger line;
+    SQUnsignedInteger hits;
+}SQProfileSample;
+
+/*must match the number of opcodes in sqopcodes.h*/
+#define SQ_OPCODE_COUNT 0x3D
+
+/*only filled in when built with SQ_INSTRUMENT*/
+typedef struct tagSQVMCounters{
+    SQUnsignedInteger ops[SQ_OPCODE_COUNT];
+    SQUnsignedInteger calls;
+    SQUnsignedInteger nativecalls;
+    SQUnsignedInteger exceptions;
+    SQUnsignedInteger gccycles;
+    SQUnsignedInteger rehashes; /*shared by all VMs of the same shared state*/
+}SQVMCounters;
+
+/*number of size classes of the pool allocator(SQ_POOL_ALLOCATOR)*/
+#define SQ_POOL_CLASSES 10
+#ifndef SQ_POOL_SLAB_SIZE
+#define SQ_POOL_SLAB_SIZE 1024
+#endif
+
+typedef struct tagSQPoolStats{
+    SQUnsignedInteger blocksize;
+    SQUnsignedInteger slabs;
+    SQUnsignedInteger used; /*blocks handed out*/
+    SQUnsignedInteger free; /*blocks waiting on the free list*/
+    SQUnsignedInteger requested; /*bytes actually asked for by the used blocks*/
+}SQPoolStats;
+
+typedef struct tagSQGCStats{
+    SQUnsignedInteger cycles; /*incremental cycles finished*/
+    SQUnsignedInteger fullcollections; /*sq_collectgarbage() calls*/
+    SQUnsignedInteger slices;
+    SQUnsignedInteger freed; /*objects finalized by the collector*/
+    SQUnsignedInteger lastcycleus; /*time spent in all the slices of the last cycle*/
+    SQUnsignedInteger maxpauseus; /*longest slice or full collection*/
+    SQUnsignedInteger totalus;
+    SQUnsignedInteger inuse; /*bytes allocated by the VMs*/
+    SQUnsignedInteger threshold; /*a cycle starts when inuse grows past this*/
+    SQUnsignedInteger ratio; /*the settings from sq_setgctrigger()*/
+    SQUnsignedInteger lowheap;
+}SQGCStats;
+
+typedef struct tagSQStringTableStats{
+    SQUnsignedInteger strings; /*interned strings*/
+    SQUnsignedInteger slots;
+    SQUnsignedInteger usedslots; /*slots with at least one string*/
+    SQUnsignedInteger longestchain;
+    SQUnsignedInteger transient; /*long strings not interned yet, see SQ_TRANSIENT_MINLEN*/
+}SQStringTableStats;
+
+/*allocations are charged to an account when built with SQ_MEM_ACCOUNTING*/
+typedef struct tagSQMemAccount{
+    SQUnsignedInteger current;
+    SQUnsignedInteger peak;
+    SQUnsignedInteger quota; /*0 means no limit*/
+    SQBool closeonquota; /*stop the VM instead of raising a catchable error*/
+    SQBool exceeded;
+    SQInteger refs;
+}SQMemAccount;
+
+/*placement tiers of VM allocations, see SQ_MEM_LARGESIZE*/
+#define SQ_MEMTIER_FAST 0 /*internal RAM*/
+#define SQ_MEMTIER_LARGE 1 /*PSRAM, on boards that have it*/
+#define SQ_MEMTIERS 2
+
+typedef struct tagSQMemTierStats{
+    SQUnsignedInteger inuse; /*bytes*/
+    SQUnsignedInteger peak;
+    SQUnsignedInteger blocks;
+    SQUnsignedInteger spilled; /*allocations meant for this tier that had to go to the other one*/
+}SQMemTierStats;
+
 typedef struct SQVM* HSQUIRRELVM;
 typedef SQObject HSQOBJECT;
 typedef SQMemberHandle HSQMEMBERHANDLE;
+typedef SQInteger HSQHANDLE; /*an object pinned with sq_newhandle()*/
 typedef SQInteger (*SQFUNCTION)(HSQUIRRELVM);
 typedef SQInteger (*SQRELEASEHOOK)(SQUserPointer,SQInteger size);
 typedef void (*SQCOMPILERERROR)(HSQUIRRELVM,const SQChar * /*desc*/,const SQChar * /*source*/,SQInteger /*line*/,SQInteger /*column*/);
@@ -226,6 +315,7 @@ SQUIRREL_API SQInteger sq_request_forceclose(HSQUIRRELVM v);
 SQUIRREL_API SQRESULT sq_compile(HSQUIRRELVM v,SQLEXREADFUNC read,SQUserPointer p,const SQChar *sourcename,SQBool raiseerror);
 SQUIRREL_API SQRESULT sq_compilebuffer(HSQUIRRELVM v,const SQChar *s,SQInteger size,const SQChar *sourcename,SQBool raiseerror);
 SQUIRREL_API void sq_enabledebuginfo(HSQUIRRELVM v, SQBool enable);
+SQUIRREL_API void sq_striplocals(HSQUIRRELVM v, SQBool strip);
 SQUIRREL_API void sq_notifyallexceptions(HSQUIRRELVM v, SQBool enable);
 SQUIRREL_API void sq_setcompilererrorhandler(HSQUIRRELVM v,SQCOMPILERERROR f);
 
@@ -278,6 +368,7 @@ SQUIRREL_API SQRESULT sq_gettypetag(HSQUIRRELVM v,SQInteger idx,SQUserPointer *t
 SQUIRREL_API void sq_setreleasehook(HSQUIRRELVM v,SQInteger idx,SQRELEASEHOOK hook);
 SQUIRREL_API SQRELEASEHOOK sq_getreleasehook(HSQUIRRELVM v,SQInteger idx);
 SQUIRREL_API SQChar *sq_getscratchpad(HSQUIRRELVM v,SQInteger minsize);
+SQUIRREL_API SQChar *sq_pushnewstring(HSQUIRRELVM v,SQInteger len);
 SQUIRREL_API SQRESULT sq_getfunctioninfo(HSQUIRRELVM v,SQInteger level,SQFunctionInfo *fi);
 SQUIRREL_API SQRESULT sq_getclosureinfo(HSQUIRRELVM v,SQInteger idx,SQInteger *nparams,SQInteger *nfreevars);
 SQUIRREL_API SQRESULT sq_getclosurename(HSQUIRRELVM v,SQInteger idx);
@@ -348,6 +439,10 @@ SQUIRREL_API void sq_pushobject(HSQUIRRELVM v,HSQOBJECT obj);
 SQUIRREL_API void sq_addref(HSQUIRRELVM v,HSQOBJECT *po);
 SQUIRREL_API SQBool sq_release(HSQUIRRELVM v,HSQOBJECT *po);
 SQUIRREL_API SQUnsignedInteger sq_getrefcount(HSQUIRRELVM v,HSQOBJECT *po);
+SQUIRREL_API HSQHANDLE sq_newhandle(HSQUIRRELVM v,SQInteger idx);
+SQUIRREL_API SQRESULT sq_pushhandle(HSQUIRRELVM v,HSQHANDLE h);
+SQUIRREL_API SQRESULT sq_gethandleobj(HSQUIRRELVM v,HSQHANDLE h,HSQOBJECT *po);
+SQUIRREL_API SQRESULT sq_releasehandle(HSQUIRRELVM v,HSQHANDLE h);
 SQUIRREL_API void sq_resetobject(HSQOBJECT *po);
 SQUIRREL_API const SQChar *sq_objtostring(const HSQOBJECT *o);
 SQUIRREL_API SQBool sq_objtobool(const HSQOBJECT *o);
@@ -361,6 +456,11 @@ SQUIRREL_API SQUnsignedInteger sq_getvmrefcount(HSQUIRRELVM v, const HSQOBJECT *
 /*GC*/
 SQUIRREL_API SQInteger sq_collectgarbage(HSQUIRRELVM v);
 SQUIRREL_API SQRESULT sq_resurrectunreachable(HSQUIRRELVM v);
+SQUIRREL_API SQBool sq_gcstep(HSQUIRRELVM v);
+SQUIRREL_API void sq_setgcslice(HSQUIRRELVM v,SQInteger nobjects);
+SQUIRREL_API void sq_setgctrigger(HSQUIRRELVM v,SQInteger ratio,SQInteger lowheap);
+SQUIRREL_API SQRESULT sq_getgcstats(HSQUIRRELVM v,SQGCStats *st);
+SQUIRREL_API void sq_getstringtablestats(HSQUIRRELVM v,SQStringTableStats *st);
 
 /*serialization*/
 SQUIRREL_API SQRESULT sq_writeclosure(HSQUIRRELVM vm,SQWRITEFUNC writef,SQUserPointer up);
@@ -370,11 +470,29 @@ SQUIRREL_API SQRESULT sq_readclosure(HSQUIRRELVM vm,SQREADFUNC readf,SQUserPoint
 SQUIRREL_API void *sq_malloc(SQUnsignedInteger size);
 SQUIRREL_API void *sq_realloc(void* p,SQUnsignedInteger oldsize,SQUnsignedInteger newsize);
 SQUIRREL_API void sq_free(void *p,SQUnsignedInteger size);
+SQUIRREL_API SQRESULT sq_getpoolstats(SQInteger sizeclass,SQPoolStats *ps);
+SQUIRREL_API SQUnsignedInteger sq_getmeminuse();
+SQUIRREL_API SQMemAccount *sq_newmemaccount(SQUnsignedInteger quota,SQBool closeonquota);
+SQUIRREL_API void sq_releasememaccount(SQMemAccount *a);
+SQUIRREL_API SQMemAccount *sq_setcurrentmemaccount(SQMemAccount *a);
+SQUIRREL_API void sq_setmemaccount(HSQUIRRELVM v,SQMemAccount *a);
+SQUIRREL_API SQMemAccount *sq_getmemaccount(HSQUIRRELVM v);
+SQUIRREL_API void sq_setmemlargesize(SQUnsignedInteger size);
+SQUIRREL_API SQUnsignedInteger sq_getmemlargesize();
+SQUIRREL_API SQRESULT sq_getmemtierstats(SQInteger tier,SQMemTierStats *st);
 
 /*debug*/
 SQUIRREL_API SQRESULT sq_stackinfos(HSQUIRRELVM v,SQInteger level,SQStackInfos *si);
 SQUIRREL_API void sq_setdebughook(HSQUIRRELVM v);
 SQUIRREL_API void sq_setnativedebughook(HSQUIRRELVM v,SQDEBUGHOOK hook);
+SQUIRREL_API SQRESULT sq_startprofiler(HSQUIRRELVM v,SQInteger nslots);
+SQUIRREL_API void sq_stopprofiler(HSQUIRRELVM v);
+SQUIRREL_API SQInteger sq_getprofilesize(HSQUIRRELVM v,SQUnsignedInteger *dropped);
+SQUIRREL_API SQRESULT sq_getprofilesample(HSQUIRRELVM v,SQInteger idx,SQProfileSample *ps);
+SQUIRREL_API SQRESULT sq_pushprofile(HSQUIRRELVM v);
+SQUIRREL_API SQRESULT sq_getcounters(HSQUIRRELVM v,SQVMCounters *c);
+SQUIRREL_API void sq_resetcounters(HSQUIRRELVM v);
+SQUIRREL_API SQRESULT sq_pushcounters(HSQUIRRELVM v);
 
 /*UTILITY MACRO*/
 #define sq_isnumeric(o) ((o)._type&SQOBJECT_NUMERIC)
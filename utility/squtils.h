@@ -6,6 +6,17 @@ void *sq_vm_malloc(SQUnsignedInteger size);
 void *sq_vm_realloc(void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size);
 void sq_vm_free(void *p,SQUnsignedInteger size);
 
+//Sends the allocations made while one of these is alive to a tier(SQ_MEMTIER_FAST or
+//SQ_MEMTIER_LARGE) regardless of their size
+#define SQ_PLACE_BYSIZE -1
+SQInteger sq_vm_setplacement(SQInteger tier);
+struct SQMemPlacement
+{
+    SQMemPlacement(SQInteger tier) { _prev = sq_vm_setplacement(tier); }
+    ~SQMemPlacement() { sq_vm_setplacement(_prev); }
+    SQInteger _prev;
+};
+
 #define sq_new(__ptr,__type) {__ptr=(__type *)sq_vm_malloc(sizeof(__type));new (__ptr) __type;}
 #define sq_delete(__ptr,__type) {__ptr->~__type();sq_vm_free(__ptr,sizeof(__type));}
 #define SQ_MALLOC(__size) sq_vm_malloc((__size));
@@ -14,8 +25,52 @@ void sq_vm_free(void *p,SQUnsignedInteger size);
 
 #define sq_aligning(v) (((size_t)(v) + (SQ_ALIGNMENT-1)) & (~(SQ_ALIGNMENT-1)))
 
+//Bump allocator for scratch data that all dies at the same time, like the compiler's.
+//Everything is given back in one go when the arena is destroyed. Growing or freeing
+//the most recent block happens in place, anything else just leaves a hole until then.
+//Arenas nest, the newest one alive is where new SQArenaAllocator vectors take from.
+class SQArena
+{
+public:
+    SQArena(SQUnsignedInteger chunksize);
+    ~SQArena();
+    void *Alloc(SQUnsignedInteger size);
+    void *Realloc(void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size);
+    void Free(void *p,SQUnsignedInteger size);
+    static SQArena *_current;
+private:
+    struct Chunk{
+        Chunk *_next;
+        SQUnsignedInteger _size;
+    };
+    bool NewChunk(SQUnsignedInteger size);
+    Chunk *_chunks;
+    unsigned char *_top;
+    unsigned char *_end;
+    unsigned char *_last;
+    SQUnsignedInteger _chunksize;
+    SQArena *_prev;
+};
+
+//Where a sqvector gets its storage from. sqvector derives from it, so an allocator with no
+//state costs nothing.
+struct SQVMAllocator
+{
+    static void *Realloc(void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size) { return sq_vm_realloc(p,oldsize,size); }
+    static void Free(void *p,SQUnsignedInteger size) { sq_vm_free(p,size); }
+};
+
+//Sticks with the arena that was current when the vector was made, even once a newer one is
+struct SQArenaAllocator
+{
+    SQArenaAllocator() { _arena = SQArena::_current; }
+    void *Realloc(void *p,SQUnsignedInteger oldsize,SQUnsignedInteger size) { return _arena->Realloc(p,oldsize,size); }
+    void Free(void *p,SQUnsignedInteger size) { _arena->Free(p,size); }
+    SQArena *_arena;
+};
+
 //sqvector mini vector class, supports objects by value
-template<typename T> class sqvector
+template<typename T,typename A = SQVMAllocator> class sqvector : private A
 {
 public:
     sqvector()
@@ -24,11 +79,11 @@ public:
         _size = 0;
         _allocated = 0;
     }
-    sqvector(const sqvector<T>& v)
+    sqvector(const sqvector<T,A>& v)
     {
         copy(v);
     }
-    void copy(const sqvector<T>& v)
+    void copy(const sqvector<T,A>& v)
     {
         if(_size) {
             resize(0); //destroys all previous stuff
@@ -47,7 +102,7 @@ public:
         if(_allocated) {
             for(SQUnsignedInteger i = 0; i < _size; i++)
                 _vals[i].~T();
-            SQ_FREE(_vals, (_allocated * sizeof(T)));
+            A::Free(_vals, (_allocated * sizeof(T)));
         }
     }
     void reserve(SQUnsignedInteger newsize) { _realloc(newsize); }
@@ -106,7 +161,7 @@ private:
     void _realloc(SQUnsignedInteger newsize)
     {
         newsize = (newsize > 0)?newsize:4;
-        _vals = (T*)SQ_REALLOC(_vals, _allocated * sizeof(T), newsize * sizeof(T));
+        _vals = (T*)A::Realloc(_vals, _allocated * sizeof(T), newsize * sizeof(T));
         _allocated = newsize;
     }
     SQUnsignedInteger _size;
@@ -20,7 +20,7 @@
 
 
 //How often to yield to other threads in a multithreading environment
-#define SQ_SUSPEND_INTERVAL 250;
+#define SQ_SUSPEND_INTERVAL 250
 
 //The suspend function is called every N instructions, a little under 1 millisecond.
 //That lets use do true multithreading. 
@@ -137,6 +137,16 @@ SQVM::SQVM(SQSharedState *ss)
     _debughook = false;
     _debughook_native = NULL;
     _debughook_closure.Null();
+    _linepos = NULL;
+    _lineop = _lineline = 0;
+    _striplocals = false;
+    _profiling = false;
+    _profileslots = 0;
+    _profiledropped = 0;
+    _memaccount = NULL;
+#ifdef SQ_INSTRUMENT
+    memset(&_counters,0,sizeof(_counters));
+#endif
     _openouters = NULL;
     ci = NULL;
     _releasehook = NULL;
@@ -153,6 +163,10 @@ void SQVM::Finalize()
     _debughook = false;
     _debughook_native = NULL;
     _debughook_closure.Null();
+    _linefunc.Null();
+    _profiling = false;
+    _profile.resize(0);
+    if(_memaccount) { sq_releasememaccount(_memaccount); _memaccount = NULL; }
     temp_reg.Null();
     _callstackdata.resize(0);
     SQInteger size=_stack.size();
@@ -341,6 +355,13 @@ bool SQVM::StringCat(const SQObjectPtr &str,const SQObjectPtr &obj,SQObjectPtr &
     if(!ToString(str, a)) return false;
     if(!ToString(obj, b)) return false;
     SQInteger l = _string(a)->_len , ol = _string(b)->_len;
+    if(l + ol >= SQ_TRANSIENT_MINLEN) {
+        SQString *t = _ss(this)->_stringtable->NewTransient(l + ol);
+        memcpy(t->_val, _stringval(a), sq_rsl(l));
+        memcpy(t->_val + l, _stringval(b), sq_rsl(ol));
+        dest = t;
+        return true;
+    }
     SQChar *s = _sp(sq_rsl(l + ol + 1));
     memcpy(s, _stringval(a), sq_rsl(l));
     memcpy(s + l, _stringval(b), sq_rsl(ol));
@@ -363,9 +384,13 @@ bool SQVM::TypeOf(const SQObjectPtr &obj1,SQObjectPtr &dest)
 
 bool SQVM::Init(SQVM *friendvm, SQInteger stacksize)
 {
-    _stack.resize(stacksize);
-    _alloccallsstacksize = 4;
-    _callstackdata.resize(_alloccallsstacksize);
+    {
+        //Stacks are touched on every instruction, keep them out of PSRAM
+        SQMemPlacement fast(SQ_MEMTIER_FAST);
+        _stack.resize(stacksize);
+        _alloccallsstacksize = 4;
+        _callstackdata.resize(_alloccallsstacksize);
+    }
     _callsstacksize = 0;
     _callsstack = &_callstackdata[0];
     _stackbase = 0;
@@ -380,6 +405,11 @@ bool SQVM::Init(SQVM *friendvm, SQInteger stacksize)
         _debughook = friendvm->_debughook;
         _debughook_native = friendvm->_debughook_native;
         _debughook_closure = friendvm->_debughook_closure;
+        //Threads a program makes count against that program
+        if(friendvm->_memaccount) {
+            _memaccount = friendvm->_memaccount;
+            _memaccount->refs++;
+        }
     }
 
 
@@ -390,6 +420,7 @@ bool SQVM::Init(SQVM *friendvm, SQInteger stacksize)
 bool SQVM::StartCall(SQClosure *closure,SQInteger target,SQInteger args,SQInteger stackbase,bool tailcall)
 {
     SQFunctionProto *func = closure->_function;
+    SQ_COUNT(this,calls);
 
     SQInteger paramssize = func->_nparameters;
     const SQInteger newtop = stackbase + func->_stacksize;
@@ -658,6 +689,9 @@ bool SQVM::IsEqual(const SQObjectPtr &o1,const SQObjectPtr &o2,bool &res)
 {
     if(sq_type(o1) == sq_type(o2)) {
         res = (_rawval(o1) == _rawval(o2));
+        if(!res && sq_type(o1) == OT_STRING && (_string(o1)->IsTransient() || _string(o2)->IsTransient())) {
+            res = (_string(o1)->_len == _string(o2)->_len) && !memcmp(_stringval(o1), _stringval(o2), sq_rsl(_string(o1)->_len));
+        }
     }
     else {
         if(sq_isnumeric(o1) && sq_isnumeric(o2)) {
@@ -701,6 +735,10 @@ bool SQVM::Execute(SQObjectPtr &closure, SQInteger nargs, SQInteger stackbase,SQ
     if ((_nnativecalls + 1) > MAX_NATIVE_CALLS) { Raise_Error(F("Native stack overflow")); return false; }
     _nnativecalls++;
     AutoDec16 ad(&_nnativecalls);
+
+    SQMemAccountScope memscope(_memaccount);
+    //Over quota from earlier, go through the yield point right away to report it
+    if(_memaccount && _memaccount->exceeded) sqsuspendcountdown = 1;
     SQInteger traps = 0;
     CallInfo *prevci = ci;
 
@@ -734,22 +772,40 @@ exception_restore:
     {
         for(;;)
         {
-
+#ifdef SQ_NO_LINEOPS
+            //Looked at before every instruction, not through the countdown, which nested calls
+            //and other VMs reset
+            if(_debughook) LineHookStep();
+#endif
 
             sqsuspendcountdown --;
             if(sqsuspendcountdown==0)
             {   
                 sqsuspendcountdown = SQ_SUSPEND_INTERVAL;
+                if(_profiling) ProfileSample();
+#ifndef NO_GARBAGE_COLLECTOR
+                //Collection work is done in slices while we hold the GIL
+                _sharedstate->GCYield(this);
+#endif
                 sq_threadyield();
+                //Other VMs may have run and changed the account being charged
+                sq_setcurrentmemaccount(_memaccount);
                 if(stopRequestedFlag)
                 {
                     //This kind of exception we don't handle
                     allowHandleException = false;
                     Raise_Error("Execution stopped via API call"); SQ_THROW(); continue;
                 }
+                bool fatal = false;
+                if(CheckMemAccount(fatal))
+                {
+                    if(fatal) allowHandleException = false;
+                    SQ_THROW(); continue;
+                }
             }
 
             const SQInstruction &_i_ = *ci->_ip++;
+            SQ_COUNT(this,ops[_i_.op]);
             //dumpstack(_stackbase);
             //scprintf("\n[%d] %s %d %d %d %d\n",ci->_ip-_closure(ci->_closure)->_function->_instructions,g_InstrDesc[_i_.op].name,arg0,arg1,arg2,arg3);
             switch(_i_.op)
@@ -1106,6 +1162,7 @@ exception_restore:
     }
 exception_trap:
     {
+        SQ_COUNT(this,exceptions);
         SQObjectPtr currerror = _lasterror;
 //      dumpstack(_stackbase);
 //      SQInteger n = 0;
@@ -1187,10 +1244,97 @@ void SQVM::CallDebugHook(SQInteger type,SQInteger forcedline)
     _debughook = true;
 }
 
+//Raises an error if the memory quota was exceeded since the last check.
+//fatal is set if the account says to stop the VM rather than let the script handle it.
+bool SQVM::CheckMemAccount(bool &fatal)
+{
+    if(!_memaccount || !_memaccount->exceeded) return false;
+    _memaccount->exceeded = SQFalse;
+    fatal = _memaccount->closeonquota ? true : false;
+    Raise_Error(F("Out of memory: quota of %d bytes exceeded (%d in use)"),
+        (int)_memaccount->quota, (int)_memaccount->current);
+    return true;
+}
+
+//There are no _OP_LINE instructions in SQ_NO_LINEOPS builds, so while a debug hook is set
+//Execute comes here before every instruction, and we report a line whenever the next instruction
+//starts a line info entry. Going forward through the same function carries on from the entry
+//reached last time, a call, a return or a jump back starts over.
+void SQVM::LineHookStep()
+{
+    if(sq_type(ci->_closure) != OT_CLOSURE) return;
+    SQFunctionProto *func = _closure(ci->_closure)->_function;
+    SQInteger op = (SQInteger)(ci->_ip - func->_instructions);
+    SQLineInfoReader r(func->_lineinfos,func->_lineinfosize);
+    if(sq_type(_linefunc) == OT_FUNCPROTO && _funcproto(_linefunc) == func && op >= _lineop) {
+        r._p = _linepos;
+        r._op = _lineop;
+        r._line = _lineline;
+    }
+    else {
+        if(!r.Next()) return;
+        _linefunc = func;
+    }
+    for(;;) {
+        SQLineInfoReader n = r;
+        if(!n.Next() || n._op > op) break;
+        r = n;
+    }
+    _linepos = r._p;
+    _lineop = r._op;
+    _lineline = r._line;
+    if(r._op == op) CallDebugHook(_SC('l'),r._line);
+}
+
+void SQVM::ProfileSample()
+{
+    if(!ci || sq_type(ci->_closure) != OT_CLOSURE) return;
+    SQFunctionProto *func = _closure(ci->_closure)->_function;
+    SQInteger line = func->GetLine(ci->_ip);
+    SQUnsignedInteger size = _profile.size();
+    for(SQUnsignedInteger i = 0; i < size; i++) {
+        SQProfileEntry &e = _profile[i];
+        if(_funcproto(e._function) == func && e._line == line) {
+            e._hits++;
+            //Move hot entries toward the front one step at a time, so the
+            //scan stays short and the histogram is almost sorted when dumped.
+            if(i > 0 && _profile[i-1]._hits < e._hits) {
+                SQProfileEntry t = _profile[i-1];
+                _profile[i-1] = e;
+                _profile[i] = t;
+            }
+            return;
+        }
+    }
+    if(size < _profileslots) {
+        SQProfileEntry &e = _profile.push_back();
+        e._function = func;
+        e._line = line;
+        e._hits = 1;
+    }
+    else {
+        _profiledropped++;
+    }
+}
+
+//Insertion sort, hottest first. The histogram is kept nearly sorted so this is close to linear.
+void SQVM::SortProfile()
+{
+    SQUnsignedInteger size = _profile.size();
+    for(SQUnsignedInteger i = 1; i < size; i++) {
+        for(SQUnsignedInteger j = i; j > 0 && _profile[j-1]._hits < _profile[j]._hits; j--) {
+            SQProfileEntry t = _profile[j-1];
+            _profile[j-1] = _profile[j];
+            _profile[j] = t;
+        }
+    }
+}
+
 bool SQVM::CallNative(SQNativeClosure *nclosure, SQInteger nargs, SQInteger newbase, SQObjectPtr &retval, SQInt32 target,bool &suspend, bool &tailcall)
 {
     SQInteger nparamscheck = nclosure->_nparamscheck;
     SQInteger newtop = newbase + nargs + nclosure->_noutervalues;
+    SQ_COUNT(this,nativecalls);
 
     if (_nnativecalls + 1 > MAX_NATIVE_CALLS) {
         Raise_Error(F("Native stack overflow"));
@@ -1228,7 +1372,13 @@ bool SQVM::CallNative(SQNativeClosure *nclosure, SQInteger nargs, SQInteger newb
     }
 
     _nnativecalls++;
+#ifndef NO_GARBAGE_COLLECTOR
+    _sharedstate->_gcnatives++;
+#endif
     SQInteger ret = (nclosure->_function)(this);
+#ifndef NO_GARBAGE_COLLECTOR
+    _sharedstate->_gcnatives--;
+#endif
     _nnativecalls--;
 
     suspend = false;
@@ -1712,6 +1862,7 @@ bool SQVM::EnterFrame(SQInteger newbase, SQInteger newtop, bool tailcall)
             Raise_Error(F("stack overflow, cannot resize stack while in a metamethod"));
             return false;
         }
+        SQMemPlacement fast(SQ_MEMTIER_FAST);
         _stack.resize(newtop + (MIN_STACK_OVERHEAD << 2));
         RelocateOuters();
     }
@@ -34,6 +34,16 @@ struct SQExceptionTrap{
 
 typedef sqvector<SQExceptionTrap> ExceptionsTraps;
 
+//One bucket of the sampling profiler's histogram.
+//Holding the function proto keeps it alive for as long as it is in the histogram.
+struct SQProfileEntry{
+    SQObjectPtr _function;
+    SQInteger _line;
+    SQUnsignedInteger _hits;
+};
+
+typedef sqvector<SQProfileEntry> SQProfileEntryVec;
+
 struct SQVM : public CHAINABLE_OBJ
 {
     struct CallInfo{
@@ -45,7 +55,8 @@ struct SQVM : public CHAINABLE_OBJ
         SQCanBe16 _etraps;
         SQCanBe16 _prevstkbase;
         SQCanBe16 _prevtop;
-        SQCanBe16 _target;
+        //Signed, -1 means the return value is discarded
+        int16_t _target;
         //This limits the stack depth. Oh well.
         SQCanBe16 _ncalls;
         SQBool _root;
@@ -73,6 +84,9 @@ public:
     SQRESULT Suspend();
 
     void CallDebugHook(SQInteger type,SQInteger forcedline=0);
+    void LineHookStep();
+    void ProfileSample();
+    void SortProfile();
     void CallErrorHandler(SQObjectPtr &e);
     bool Get(const SQObjectPtr &self, const SQObjectPtr &key, SQObjectPtr &dest, SQUnsignedInteger getflags, SQInteger selfidx);
     SQInteger FallBackGet(const SQObjectPtr &self,const SQObjectPtr &key,SQObjectPtr &dest);
@@ -127,6 +141,7 @@ public:
     void Finalize();
     void GrowCallStack() {
         SQInteger newsize = _alloccallsstacksize*2;
+        SQMemPlacement fast(SQ_MEMTIER_FAST);
         _callstackdata.resize(newsize);
         _callsstack = &_callstackdata[0];
         _alloccallsstacksize = newsize;
@@ -161,6 +176,28 @@ public:
     bool _debughook;
     SQDEBUGHOOK _debughook_native;
     SQObjectPtr _debughook_closure;
+    //The line info entry LineHookStep last reached, so stepping forward doesn't rescan from the start
+    SQObjectPtr _linefunc;
+    const unsigned char *_linepos;
+    SQInteger _lineop;
+    SQInteger _lineline;
+    //Functions compiled on this VM don't keep local variable names
+    bool _striplocals;
+
+    //Sampling profiler, fed from the periodic yield point in Execute.
+    //The histogram never grows past _profileslots, samples that don't fit are only counted.
+    bool _profiling;
+    SQProfileEntryVec _profile;
+    SQUnsignedInteger _profileslots;
+    SQUnsignedInteger _profiledropped;
+
+    //What this VM's allocations get charged to, the VM holds a reference to it
+    SQMemAccount *_memaccount;
+    bool CheckMemAccount(bool &fatal);
+
+#ifdef SQ_INSTRUMENT
+    SQVMCounters _counters;
+#endif
 
     SQObjectPtr temp_reg;
 
@@ -173,8 +210,11 @@ public:
     ExceptionsTraps _etraps;
     CallInfo *ci;
     SQUserPointer _foreignptr;
-    //VMs sharing the same state
+#ifdef NO_GARBAGE_COLLECTOR
+    //VMs sharing the same state, SQCollectable already has this otherwise
+    //and the collector needs it set there
     SQSharedState *_sharedstate;
+#endif
     SQCanBe16 _nnativecalls;
     SQCanBe16 _nmetamethodscall;
     SQRELEASEHOOK _releasehook;
@@ -192,6 +232,13 @@ struct AutoDec{
     SQInteger *_n;
 };
 
+//Makes a VM's memory account the one being charged for as long as it's in scope
+struct SQMemAccountScope{
+    SQMemAccountScope(SQMemAccount *a) { _prev = sq_setcurrentmemaccount(a); }
+    ~SQMemAccountScope() { sq_setcurrentmemaccount(_prev); }
+    SQMemAccount *_prev;
+};
+
 struct AutoDec16{
     AutoDec16(uint16_t *n) { _n = n; }
 
@@ -204,6 +251,13 @@ inline SQObjectPtr &stack_get(HSQUIRRELVM v,SQInteger idx){return ((idx>=0)?(v->
 
 #define _ss(_vm_) (_vm_)->_sharedstate
 
+//Instrumentation counters, compiled out unless SQ_INSTRUMENT is defined
+#ifdef SQ_INSTRUMENT
+#define SQ_COUNT(_vm_,field) ((_vm_)->_counters.field++)
+#else
+#define SQ_COUNT(_vm_,field)
+#endif
+
 #ifndef NO_GARBAGE_COLLECTOR
 #define _opt_ss(_vm_) (_vm_)->_sharedstate
 #else